@@ -1,13 +1,13 @@
 #include "AuthManager.h"
+#include "../common/Log.h"
 
 #include <sodium.h>
-#include <iostream>
 #include <ctime>
 #include <optional>
 #include <stdexcept>
 
-AuthManager::AuthManager(sqlite3* db)
-    : db(db)
+AuthManager::AuthManager(Database& db, size_t hash_threads, size_t hash_queue)
+    : db(db), hasher(hash_threads, hash_queue)
 {
     if (sodium_init() < 0) {
         throw std::runtime_error("libsodium init failed");
@@ -49,141 +49,138 @@ std::string AuthManager::generate_token() {
     return std::string(token_hex);
 }
 
-bool AuthManager::register_user(const std::string& username, const std::string& password) {
-    std::string pw_hash = hash_password(password);
+AuthResult AuthManager::register_user(const std::string& username, const std::string& password) {
+    std::optional<std::string> pw_hash = hasher.run([&] { return hash_password(password); });
+    if (!pw_hash)
+        return AuthResult::Busy;
 
-    sqlite3_stmt* stmt;
-    const char* sql = "INSERT INTO users (username, password_hash, created_at) VALUES (?, ?, ?);";
-
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "register_user prepare failed: " << sqlite3_errmsg(db) << "\n";
-        return false;
+    Database::Handle conn = db.acquire();
+    Database::Statement stmt = conn.prepare("INSERT INTO users (username, password_hash, created_at) VALUES (?, ?, ?);");
+    if (!stmt) {
+        LOG_ERROR("register_user prepare failed: {}", conn.errmsg());
+        return AuthResult::Failed;
     }
 
     sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, pw_hash.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, pw_hash->c_str(), -1, SQLITE_TRANSIENT);
     sqlite3_bind_int64(stmt, 3, (sqlite3_int64)time(nullptr));
 
-    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
-    if (!ok) {
-        std::cerr << "register_user step failed: " << sqlite3_errmsg(db) << "\n";
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        LOG_ERROR("register_user step failed: {}", conn.errmsg());
+        return AuthResult::Failed;
     }
-
-    sqlite3_finalize(stmt);
-    return ok;
+    return AuthResult::Ok;
 }
 
-std::optional<std::string> AuthManager::login(const std::string& username, const std::string& password) {
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT id, password_hash FROM users WHERE username = ?;";
+AuthResult AuthManager::login(const std::string& username, const std::string& password, std::string& token) {
+    int user_id;
+    std::string stored_hash;
+    {
+        Database::Handle conn = db.acquire();
+        Database::Statement stmt = conn.prepare("SELECT id, password_hash FROM users WHERE username = ?;");
+        if (!stmt) {
+            LOG_ERROR("login prepare failed: {}", conn.errmsg());
+            return AuthResult::Failed;
+        }
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "login prepare failed: " << sqlite3_errmsg(db) << "\n";
-        return std::nullopt;
-    }
+        sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
 
-    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt) != SQLITE_ROW)
+            return AuthResult::Failed;
 
-    if (sqlite3_step(stmt) != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
-        return std::nullopt;
+        user_id = sqlite3_column_int(stmt, 0);
+        const unsigned char* ph = sqlite3_column_text(stmt, 1);
+        stored_hash = ph ? reinterpret_cast<const char*>(ph) : "";
     }
 
-    int user_id = sqlite3_column_int(stmt, 0);
-    const unsigned char* ph = sqlite3_column_text(stmt, 1);
-    std::string stored_hash = ph ? reinterpret_cast<const char*>(ph) : "";
-
-    sqlite3_finalize(stmt);
-
-    if (!verify_password(password, stored_hash))
-        return std::nullopt;
+    // Password hashing is slow; never hold a pooled connection across it
+    std::optional<bool> verified = hasher.run([&] { return verify_password(password, stored_hash); });
+    if (!verified)
+        return AuthResult::Busy;
+    if (!*verified)
+        return AuthResult::Failed;
 
     // generate token and store in sessions table
-    std::string token = generate_token();
+    std::string new_token = generate_token();
     time_t now = time(nullptr);
     time_t expires = now + 24*3600; // 24h
 
-    sqlite3_stmt* ins;
-    const char* ins_sql = "INSERT INTO sessions (token, user_id, expires_at, created_at) VALUES (?, ?, ?, ?);";
-
-    if (sqlite3_prepare_v2(db, ins_sql, -1, &ins, nullptr) != SQLITE_OK) {
-        std::cerr << "login insert prepare failed: " << sqlite3_errmsg(db) << "\n";
-        return std::nullopt;
+    Database::Handle conn = db.acquire();
+    Database::Statement ins = conn.prepare("INSERT INTO sessions (token, user_id, expires_at, created_at) VALUES (?, ?, ?, ?);");
+    if (!ins) {
+        LOG_ERROR("login insert prepare failed: {}", conn.errmsg());
+        return AuthResult::Failed;
     }
 
-    sqlite3_bind_text(ins, 1, token.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(ins, 1, new_token.c_str(), -1, SQLITE_TRANSIENT);
     sqlite3_bind_int(ins, 2, user_id);
     sqlite3_bind_int64(ins, 3, (sqlite3_int64)expires);
     sqlite3_bind_int64(ins, 4, (sqlite3_int64)now);
 
-    bool ok = sqlite3_step(ins) == SQLITE_DONE;
-    if (!ok) {
-        std::cerr << "login insert failed: " << sqlite3_errmsg(db) << "\n";
-        sqlite3_finalize(ins);
-        return std::nullopt;
+    if (sqlite3_step(ins) != SQLITE_DONE) {
+        LOG_ERROR("login insert failed: {}", conn.errmsg());
+        return AuthResult::Failed;
     }
 
-    sqlite3_finalize(ins);
-    return token;
+    token_cache.insert(new_token, TokenCache::Entry{user_id, username, expires});
+    token = new_token;
+    return AuthResult::Ok;
 }
 
 bool AuthManager::validate_token(const std::string& token) {
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT user_id FROM sessions WHERE token = ? AND expires_at > ?;";
-
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "validate_token prepare failed: " << sqlite3_errmsg(db) << "\n";
-        return false;
-    }
-
-    sqlite3_bind_text(stmt, 1, token.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int64(stmt, 2, (sqlite3_int64)time(nullptr));
-
-    bool valid = sqlite3_step(stmt) == SQLITE_ROW;
-    sqlite3_finalize(stmt);
-    return valid;
+    return resolve_token(token).has_value();
 }
 
+// The row goes first and the cache entry after it: a resolve_token that
+// read the row before the delete holds an older ticket and won't re-cache it
 void AuthManager::logout(const std::string& token) {
-    sqlite3_stmt* stmt;
-    const char* sql = "DELETE FROM sessions WHERE token = ?;";
-
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "logout prepare failed: " << sqlite3_errmsg(db) << "\n";
-        return;
+    {
+        Database::Handle conn = db.acquire();
+        Database::Statement stmt = conn.prepare("DELETE FROM sessions WHERE token = ?;");
+        if (!stmt) {
+            LOG_ERROR("logout prepare failed: {}", conn.errmsg());
+        } else {
+            sqlite3_bind_text(stmt, 1, token.c_str(), -1, SQLITE_TRANSIENT);
+            if (sqlite3_step(stmt) != SQLITE_DONE)
+                LOG_ERROR("logout step failed: {}", conn.errmsg());
+        }
     }
+    token_cache.erase(token);
+}
 
-    sqlite3_bind_text(stmt, 1, token.c_str(), -1, SQLITE_TRANSIENT);
+std::optional<TokenCache::Entry> AuthManager::resolve_token(const std::string& token) {
+    if (auto cached = token_cache.lookup(token))
+        return cached;
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        std::cerr << "logout step failed: " << sqlite3_errmsg(db) << "\n";
+    uint64_t ticket = token_cache.ticket(token);
+    std::optional<TokenCache::Entry> result;
+    {
+        Database::Handle conn = db.acquire();
+        Database::Statement stmt = conn.prepare(
+            "SELECT u.id, u.username, s.expires_at "
+            "FROM sessions s "
+            "JOIN users u ON s.user_id = u.id "
+            "WHERE s.token = ? AND s.expires_at > ?;");
+        if (!stmt) {
+            LOG_ERROR("resolve_token prepare failed: {}", conn.errmsg());
+            return std::nullopt;
+        }
+        sqlite3_bind_text(stmt, 1, token.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, (sqlite3_int64)time(nullptr));
+
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            const unsigned char* uname = sqlite3_column_text(stmt, 1);
+            if (uname) {
+                result = TokenCache::Entry{
+                    sqlite3_column_int(stmt, 0),
+                    std::string(reinterpret_cast<const char*>(uname)),
+                    (time_t)sqlite3_column_int64(stmt, 2)
+                };
+            }
+        }
     }
 
-    sqlite3_finalize(stmt);
+    if (result)
+        token_cache.insert(token, *result, ticket);
+    return result;
 }
-
-std::string AuthManager::username_from_token(const std::string& token) {
-    std::cout << token << std::endl;
-    sqlite3_stmt* stmt;
-    const char* sql =
-        "SELECT u.username "
-        "FROM sessions s "
-        "JOIN users u ON s.user_id = u.id "
-        "WHERE s.token = ? AND s.expires_at > ?;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "username_from_token prepare failed: " << sqlite3_errmsg(db) << "\n";
-        return "NULL";
-    }
-    sqlite3_bind_text(stmt, 1, token.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int64(stmt, 2, (sqlite3_int64)time(nullptr));
-    std::optional<std::string> result;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const unsigned char* uname = sqlite3_column_text(stmt, 0);
-        if (uname) result = std::string(reinterpret_cast<const char*>(uname));
-    }
-    sqlite3_finalize(stmt);
-    if (!result.has_value()) {
-        throw std::runtime_error("Invalid or expired token");
-    }
-    return result.value();
-}
\ No newline at end of file
@@ -4,19 +4,27 @@
 #include <sqlite3.h>
 
 #include "../database/Database.h"
+#include "TokenCache.h"
+#include "HashExecutor.h"
+
+// Busy means the hashing executor refused the work; the client may retry
+enum class AuthResult { Ok, Failed, Busy };
 
 class AuthManager {
 public:
-    AuthManager(sqlite3* db);
+    AuthManager(Database& db, size_t hash_threads = 2, size_t hash_queue = 1);
 
-    bool register_user(const std::string& username, const std::string& password);
-    std::optional<std::string> login(const std::string& username, const std::string& password);
+    AuthResult register_user(const std::string& username, const std::string& password);
+    AuthResult login(const std::string& username, const std::string& password, std::string& token);
     bool validate_token(const std::string& token);
     void logout(const std::string& token);
-    std::string username_from_token(const std::string& token);
+    std::optional<TokenCache::Entry> resolve_token(const std::string& token);   // cache first, then SQLite
+    HashExecutor::Stats hash_stats() const { return hasher.stats(); }
 
 private:
-    sqlite3* db;
+    Database& db;
+    TokenCache token_cache;
+    HashExecutor hasher;
 
     std::string generate_token();
     bool verify_password(const std::string& password, const std::string& stored_hash);
@@ -0,0 +1,102 @@
+#include "HashExecutor.h"
+
+#include "../common/Metrics.h"
+
+HashExecutor::HashExecutor(size_t num_threads, size_t max_queued, std::chrono::milliseconds max_wait)
+    : max_queued(max_queued), max_wait(max_wait)
+{
+    if (num_threads == 0)
+        num_threads = 1;
+    for (size_t i = 0; i < num_threads; ++i)
+        workers.emplace_back(&HashExecutor::worker_loop, this);
+}
+
+HashExecutor::~HashExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+    cv.notify_all();
+    for (std::thread& t : workers)
+        t.join();
+}
+
+// Admission control: a job is accepted only if a thread is free to take it or
+// there is room in the queue. Callers turn a refusal into a "busy" reply.
+bool HashExecutor::try_push(Job job) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (stop || in_flight >= max_queued + workers.size()) {
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            Metrics::add(Metrics::Counter::HashRejected);
+            return false;
+        }
+        jobs.push_back(std::move(job));
+        ++in_flight;
+    }
+    cv.notify_one();
+    return true;
+}
+
+void HashExecutor::worker_loop() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this] { return stop || !jobs.empty(); });
+            if (jobs.empty())
+                return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        Clock::time_point started = Clock::now();
+        auto waited = std::chrono::duration_cast<std::chrono::microseconds>(started - job.enqueued);
+        wait_us_total.fetch_add(waited.count(), std::memory_order_relaxed);
+        record_max(wait_us_max, waited.count());
+        Metrics::observe(Metrics::Timer::HashQueueWait, (uint64_t)waited.count());
+
+        // The client has probably given up on a job that sat this long; skip the hash
+        if (waited > max_wait) {
+            expired.fetch_add(1, std::memory_order_relaxed);
+            Metrics::add(Metrics::Counter::HashExpired);
+            job.fn(true);
+            continue;
+        }
+
+        job.fn(false);
+
+        auto ran = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started);
+        hash_us_total.fetch_add(ran.count(), std::memory_order_relaxed);
+        record_max(hash_us_max, ran.count());
+        Metrics::observe(Metrics::Timer::PasswordHash, (uint64_t)ran.count());
+        completed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void HashExecutor::finish() {
+    std::lock_guard<std::mutex> lock(mtx);
+    --in_flight;
+}
+
+void HashExecutor::record_max(std::atomic<uint64_t>& slot, uint64_t value) {
+    uint64_t current = slot.load(std::memory_order_relaxed);
+    while (value > current && !slot.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+HashExecutor::Stats HashExecutor::stats() const {
+    Stats s;
+    s.completed = completed.load(std::memory_order_relaxed);
+    s.rejected = rejected.load(std::memory_order_relaxed);
+    s.expired = expired.load(std::memory_order_relaxed);
+    s.hash_us_total = hash_us_total.load(std::memory_order_relaxed);
+    s.hash_us_max = hash_us_max.load(std::memory_order_relaxed);
+    s.wait_us_total = wait_us_total.load(std::memory_order_relaxed);
+    s.wait_us_max = wait_us_max.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        s.queued = jobs.size();
+    }
+    return s;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Small fixed-size executor for password hashing. crypto_pwhash is slow and
+// needs tens of megabytes per call, so it runs here with a hard concurrency
+// cap instead of on the connection workers. When every thread is busy and the
+// queue is full, work is refused immediately rather than queued.
+class HashExecutor {
+public:
+    struct Stats {
+        uint64_t completed;
+        uint64_t rejected;        // refused because the queue was full
+        uint64_t expired;         // dropped after waiting longer than max_wait
+        uint64_t hash_us_total;   // time spent running jobs
+        uint64_t hash_us_max;
+        uint64_t wait_us_total;   // time jobs spent queued before starting
+        uint64_t wait_us_max;
+        size_t queued;
+    };
+
+    HashExecutor(size_t num_threads, size_t max_queued,
+                 std::chrono::milliseconds max_wait = std::chrono::milliseconds(2000));
+    ~HashExecutor();
+
+    HashExecutor(const HashExecutor&) = delete;
+    HashExecutor& operator=(const HashExecutor&) = delete;
+
+    // Run fn on a hashing thread and wait for its result. Returns nullopt
+    // when the executor is saturated; exceptions from fn are rethrown here.
+    template <class F>
+    auto run(F fn) -> std::optional<decltype(fn())>;
+
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+        std::function<void(bool expired)> fn;
+        Clock::time_point enqueued;
+    };
+
+    bool try_push(Job job);
+    void worker_loop();
+    void finish();
+    static void record_max(std::atomic<uint64_t>& slot, uint64_t value);
+
+    std::vector<std::thread> workers;
+    std::deque<Job> jobs;
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    bool stop = false;
+    size_t in_flight = 0;     // queued plus running
+    size_t max_queued;
+    std::chrono::milliseconds max_wait;
+
+    std::atomic<uint64_t> completed{0};
+    std::atomic<uint64_t> rejected{0};
+    std::atomic<uint64_t> expired{0};
+    std::atomic<uint64_t> hash_us_total{0};
+    std::atomic<uint64_t> hash_us_max{0};
+    std::atomic<uint64_t> wait_us_total{0};
+    std::atomic<uint64_t> wait_us_max{0};
+};
+
+template <class F>
+auto HashExecutor::run(F fn) -> std::optional<decltype(fn())> {
+    using Result = decltype(fn());
+
+    auto promise = std::make_shared<std::promise<std::optional<Result>>>();
+    std::future<std::optional<Result>> result = promise->get_future();
+
+    Job job;
+    // The slot is released before the caller wakes, so a client's next
+    // request never finds its own finished job still counted
+    job.fn = [this, promise, fn = std::move(fn)](bool expired) mutable {
+        if (expired) {
+            finish();
+            promise->set_value(std::nullopt);
+            return;
+        }
+        try {
+            std::optional<Result> value = fn();
+            finish();
+            promise->set_value(std::move(value));
+        } catch (...) {
+            finish();
+            promise->set_exception(std::current_exception());
+        }
+    };
+    job.enqueued = Clock::now();
+
+    if (!try_push(std::move(job)))
+        return std::nullopt;
+    return result.get();
+}
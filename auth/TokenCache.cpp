@@ -0,0 +1,88 @@
+#include "TokenCache.h"
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+
+TokenCache::TokenCache(size_t max_entries, time_t max_ttl)
+    : max_per_shard(std::max<size_t>(1, max_entries / SHARDS)), max_ttl(max_ttl)
+{
+}
+
+TokenCache::Shard& TokenCache::shard_for(const std::string& token) {
+    return shards[std::hash<std::string>{}(token) % SHARDS];
+}
+
+std::optional<TokenCache::Entry> TokenCache::lookup(const std::string& token) {
+    Shard& shard = shard_for(token);
+    time_t now = time(nullptr);
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mtx);
+        auto it = shard.map.find(token);
+        if (it == shard.map.end())
+            return std::nullopt;
+        if (it->second.valid_until > now)
+            return it->second.entry;
+    }
+
+    // Expired: drop it so the next lookup goes back to the database
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    auto it = shard.map.find(token);
+    if (it != shard.map.end() && it->second.valid_until <= now)
+        shard.map.erase(it);
+    return std::nullopt;
+}
+
+void TokenCache::insert(const std::string& token, const Entry& entry) {
+    Shard& shard = shard_for(token);
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    insert_locked(shard, token, entry);
+}
+
+uint64_t TokenCache::ticket(const std::string& token) {
+    Shard& shard = shard_for(token);
+    std::shared_lock<std::shared_mutex> lock(shard.mtx);
+    return shard.erasures;
+}
+
+void TokenCache::insert(const std::string& token, const Entry& entry, uint64_t ticket) {
+    Shard& shard = shard_for(token);
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    if (shard.erasures == ticket)
+        insert_locked(shard, token, entry);
+}
+
+void TokenCache::insert_locked(Shard& shard, const std::string& token, const Entry& entry) {
+    time_t now = time(nullptr);
+    time_t valid_until = std::min(entry.expires_at, now + max_ttl);
+    if (valid_until <= now)
+        return;
+
+    if (shard.map.size() >= max_per_shard && shard.map.find(token) == shard.map.end()) {
+        // Full: sweep expired entries first, then evict an arbitrary one
+        for (auto it = shard.map.begin(); it != shard.map.end();) {
+            if (it->second.valid_until <= now)
+                it = shard.map.erase(it);
+            else
+                ++it;
+        }
+        if (shard.map.size() >= max_per_shard)
+            shard.map.erase(shard.map.begin());
+    }
+    shard.map[token] = Cached{entry, valid_until};
+}
+
+void TokenCache::erase(const std::string& token) {
+    Shard& shard = shard_for(token);
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    shard.map.erase(token);
+    ++shard.erasures;
+}
+
+void TokenCache::clear() {
+    for (Shard& shard : shards) {
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        shard.map.clear();
+        ++shard.erasures;
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// Sharded in-memory map of session token -> (user id, username, expiry) that
+// sits in front of the sessions table. Readers of different shards never
+// contend, and readers of the same shard share the lock.
+class TokenCache {
+public:
+    struct Entry {
+        int user_id;
+        std::string username;
+        time_t expires_at;     // session expiry from the database
+    };
+
+    // max_ttl bounds how long an entry is trusted without going back to SQLite
+    explicit TokenCache(size_t max_entries = 64 * 1024, time_t max_ttl = 300);
+
+    std::optional<Entry> lookup(const std::string& token);
+    void insert(const std::string& token, const Entry& entry);
+
+    // Taken before reading the database; the insert is skipped if the token
+    // was erased since, so a concurrent logout can't be undone by a stale row
+    uint64_t ticket(const std::string& token);
+    void insert(const std::string& token, const Entry& entry, uint64_t ticket);
+    void erase(const std::string& token);
+    void clear();
+
+private:
+    static constexpr size_t SHARDS = 16;
+
+    struct Cached {
+        Entry entry;
+        time_t valid_until;    // min(session expiry, insert time + max_ttl)
+    };
+
+    struct Shard {
+        std::shared_mutex mtx;
+        std::unordered_map<std::string, Cached> map;
+        uint64_t erasures = 0;
+    };
+
+    Shard& shard_for(const std::string& token);
+    void insert_locked(Shard& shard, const std::string& token, const Entry& entry);
+
+    std::array<Shard, SHARDS> shards;
+    size_t max_per_shard;
+    time_t max_ttl;
+};
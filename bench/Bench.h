@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Helpers shared by the programs under bench/. Each one prints a small table
+// for the machine it runs on; nothing is asserted, the numbers are for
+// comparing builds and settings.
+namespace Bench {
+    inline double now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Fastest of several runs of fn, in seconds: the one least disturbed by
+    // the rest of the machine
+    template <class F>
+    double best_of(int runs, F&& fn) {
+        double best = 1e300;
+        for (int i = 0; i < runs; ++i) {
+            double start = now();
+            fn();
+            double elapsed = now() - start;
+            if (elapsed < best)
+                best = elapsed;
+        }
+        return best;
+    }
+
+    // --name=value from argv, or fallback
+    inline long arg(int argc, char** argv, const char* name, long fallback) {
+        std::string prefix = std::string("--") + name + "=";
+        for (int i = 1; i < argc; ++i)
+            if (strncmp(argv[i], prefix.c_str(), prefix.size()) == 0)
+                return std::atol(argv[i] + prefix.size());
+        return fallback;
+    }
+}
@@ -0,0 +1,151 @@
+#include "../auth/AuthManager.h"
+#include "../database/Database.h"
+#include "Bench.h"
+
+#include <sodium.h>
+#include <sqlite3.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+void initialize_schema(Database& db);
+
+// Session-token resolutions per second, the check every command makes.
+//
+//   bench/auth [--tokens=N] [--lookups=N] [--pool=N]
+//
+// "one connection": the old path, a statement prepared per call on a single
+//                   shared sqlite3 handle.
+// "pooled":         the same JOIN on pooled connections with cached
+//                   statements, which is what a TokenCache miss costs.
+// "cached":         AuthManager::resolve_token once the TokenCache is warm.
+namespace {
+    const char* const RESOLVE_SQL =
+        "SELECT u.id, u.username, s.expires_at "
+        "FROM sessions s "
+        "JOIN users u ON s.user_id = u.id "
+        "WHERE s.token = ? AND s.expires_at > ?;";
+
+    bool resolve_one_connection(sqlite3* db, const std::string& token) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, RESOLVE_SQL, -1, &stmt, nullptr) != SQLITE_OK)
+            return false;
+        sqlite3_bind_text(stmt, 1, token.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, (sqlite3_int64)time(nullptr));
+        bool found = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+        return found;
+    }
+
+    bool resolve_pooled(Database& db, const std::string& token) {
+        Database::Handle conn = db.acquire();
+        Database::Statement stmt = conn.prepare(RESOLVE_SQL);
+        if (!stmt)
+            return false;
+        sqlite3_bind_text(stmt, 1, token.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, (sqlite3_int64)time(nullptr));
+        return sqlite3_step(stmt) == SQLITE_ROW;
+    }
+
+    // Runs fn(token) lookups times split across threads; returns lookups/s
+    template <class F>
+    double run(int threads, long lookups, const std::vector<std::string>& tokens, F&& fn) {
+        std::atomic<long> misses{0};
+        long per = lookups / threads;
+        double start = Bench::now();
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                for (long i = 0; i < per; ++i)
+                    if (!fn(tokens[(size_t)(i * 7 + t) % tokens.size()]))
+                        misses.fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+        for (auto& w : workers)
+            w.join();
+        double elapsed = Bench::now() - start;
+        if (misses.load() > 0)
+            std::fprintf(stderr, "auth: %ld lookups failed\n", misses.load());
+        return (double)(per * threads) / elapsed;
+    }
+}
+
+int main(int argc, char** argv) {
+    long ntokens = Bench::arg(argc, argv, "tokens", 1000);
+    long lookups = Bench::arg(argc, argv, "lookups", 200000);
+    long pool = Bench::arg(argc, argv, "pool", 8);
+
+    if (sodium_init() < 0) {
+        std::fprintf(stderr, "auth: sodium_init failed\n");
+        return 1;
+    }
+    char dir[] = "/tmp/bench_auth_XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string path = std::string(dir) + "/bench.db";
+
+    std::vector<std::string> tokens;
+    {
+        Database db(path, 8);
+        initialize_schema(db);
+        AuthManager auth(db);
+        std::string token;
+        if (auth.register_user("bench", "bench-password") != AuthResult::Ok ||
+            auth.login("bench", "bench-password", token) != AuthResult::Ok) {
+            std::fprintf(stderr, "auth: could not create the bench user\n");
+            return 1;
+        }
+        tokens.push_back(token);
+
+        // The rest of the sessions go straight into the table; a login per
+        // token would spend the whole setup in Argon2
+        Database::Handle conn = db.acquire();
+        conn.exec("BEGIN;");
+        Database::Statement stmt = conn.prepare(
+            "INSERT INTO sessions (token, user_id, expires_at, created_at) "
+            "SELECT ?, user_id, expires_at, created_at FROM sessions LIMIT 1;");
+        for (long i = 1; i < ntokens; ++i) {
+            std::string t = "bench-token-" + std::to_string(i);
+            sqlite3_bind_text(stmt, 1, t.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+            tokens.push_back(t);
+        }
+        conn.exec("COMMIT;");
+    }
+
+    Database db(path, (size_t)pool);
+    AuthManager auth(db);
+    sqlite3* single = nullptr;
+    if (sqlite3_open(path.c_str(), &single) != SQLITE_OK) {
+        std::fprintf(stderr, "auth: sqlite3_open failed\n");
+        return 1;
+    }
+    for (const std::string& t : tokens)
+        auth.resolve_token(t);
+
+    std::printf("%ld sessions, %ld pooled connections, %ld lookups per run, thousand lookups/s\n",
+                ntokens, pool, lookups);
+    std::printf("%-8s %16s %16s %16s\n", "threads", "one connection", "pooled", "cached");
+    for (int threads : {1, 2, 4, 8}) {
+        double old_path = run(threads, lookups, tokens,
+                              [&](const std::string& t) { return resolve_one_connection(single, t); });
+        double pooled = run(threads, lookups, tokens,
+                            [&](const std::string& t) { return resolve_pooled(db, t); });
+        double cached = run(threads, lookups, tokens,
+                            [&](const std::string& t) { return auth.resolve_token(t).has_value(); });
+        std::printf("%-8d %16.1f %16.1f %16.1f\n", threads, old_path / 1e3, pooled / 1e3, cached / 1e3);
+    }
+
+    sqlite3_close(single);
+    unlink(path.c_str());
+    unlink((path + "-wal").c_str());
+    unlink((path + "-shm").c_str());
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "../common/BufferPool.h"
+#include "../common/DiskWriter.h"
+#include "Bench.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+// Upload ingest throughput: DiskWriter's io_uring and writer-thread backends
+// against the pwrite-per-chunk receive loop they replaced.
+//
+//   bench/disk_writer [--mb=N] [--chunk-kb=N] [--depth=N]
+//
+// Receiving is modelled as a sleep at a fixed link rate followed by filling
+// the buffer, so the receiver waits the way it would on a socket. Each run
+// writes a fresh file in /var/tmp and ends with fdatasync, so the disk time
+// is counted.
+namespace {
+    void receive_at(double mb_per_s, char* data, size_t len, uint64_t offset) {
+        if (mb_per_s > 0)
+            std::this_thread::sleep_for(std::chrono::duration<double>((double)len / (mb_per_s * 1e6)));
+        memset(data, (int)(offset >> 20), len);
+    }
+
+    int fresh_file(char* path) {
+        strcpy(path, "/var/tmp/bench_disk_writer_XXXXXX");
+        int fd = mkstemp(path);
+        if (fd != -1)
+            unlink(path);
+        return fd;
+    }
+
+    bool pwrite_loop(uint64_t size, double rate) {
+        char path[64];
+        int fd = fresh_file(path);
+        if (fd == -1)
+            return false;
+        BufferPool::Lease buffer = BufferPool::instance().acquire();
+        bool ok = true;
+        for (uint64_t offset = 0; ok && offset < size; offset += buffer.size()) {
+            receive_at(rate, buffer.data(), buffer.size(), offset);
+            ok = pwrite(fd, buffer.data(), buffer.size(), (off_t)offset) == (ssize_t)buffer.size();
+        }
+        ok = ok && fdatasync(fd) == 0;
+        close(fd);
+        return ok;
+    }
+
+    bool disk_writer(uint64_t size, double rate, const DiskWriter::Options& options) {
+        char path[64];
+        int fd = fresh_file(path);
+        if (fd == -1)
+            return false;
+        bool ok;
+        {
+            DiskWriter writer(fd, 0, size, options);
+            for (uint64_t offset = 0; offset < size;) {
+                BufferPool::Lease buffer = writer.acquire();
+                if (!buffer)
+                    break;
+                size_t len = buffer.size();
+                receive_at(rate, buffer.data(), len, offset);
+                writer.submit(std::move(buffer), len, offset);
+                offset += len;
+            }
+            ok = writer.finish();
+        }
+        close(fd);
+        return ok;
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t size = (uint64_t)Bench::arg(argc, argv, "mb", 512) << 20;
+    BufferPool::instance().configure((size_t)Bench::arg(argc, argv, "chunk-kb", 1024) << 10);
+
+    DiskWriter::Options threaded;
+    threaded.queue_depth = (unsigned)Bench::arg(argc, argv, "depth", 4);
+    threaded.sync = DiskWriter::Sync::End;
+    threaded.io_uring = false;
+    DiskWriter::Options uring = threaded;
+    uring.io_uring = true;
+
+    bool have_uring;
+    {
+        char path[64];
+        int fd = fresh_file(path);
+        DiskWriter probe(fd, 0, 0, uring);
+        have_uring = probe.using_io_uring();
+        probe.finish();
+        close(fd);
+    }
+
+    std::printf("%llu MiB per run, %zu KiB chunks, depth %u, MB/s ingested\n",
+                (unsigned long long)(size >> 20), BufferPool::instance().chunk_size() >> 10, threaded.queue_depth);
+    std::printf("%-12s %12s %14s %12s\n", "link", "pwrite loop", "writer thread", "io_uring");
+    for (double rate : {0.0, 250.0, 500.0, 1000.0, 2000.0}) {
+        auto measure = [&](auto&& run) {
+            double elapsed = Bench::best_of(3, [&] {
+                if (!run())
+                    std::fprintf(stderr, "disk_writer: a write failed\n");
+            });
+            return (double)size / 1e6 / elapsed;
+        };
+        double plain = measure([&] { return pwrite_loop(size, rate); });
+        double thread = measure([&] { return disk_writer(size, rate, threaded); });
+        char link[32], ring[32];
+        if (rate > 0)
+            std::snprintf(link, sizeof(link), "%.0f MB/s", rate);
+        else
+            std::snprintf(link, sizeof(link), "unlimited");
+        if (have_uring)
+            std::snprintf(ring, sizeof(ring), "%.0f", measure([&] { return disk_writer(size, rate, uring); }));
+        else
+            std::snprintf(ring, sizeof(ring), "n/a");
+        std::printf("%-12s %12.0f %14.0f %12s\n", link, plain, thread, ring);
+        std::fflush(stdout);
+    }
+    return 0;
+}
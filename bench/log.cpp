@@ -0,0 +1,89 @@
+#include "../common/Log.h"
+#include "Bench.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Cost of a log call on the calling thread: LOG_INFO against the
+// std::cout << ... << std::endl lines it replaced.
+//
+//   bench/log [--events=N]
+//
+// stdout goes to a scratch file so the lines that were actually written
+// can be counted; LOG_INFO drops records when a thread outruns the flusher,
+// so "written" is reported next to the per-call cost.
+namespace {
+    template <class F>
+    double per_call_ns(int threads, long events, F&& fn) {
+        double start = Bench::now();
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t)
+            workers.emplace_back([&, t] {
+                for (long i = 0; i < events; ++i)
+                    fn(t, i);
+            });
+        for (auto& w : workers)
+            w.join();
+        return (Bench::now() - start) * 1e9 / (double)events;
+    }
+
+    long lines_in(int fd) {
+        long lines = 0;
+        char buf[1 << 16];
+        ssize_t n;
+        lseek(fd, 0, SEEK_SET);
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+            for (ssize_t i = 0; i < n; ++i)
+                lines += buf[i] == '\n';
+        ftruncate(fd, 0);
+        lseek(fd, 0, SEEK_SET);
+        return lines;
+    }
+}
+
+int main(int argc, char** argv) {
+    long events = Bench::arg(argc, argv, "events", 200000);
+
+    FILE* report = fdopen(dup(STDOUT_FILENO), "w");
+    char path[] = "/tmp/bench_log_XXXXXX";
+    int scratch = mkstemp(path);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (!report || scratch == -1 || null_fd == -1) {
+        perror("bench/log");
+        return 1;
+    }
+    unlink(path);
+    dup2(scratch, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);    // the logger's "records dropped" notices
+    Log::set_level(Log::Level::Info);
+
+    const std::string name = "example.txt";
+    std::fprintf(report, "%ld events per thread, ns per call on each thread, lines written\n", events);
+    std::fprintf(report, "%-8s %12s %10s %12s %10s\n", "threads", "std::cout", "written", "LOG_INFO", "written");
+    for (int threads : {1, 2, 4, 8}) {
+        long expected = events * threads;
+
+        double cout_ns = per_call_ns(threads, events, [&](int t, long i) {
+            std::cout << "Stored " << name << " for session " << t << ", " << i << " bytes" << std::endl;
+        });
+        long cout_lines = lines_in(scratch);
+
+        double log_ns = per_call_ns(threads, events, [&](int t, long i) {
+            LOG_INFO("Stored {} for session {}, {} bytes", name, t, i);
+        });
+        Log::flush();
+        long log_lines = lines_in(scratch);
+
+        std::fprintf(report, "%-8d %12.0f %9.1f%% %12.0f %9.1f%%\n", threads,
+                     cout_ns, 100.0 * (double)cout_lines / (double)expected,
+                     log_ns, 100.0 * (double)log_lines / (double)expected);
+        std::fflush(report);
+    }
+    return 0;
+}
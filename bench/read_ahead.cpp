@@ -0,0 +1,105 @@
+#include "../common/BufferPool.h"
+#include "../common/ReadAhead.h"
+#include "Bench.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// Buffered download throughput from a cold page cache: ReadAhead against the
+// pread-then-send loop it replaced.
+//
+//   bench/read_ahead [--mb=N] [--chunk-kb=N]
+//
+// The file lives in /var/tmp and is dropped from the page cache before each
+// run. Sending is modelled as a sleep at a fixed link rate, so the sender
+// waits the way a socket would without taking the CPU from the reader.
+namespace {
+    void drop_cache(int fd) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+
+    void send_at(double mb_per_s, size_t len) {
+        if (mb_per_s > 0)
+            std::this_thread::sleep_for(std::chrono::duration<double>((double)len / (mb_per_s * 1e6)));
+    }
+
+    bool pread_loop(int fd, uint64_t size, double rate) {
+        BufferPool::Lease buffer = BufferPool::instance().acquire();
+        uint64_t offset = 0;
+        while (offset < size) {
+            ssize_t n = pread(fd, buffer.data(), buffer.size(), (off_t)offset);
+            if (n <= 0)
+                return false;
+            offset += (uint64_t)n;
+            send_at(rate, (size_t)n);
+        }
+        return true;
+    }
+
+    bool read_ahead(int fd, uint64_t size, double rate) {
+        ReadAhead reader(fd, 0, size);
+        BufferPool::Lease buffer;
+        size_t n = 0;
+        while (true) {
+            if (!reader.next(buffer, n))
+                return false;
+            if (n == 0)
+                return true;
+            send_at(rate, n);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t size = (uint64_t)Bench::arg(argc, argv, "mb", 256) << 20;
+    BufferPool::instance().configure((size_t)Bench::arg(argc, argv, "chunk-kb", 1024) << 10);
+
+    char path[] = "/var/tmp/bench_read_ahead_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(path);
+    {
+        std::vector<char> block(1 << 20);
+        for (size_t i = 0; i < block.size(); ++i)
+            block[i] = (char)(i * 2654435761u >> 13);
+        for (uint64_t done = 0; done < size; done += block.size()) {
+            if (write(fd, block.data(), block.size()) != (ssize_t)block.size()) {
+                perror("write");
+                return 1;
+            }
+        }
+    }
+
+    std::printf("%llu MiB file, %zu KiB chunks, cold cache, MB/s delivered\n",
+                (unsigned long long)(size >> 20), BufferPool::instance().chunk_size() >> 10);
+    std::printf("%-16s %12s %12s\n", "link", "pread loop", "read-ahead");
+    for (double rate : {0.0, 200.0, 500.0, 1000.0, 2000.0}) {
+        double sync = Bench::best_of(3, [&] {
+            drop_cache(fd);
+            if (!pread_loop(fd, size, rate))
+                std::fprintf(stderr, "read_ahead: pread failed\n");
+        });
+        double ahead = Bench::best_of(3, [&] {
+            drop_cache(fd);
+            if (!read_ahead(fd, size, rate))
+                std::fprintf(stderr, "read_ahead: ReadAhead failed\n");
+        });
+        char link[32];
+        if (rate > 0)
+            std::snprintf(link, sizeof(link), "%.0f MB/s", rate);
+        else
+            std::snprintf(link, sizeof(link), "unlimited");
+        std::printf("%-16s %12.0f %12.0f\n", link, (double)size / 1e6 / sync, (double)size / 1e6 / ahead);
+    }
+    close(fd);
+    return 0;
+}
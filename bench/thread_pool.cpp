@@ -0,0 +1,158 @@
+#include "../server/ThreadPool.h"
+#include "Bench.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Task throughput of the work-stealing ThreadPool against the single-queue
+// pool it replaced (one mutex, std::function tasks copied out of the queue).
+//
+//   bench/thread_pool [--workers=N] [--tasks=N]
+//
+// "external": P producer threads submit small tasks concurrently.
+// "fan-out":  tasks running on the pool submit their follow-up work, the
+//             pattern per-worker deques keep local.
+namespace {
+    class SingleQueuePool {
+    public:
+        explicit SingleQueuePool(int num_threads) {
+            for (int i = 0; i < num_threads; ++i) {
+                threads.emplace_back([this]() {
+                    while (true) {
+                        std::unique_lock<std::mutex> lock(mtx);
+                        cv.wait(lock, [this]() { return !tasks.empty() || stop; });
+                        if (stop && tasks.empty())
+                            break;
+                        auto task = tasks.front();
+                        tasks.pop();
+                        lock.unlock();
+                        task();
+                    }
+                });
+            }
+        }
+
+        ~SingleQueuePool() {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stop = true;
+            }
+            cv.notify_all();
+            for (auto& t : threads)
+                t.join();
+        }
+
+        void submit(std::function<void()> task) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                tasks.push(task);
+            }
+            cv.notify_one();
+        }
+
+    private:
+        std::vector<std::thread> threads;
+        std::queue<std::function<void()>> tasks;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool stop = false;
+    };
+
+    // About the size of a real session task: a few pointers and ids, too big
+    // for std::function's inline buffer but within Task's
+    struct Work {
+        std::atomic<uint64_t>* done;
+        uint64_t a, b, c;
+        void operator()() const { done->fetch_add(a + b + c - 2, std::memory_order_relaxed); }
+    };
+
+    void wait_for(const std::atomic<uint64_t>& done, uint64_t target) {
+        while (done.load(std::memory_order_relaxed) < target)
+            std::this_thread::yield();
+    }
+
+    template <class Pool>
+    double external(Pool& pool, int producers, uint64_t tasks) {
+        std::atomic<uint64_t> done{0};
+        uint64_t per = tasks / (uint64_t)producers;
+        double start = Bench::now();
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&] {
+                for (uint64_t i = 0; i < per; ++i)
+                    pool.submit(Work{&done, 1, 1, 1});
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        wait_for(done, per * (uint64_t)producers);
+        return (double)(per * (uint64_t)producers) / (Bench::now() - start);
+    }
+
+    // Each root task submits a chain of follow-ups from inside the pool
+    template <class Pool>
+    struct Chain {
+        Pool* pool;
+        std::atomic<uint64_t>* done;
+        uint64_t left;
+        void operator()() const {
+            done->fetch_add(1, std::memory_order_relaxed);
+            if (left > 0)
+                pool->submit(Chain{pool, done, left - 1});
+        }
+    };
+
+    template <class Pool>
+    double fan_out(Pool& pool, uint64_t tasks) {
+        const uint64_t roots = 64;
+        uint64_t depth = tasks / roots;
+        std::atomic<uint64_t> done{0};
+        double start = Bench::now();
+        for (uint64_t r = 0; r < roots; ++r)
+            pool.submit(Chain<Pool>{&pool, &done, depth - 1});
+        wait_for(done, roots * depth);
+        return (double)(roots * depth) / (Bench::now() - start);
+    }
+}
+
+int main(int argc, char** argv) {
+    int workers = (int)Bench::arg(argc, argv, "workers", 4);
+    uint64_t tasks = (uint64_t)Bench::arg(argc, argv, "tasks", 2000000);
+
+    std::printf("%d workers, %llu tasks per run, million tasks/s\n", workers, (unsigned long long)tasks);
+    std::printf("%-22s %14s %14s\n", "scenario", "single queue", "work stealing");
+    for (int producers : {1, 2, 4, 8}) {
+        double single, stealing;
+        {
+            SingleQueuePool pool(workers);
+            single = external(pool, producers, tasks);
+        }
+        {
+            ThreadPool pool(workers);
+            stealing = external(pool, producers, tasks);
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "external, %d producer%s", producers, producers > 1 ? "s" : "");
+        std::printf("%-22s %14.2f %14.2f\n", name, single / 1e6, stealing / 1e6);
+    }
+    {
+        double single, stealing;
+        {
+            SingleQueuePool pool(workers);
+            single = fan_out(pool, tasks);
+        }
+        {
+            ThreadPool pool(workers);
+            stealing = fan_out(pool, tasks);
+        }
+        std::printf("%-22s %14.2f %14.2f\n", "fan-out", single / 1e6, stealing / 1e6);
+    }
+    return 0;
+}
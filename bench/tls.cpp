@@ -0,0 +1,222 @@
+#include "../common/Log.h"
+#include "../common/Network.h"
+#include "Bench.h"
+
+#include <netinet/in.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// TLS transfers over loopback TCP, through the same Network calls the server
+// and client use.
+//
+//   bench/tls [--mb=N] [--round-trips=N]
+//
+// streams:      aggregate throughput of N connections sending at once, each
+//               on its own TLS session, against the same senders serialized
+//               on one process-wide lock as every SSL_write used to be.
+// chunk size:   one connection streaming through buffers of each size, from
+//               the old 4 KB stack array up to the pooled transfer chunk.
+// round trips:  small request/response exchanges with send_bytes, which
+//               puts the length prefix and payload in one TLS record,
+//               against a separate write for the prefix.
+namespace {
+    // Self-signed P-256 certificate for the bench server
+    bool write_certificate(const std::string& cert_path, const std::string& key_path) {
+        EVP_PKEY* key = EVP_EC_gen("P-256");
+        X509* cert = X509_new();
+        if (!key || !cert)
+            return false;
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME* name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        bool ok = X509_sign(cert, key, EVP_sha256()) > 0;
+
+        FILE* f = fopen(cert_path.c_str(), "w");
+        ok = ok && f && PEM_write_X509(f, cert) == 1;
+        if (f)
+            fclose(f);
+        f = fopen(key_path.c_str(), "w");
+        ok = ok && f && PEM_write_PrivateKey(f, key, nullptr, nullptr, 0, nullptr, nullptr) == 1;
+        if (f)
+            fclose(f);
+        X509_free(cert);
+        EVP_PKEY_free(key);
+        return ok;
+    }
+
+    struct Pair {
+        Connection server;
+        Connection client;
+    };
+
+    // A connected loopback TCP pair with the TLS handshake done on both ends
+    bool make_pair(Pair& pair) {
+        int listener = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (listener == -1 || bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0 ||
+            getsockname(listener, (sockaddr*)&addr, &len) != 0) {
+            perror("tls: listen");
+            return false;
+        }
+        int client_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (client_fd == -1 || connect(client_fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            perror("tls: connect");
+            return false;
+        }
+        int server_fd = accept(listener, nullptr, nullptr);
+        close(listener);
+        if (server_fd == -1) {
+            perror("tls: accept");
+            return false;
+        }
+        pair.server = Connection(server_fd);
+        pair.client = Connection(client_fd);
+
+        int server_result = -1;
+        std::thread handshake([&] { server_result = Network::wrap_server_connection(pair.server); });
+        int client_result = Network::wrap_client_connection(pair.client);
+        handshake.join();
+        return server_result == 0 && client_result == 0;
+    }
+
+    std::vector<std::unique_ptr<Pair>> make_pairs(int count) {
+        std::vector<std::unique_ptr<Pair>> pairs;
+        for (int i = 0; i < count; ++i) {
+            auto pair = std::make_unique<Pair>();
+            if (!make_pair(*pair))
+                return {};
+            pairs.push_back(std::move(pair));
+        }
+        return pairs;
+    }
+
+    // MB/s over all connections; each client sends bytes_each in chunk-sized writes
+    double streams(int connections, uint64_t bytes_each, bool global_lock, size_t chunk = 1 << 20) {
+        auto pairs = make_pairs(connections);
+        if (pairs.empty())
+            return 0;
+        std::mutex lock;
+        double start = Bench::now();
+        std::vector<std::thread> threads;
+        for (auto& pair : pairs) {
+            Pair* p = pair.get();
+            threads.emplace_back([&, p] {
+                std::vector<char> data(chunk, 'x');
+                for (uint64_t sent = 0; sent < bytes_each; sent += chunk) {
+                    if (global_lock) {
+                        std::lock_guard<std::mutex> guard(lock);
+                        Network::send_raw(p->client, data.data(), chunk);
+                    } else {
+                        Network::send_raw(p->client, data.data(), chunk);
+                    }
+                }
+            });
+            threads.emplace_back([&, p] {
+                std::vector<char> data(chunk);
+                for (uint64_t got = 0; got < bytes_each; got += chunk)
+                    if (Network::recv_all(p->server, data.data(), chunk) != (ssize_t)chunk)
+                        return;
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        return (double)bytes_each * connections / 1e6 / (Bench::now() - start);
+    }
+
+    // Round trips/s: the client sends a size-byte message, the server echoes it
+    double round_trips(long count, size_t size, bool coalesced) {
+        auto pairs = make_pairs(1);
+        if (pairs.empty())
+            return 0;
+        Pair& p = *pairs[0];
+        std::vector<char> message(size, 'm');
+        auto send = [&](Connection& conn, const std::vector<char>& data) {
+            if (coalesced)
+                return Network::send_bytes(conn, data.data(), data.size(), "message");
+            uint32_t len_net = htonl((uint32_t)data.size());
+            if (Network::send_raw(conn, &len_net, sizeof(len_net)) != 0)
+                return -1;
+            return Network::send_raw(conn, data.data(), data.size());
+        };
+
+        double start = Bench::now();
+        std::thread echo([&] {
+            std::vector<char> buffer;
+            for (long i = 0; i < count; ++i)
+                if (Network::recv_bytes(p.server, buffer, "message") != 0 || send(p.server, buffer) != 0)
+                    return;
+        });
+        std::vector<char> reply;
+        for (long i = 0; i < count; ++i)
+            if (send(p.client, message) != 0 || Network::recv_bytes(p.client, reply, "reply") != 0)
+                break;
+        echo.join();
+        return (double)count / (Bench::now() - start);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t bytes_each = (uint64_t)Bench::arg(argc, argv, "mb", 256) << 20;
+    long trips = Bench::arg(argc, argv, "round-trips", 500);
+
+    Log::set_level(Log::Level::Error);   // the unverified client context warns
+    char dir[] = "/tmp/bench_tls_XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string cert = std::string(dir) + "/cert.pem", key = std::string(dir) + "/key.pem";
+    bool ready = write_certificate(cert, key) && Network::init_server_tls(cert, key) == 0 &&
+                 Network::init_client_tls(false) == 0;
+    unlink(cert.c_str());
+    unlink(key.c_str());
+    rmdir(dir);
+    if (!ready) {
+        std::fprintf(stderr, "tls: could not set up TLS\n");
+        return 1;
+    }
+
+    std::printf("streams: %llu MiB split across the connections, aggregate MB/s\n",
+                (unsigned long long)(bytes_each >> 20));
+    std::printf("%-12s %14s %16s\n", "connections", "global lock", "per connection");
+    for (int connections : {1, 2, 4, 8}) {
+        double locked = streams(connections, bytes_each / (uint64_t)connections, true);
+        double free = streams(connections, bytes_each / (uint64_t)connections, false);
+        std::printf("%-12d %14.0f %16.0f\n", connections, locked, free);
+    }
+
+    std::printf("\nchunk size: %llu MiB over one connection, MB/s\n", (unsigned long long)(bytes_each >> 20));
+    for (size_t chunk : {4u << 10, 64u << 10, 256u << 10, 1u << 20, 4u << 20})
+        std::printf("%-12s %14.0f\n", (std::to_string(chunk >> 10) + " KiB").c_str(),
+                    streams(1, bytes_each, false, chunk));
+
+    std::printf("\nround trips: %ld per run, round trips/s\n", trips);
+    std::printf("%-12s %14s %16s\n", "message", "split prefix", "send_bytes");
+    for (size_t size : {16, 256, 4096}) {
+        double split = round_trips(trips, size, false);
+        double coalesced = round_trips(trips, size, true);
+        char label[32];
+        std::snprintf(label, sizeof(label), "%zu B", size);
+        std::printf("%-12s %14.0f %16.0f\n", label, split, coalesced);
+    }
+    Network::cleanup_tls();
+    return 0;
+}
@@ -1,5 +1,11 @@
 #include "Client.h"
 #include "../common/Network.h"
+#include "../common/BufferPool.h"
+#include "../common/Protocol.h"
+#include "../common/ContentHash.h"
+#include "../common/Delta.h"
+#include "../common/Compression.h"
+#include "../common/Checksum.h"
 
 #include <iostream>
 #include <fstream>
@@ -7,24 +13,130 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <openssl/rand.h>
+
+namespace {
+    // Below this size a single stream is already fast enough
+    constexpr uint64_t MIN_STRIPE_SIZE = 8ull * 1024 * 1024;
+
+    // Largest literal piece of a delta stream
+    constexpr uint32_t LITERAL_CHUNK = 1024 * 1024;
+
+    // A server whose password-hashing slots are all taken answers logins and
+    // sign-ups with Busy; those are retried this many times, each wait a
+    // little longer than the last, before "Server busy" is shown
+    constexpr int BUSY_RETRIES = 3;
+    constexpr auto BUSY_BACKOFF = std::chrono::milliseconds(150);
+
+    // Files up to this size travel in a single v2 frame
+    constexpr uint64_t SMALL_FILE_LIMIT = 1024 * 1024;
+
+    // Pipelined v2 requests outstanding at once, by count and by payload bytes
+    constexpr size_t PIPELINE_WINDOW = 64;
+    constexpr size_t PIPELINE_BYTES = 4 * 1024 * 1024;
+
+    // Batched small-file transfers: files and bytes per frame, frames per pipelined round
+    constexpr size_t BATCH_FILES = 1024;
+    constexpr size_t BATCH_BYTES = 1024 * 1024;
+    constexpr size_t BATCHES_PER_ROUND = 16;
+
+    // Catalog entries requested per list page
+    constexpr uint32_t LIST_PAGE = 1000;
+
+    Protocol::Frame make_request(Protocol::Opcode opcode) {
+        Protocol::Frame frame;
+        frame.opcode = opcode;
+        return frame;
+    }
+
+    bool read_whole(const std::string& path, char* data, uint64_t size) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return false;
+        uint64_t done = 0;
+        while (done < size) {
+            ssize_t r = read(fd, data + done, (size_t)(size - done));
+            if (r == -1 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                break;
+            done += (uint64_t)r;
+        }
+        close(fd);
+        return done == size;
+    }
+
+    // Written beside the target and renamed, like a streamed download
+    bool save_whole(const std::string& filename, const char* data, size_t size) {
+        std::string save_path = "client/" + filename;
+        std::string part_path = "client/." + filename + ".part";
+        int fd = open(part_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1)
+            return false;
+        size_t done = 0;
+        while (done < size) {
+            ssize_t w = write(fd, data + done, size - done);
+            if (w == -1 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                break;
+            done += (size_t)w;
+        }
+        close(fd);
+        return done == size && rename(part_path.c_str(), save_path.c_str()) == 0;
+    }
+
+    bool send_token_and_name(Connection& c, const std::string& token, const std::string& filename) {
+        return Network::send_string(c, token, "token") == 0 &&
+               Network::send_string(c, filename, "filename") == 0;
+    }
+
+    void say_goodbye(Connection& c) {
+        char command_buffer[] = "bye.";
+        Network::send_raw(c, command_buffer, 5);
+        Network::close_connection(c);
+    }
+}
 
 Client::Client(const std::string& ip, int port)
-    : server_ip(ip), server_port(port), sockfd(-1), connected(false), logged_in(false)
+    : server_ip(ip), server_port(port), connected(false), logged_in(false), stripe_count(1), compression(false)
 {
 }
 
+void Client::setStripeCount(int count) {
+    stripe_count = std::max(1, std::min(count, MAX_STRIPES));
+}
+
 Client::~Client() {
-    closeConnection();
+    disconnect();
     // (Keep g_client_ctx for process lifetime; free at program end if desired)
 }
 
 bool Client::connectToServer() {
-    if (connected) 
+    // Reuse the keep-alive session unless the server dropped it while we were idle
+    if (connected && !Network::peer_closed(conn))
         return true;
+    if (connected)
+        closeConnection();
+    if (!openConnection(conn))
+        return false;
+    connected = true;
+    return true;
+}
+
+// Connect and complete the TLS handshake on a fresh connection
+bool Client::openConnection(Connection& target) {
     if (Network::init_client_tls() != 0) 
         return false; // TLS ctx
 
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd == -1) {
         perror("socket failed");
         return false;
@@ -38,283 +150,1168 @@ bool Client::connectToServer() {
     if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
         perror("connect failed");
         close(sockfd);
-        sockfd = -1;
         return false;
     }
 
-    if (Network::wrap_client_connection(sockfd) != 0) { 
+    target = Connection(sockfd);
+    if (Network::wrap_client_connection(target) != 0) { 
         std::cerr << "TLS handshake failed\n"; 
-        close(sockfd); 
-        sockfd = -1; 
+        target.close(); 
         return false; 
     }
-    connected = true;
     return true;
 }
 
 void Client::closeConnection() {
-    Network::close_tls(sockfd);
-    // ensure TLS cleanup if implemented (optional call)
-    if (sockfd != -1) {
-        close(sockfd);
-        sockfd = -1;
-    }
+    Network::close_connection(conn);
     connected = false;
 }
 
-bool Client::createUser(const std::string& username, const std::string& password) {
-    if (!connectToServer()) return false;
-
-    char command_buffer[] = "crte";
-    if (Network::send_raw(sockfd, command_buffer, 5) != 0) { perror("send command type"); closeConnection(); return false; }
-
-    if (Network::send_string(sockfd, username, "username") != 0) {
+bool Client::sendCommand(const char* command) {
+    if (!connectToServer())
+        return false;
+    if (Network::send_raw(conn, command, 5) != 0) {
+        perror("send command type");
         closeConnection();
         return false;
     }
-    if (Network::send_string(sockfd, password, "password") != 0) {
-        closeConnection();
+    return true;
+}
+
+void Client::disconnect() {
+    if (connected && !Network::peer_closed(conn)) {
+        char command_buffer[] = "bye.";
+        Network::send_raw(conn, command_buffer, 5);
+    }
+    closeConnection();
+}
+
+// Send requests back to back and collect their responses, which the server
+// may return in any order. The window bounds what is outstanding so the
+// server is never stuck writing responses while we are still writing requests.
+bool Client::pipeline(std::vector<Protocol::Frame>& requests, std::vector<Protocol::Frame>& responses) {
+    if (!connectToServer())
         return false;
+
+    responses.assign(requests.size(), Protocol::Frame());
+    std::unordered_map<uint32_t, size_t> pending;   // request id -> index
+    size_t next = 0;
+    size_t done = 0;
+    size_t bytes_in_flight = 0;
+
+    while (done < requests.size()) {
+        while (next < requests.size() && pending.size() < PIPELINE_WINDOW &&
+               (pending.empty() || bytes_in_flight + requests[next].payload.size() <= PIPELINE_BYTES)) {
+            Protocol::Frame& request = requests[next];
+            request.request_id = ++next_request_id;
+            request.flags = 0;
+            if (Protocol::send_frame(conn, request) != 0) {
+                perror("send request failed");
+                closeConnection();
+                return false;
+            }
+            pending[request.request_id] = next;
+            bytes_in_flight += request.payload.size();
+            ++next;
+        }
+
+        Protocol::Frame response;
+        if (Protocol::recv_frame(conn, response) != 0) {
+            std::cerr << "Failed to receive response\n";
+            closeConnection();
+            return false;
+        }
+        auto it = pending.find(response.request_id);
+        if (it == pending.end() || !(response.flags & Protocol::FLAG_RESPONSE)) {
+            std::cerr << "Unexpected response id " << response.request_id << "\n";
+            closeConnection();
+            return false;
+        }
+        bytes_in_flight -= requests[it->second].payload.size();
+        responses[it->second] = std::move(response);
+        pending.erase(it);
+        ++done;
     }
+    return true;
+}
 
-    // Receive feedback
-    std::string feedback;
-    if (Network::recv_string(sockfd, feedback, "create_user_feedback") != 0) {
-        closeConnection();
+bool Client::call(Protocol::Frame& request, Protocol::Frame& response) {
+    std::vector<Protocol::Frame> requests(1);
+    requests[0] = std::move(request);
+    std::vector<Protocol::Frame> responses;
+    if (!pipeline(requests, responses))
         return false;
+    response = std::move(responses[0]);
+    return true;
+}
+
+bool Client::callRetryingBusy(const Protocol::Frame& request, Protocol::Frame& response) {
+    for (int attempt = 0;; ++attempt) {
+        Protocol::Frame copy = request;
+        if (!call(copy, response)) return false;
+        if (response.status != Protocol::Status::Busy || attempt == BUSY_RETRIES) return true;
+        std::this_thread::sleep_for(BUSY_BACKOFF * (attempt + 1));
     }
+}
 
-    std::cout << feedback << "\n";
-    closeConnection();
+bool Client::createUser(const std::string& username, const std::string& password) {
+    Protocol::Frame request = make_request(Protocol::Opcode::CreateUser);
+    Protocol::Writer out(request.payload);
+    out.put_string(username);
+    out.put_string(password);
+
+    Protocol::Frame response;
+    if (!callRetryingBusy(request, response)) return false;
+
+    if (response.status == Protocol::Status::Ok)
+        std::cout << "User Created\n";
+    else if (response.status == Protocol::Status::Busy)
+        std::cout << "Server busy\n";
+    else
+        std::cout << "Create user failed\n";
     return true;
 }
 
 bool Client::login(const std::string& username, const std::string& password) {
-    if (!connectToServer()) return false;
+    Protocol::Frame request = make_request(Protocol::Opcode::Login);
+    Protocol::Writer out(request.payload);
+    out.put_string(username);
+    out.put_string(password);
 
-    char command_buffer[] = "lgin";
-    if (Network::send_raw(sockfd, command_buffer, 5) != 0) { perror("send command type"); closeConnection(); return false; }
+    Protocol::Frame response;
+    if (!callRetryingBusy(request, response)) return false;
 
-    if (Network::send_string(sockfd, username, "username") != 0) {
-        closeConnection();
+    if (response.status != Protocol::Status::Ok) {
+        std::cout << (response.status == Protocol::Status::Busy ? "Server busy" : "Login failed") << "\n";
         return false;
     }
-    if (Network::send_string(sockfd, password, "password") != 0) {
-        closeConnection();
+
+    Protocol::Reader in(response.payload);
+    std::string received_token = in.get_string();
+    if (!in.ok() || received_token.empty()) {
+        std::cerr << "Malformed login response\n";
         return false;
     }
 
-    // Receive feedback
-    std::string feedback;
-    if (Network::recv_string(sockfd, feedback, "login_feedback") != 0) {
-        closeConnection();
+    token = received_token;
+    logged_in = true;
+    std::cout << "Login successful\n";
+    std::cout << "Token: " << token << "\n";
+    return true;
+}
+
+bool Client::logout() {
+    if (!logged_in) {
+        std::cerr << "Not logged in\n";
         return false;
     }
-    std::cout << feedback << "\n";
 
-    // Receive token
-    std::string received_token;
-    if (Network::recv_string(sockfd, received_token, "token") != 0) {
+    Protocol::Frame request = make_request(Protocol::Opcode::Logout);
+    Protocol::Writer(request.payload).put_string(token);
+
+    Protocol::Frame response;
+    if (!call(request, response)) return false;
+
+    std::cout << (response.status == Protocol::Status::Ok ? "Logged out successfully" : "Logout failed") << "\n";
+
+    token = "";
+    logged_in = false;
+    return true;
+}
+
+// Token + filename prefix shared by the file commands
+bool Client::sendTokenAndName(const std::string& filename) {
+    if (!send_token_and_name(conn, token, filename)) {
+        perror("send token/filename failed");
         closeConnection();
         return false;
     }
+    return true;
+}
 
-    if (feedback == "Login successful") {
-        token = received_token;
-        logged_in = true;
-        std::cout << "Token: " << token << "\n";
-    }
-    else {
-        std::cout << "Failed to connect: Details ...";
+bool Client::remoteUploadStatus(const std::string& filename, uint64_t& held) {
+    Protocol::Frame request = make_request(Protocol::Opcode::UploadStatus);
+    Protocol::Writer out(request.payload);
+    out.put_string(token);
+    out.put_string(filename);
+
+    Protocol::Frame response;
+    if (!call(request, response)) return false;
+    if (response.status != Protocol::Status::Ok) {
+        std::cerr << "Upload status failed: " << Protocol::status_name(response.status) << "\n";
+        return false;
     }
-    
-    closeConnection();
-    return true;
+
+    Protocol::Reader in(response.payload);
+    held = in.get_u64();
+    return in.ok();
 }
 
-bool Client::logout() {
-    if (!logged_in) {
-        std::cerr << "Not logged in\n";
+// One frame carries the whole file; nothing to resume
+bool Client::uploadSmall(const std::string& filepath, const std::string& filename, uint64_t filesize) {
+    Protocol::Frame request = make_request(Protocol::Opcode::Put);
+    Protocol::Writer out(request.payload);
+    out.put_string(token);
+    out.put_string(filename);
+
+    std::ifstream infile(filepath, std::ios::binary);
+    if (!infile.is_open()) {
+        std::cerr << "Could not open file for reading\n";
         return false;
     }
+    char* data = out.extend((size_t)filesize);
+    if (!infile.read(data, (std::streamsize)filesize)) {
+        std::cerr << "Local file shrank during upload\n";
+        return false;
+    }
+
+    Protocol::Frame response;
+    if (!call(request, response)) return false;
 
-    if (!connectToServer()) return false;
+    bool ok = response.status == Protocol::Status::Ok;
+    std::cout << (ok ? "Upload complete" : "Upload failed") << "\n";
+    return ok;
+}
 
-    char command_buffer[] = "lgou";
-    if (Network::send_raw(sockfd, command_buffer, 5) != 0) { perror("send command type"); closeConnection(); return false; }
+// True when the server published content it already had, so nothing needs sending
+bool Client::uploadByHash(const std::string& filename, const std::string& hex, uint64_t filesize) {
+    Protocol::Frame request = make_request(Protocol::Opcode::PutByHash);
+    Protocol::Writer out(request.payload);
+    out.put_string(token);
+    out.put_string(filename);
+    out.put_string(hex);
+    out.put_u64(filesize);
 
-    if (Network::send_string(sockfd, token, "token") != 0) {
-        perror("send token failed");
+    Protocol::Frame response;
+    if (!call(request, response) || response.status != Protocol::Status::Ok)
+        return false;
+    std::cout << "Upload complete (content already on server)\n";
+    return true;
+}
+
+// Fetch the block signatures of the server's copy; base_size is NOT_FOUND
+// (UINT64_MAX) when there is no copy
+bool Client::remoteSignatures(const std::string& filename, uint64_t& base_size, uint32_t& block_size,
+                              std::vector<Delta::BlockSignature>& signatures) {
+    if (!sendCommand("dsig")) return false;
+    if (!sendTokenAndName(filename)) return false;
+
+    char header[16];
+    if (Network::recv_all(conn, header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        perror("Failed to receive signature header");
         closeConnection();
         return false;
     }
+    uint64_t size_net;
+    uint32_t fields[2];
+    memcpy(&size_net, header, sizeof(size_net));
+    memcpy(fields, header + sizeof(size_net), sizeof(fields));
+    base_size = be64toh(size_net);
+    signatures.clear();
+    if (base_size == UINT64_MAX)
+        return true;
+    block_size = ntohl(fields[0]);
+    uint32_t count = ntohl(fields[1]);
 
-    // Receive feedback from server
-    std::string feedback;
-    if (Network::recv_string(sockfd, feedback, "logout_feedback") != 0) {
-        std::cerr << "Failed to receive logout feedback\n";
+    const size_t entry_size = sizeof(uint32_t) + Delta::STRONG_BYTES;
+    std::vector<char> raw((size_t)count * entry_size);
+    if (!raw.empty() && Network::recv_all(conn, raw.data(), raw.size()) != (ssize_t)raw.size()) {
+        perror("Failed to receive signatures");
         closeConnection();
         return false;
     }
-    
-    std::cout << feedback << "\n";
-
-    token = "";
-    logged_in = false;
-    closeConnection();
+    signatures.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        const char* p = raw.data() + (size_t)i * entry_size;
+        uint32_t weak_net;
+        memcpy(&weak_net, p, sizeof(weak_net));
+        signatures[i].weak = ntohl(weak_net);
+        memcpy(signatures[i].strong, p + sizeof(weak_net), Delta::STRONG_BYTES);
+    }
     return true;
 }
 
-bool Client::uploadFile(const std::string& filepath) {
-    if (!connectToServer()) return false;
+// Send only what changed since the server's copy. handled is false when delta
+// mode does not apply (no copy, or too little in common) and the caller should
+// upload the whole file instead.
+bool Client::uploadDelta(const std::string& filepath, const std::string& filename, const std::string& hex,
+                         uint64_t filesize, bool& handled) {
+    handled = false;
 
-    if (!std::filesystem::exists(filepath)) {
-        std::cerr << "File does not exist: " << filepath << "\n";
+    uint64_t base_size = 0;
+    uint32_t block_size = 0;
+    std::vector<Delta::BlockSignature> signatures;
+    if (!remoteSignatures(filename, base_size, block_size, signatures))
+        return false;
+    if (base_size == UINT64_MAX || signatures.empty())
+        return false;
+
+    int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    void* mapped = mmap(nullptr, (size_t)filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+    const unsigned char* data = static_cast<const unsigned char*>(mapped);
+    madvise(mapped, (size_t)filesize, MADV_SEQUENTIAL);
+
+    std::vector<Delta::Op> ops = Delta::compute(data, filesize, block_size, signatures);
+    uint64_t literal_bytes = 0;
+    for (const Delta::Op& op : ops) {
+        if (op.kind == Delta::OP_LITERAL)
+            literal_bytes += op.length;
+    }
+    // Mostly new content: a plain upload is resumable and can be striped
+    if (literal_bytes > filesize / 2) {
+        munmap(mapped, (size_t)filesize);
         return false;
     }
 
-    char command_buffer[] = "send";
-    if (Network::send_raw(sockfd, command_buffer, 5) != 0) { perror("send command type"); closeConnection(); return false; }
+    bool ok = sendCommand("dlta") && sendTokenAndName(filename);
+    uint64_t header[3] = { htobe64(base_size), htobe64(block_size), htobe64(filesize) };
+    uint64_t accepted_net = 0;
+    if (ok && (Network::send_raw(conn, header, sizeof(header)) != 0 ||
+               Network::recv_all(conn, (char*)&accepted_net, sizeof(accepted_net)) != (ssize_t)sizeof(accepted_net))) {
+        perror("delta header exchange failed");
+        closeConnection();
+        ok = false;
+    }
+    if (!ok || be64toh(accepted_net) != 1) {
+        munmap(mapped, (size_t)filesize);
+        return false;    // server copy changed under us: fall back
+    }
+    handled = true;
+
+    // Ops and small literals are packed into one buffer per send
+    std::vector<char> out;
+    out.reserve(LITERAL_CHUNK + 64);
+    auto flush = [&]() {
+        bool sent = out.empty() || Network::send_raw(conn, out.data(), out.size()) == 0;
+        out.clear();
+        return sent;
+    };
+    auto append = [&](const void* p, size_t n) {
+        const char* c = static_cast<const char*>(p);
+        out.insert(out.end(), c, c + n);
+    };
 
-    if (Network::send_string(sockfd, token, "token") != 0) {
-        perror("send token failed");
+    for (const Delta::Op& op : ops) {
+        if (!ok)
+            break;
+        if (op.kind == Delta::OP_COPY) {
+            uint64_t first_net = htobe64(op.start);
+            uint32_t count_net = htonl((uint32_t)op.length);
+            append(&op.kind, 1);
+            append(&first_net, sizeof(first_net));
+            append(&count_net, sizeof(count_net));
+            if (out.size() >= LITERAL_CHUNK)
+                ok = flush();
+            continue;
+        }
+        for (uint64_t done = 0; ok && done < op.length; ) {
+            uint32_t piece = (uint32_t)std::min<uint64_t>(LITERAL_CHUNK, op.length - done);
+            uint32_t len_net = htonl(piece);
+            append(&op.kind, 1);
+            append(&len_net, sizeof(len_net));
+            if (out.size() + piece > LITERAL_CHUNK) {
+                ok = flush() && Network::send_raw(conn, data + op.start + done, piece) == 0;
+            } else {
+                append(data + op.start + done, piece);
+            }
+            done += piece;
+        }
+    }
+    uint8_t end = Delta::OP_END;
+    append(&end, 1);
+    append(hex.data(), hex.size());
+    ok = ok && flush();
+    munmap(mapped, (size_t)filesize);
+
+    std::string feedback;
+    if (!ok || Network::recv_string(conn, feedback, "upload_feedback") != 0) {
+        perror("delta upload failed");
         closeConnection();
         return false;
     }
+    std::cout << feedback << " (delta: sent " << literal_bytes << " of " << filesize << " bytes)\n";
+    return feedback == "Upload complete";
+}
+
+bool Client::uploadFile(const std::string& filepath) {
+    if (!std::filesystem::exists(filepath)) {
+        std::cerr << "File does not exist: " << filepath << "\n";
+        return false;
+    }
 
     std::string filename = std::filesystem::path(filepath).filename().string();
-    auto filesize = std::filesystem::file_size(filepath);
+    uint64_t filesize = std::filesystem::file_size(filepath);
 
     if (filename.size() >= 256) {
         std::cerr << "Filename too long\n";
         return false;
     }
 
-    if (Network::send_string(sockfd, filename, "filename") != 0) {
-        closeConnection();
+    if (filesize <= SMALL_FILE_LIMIT)
+        return uploadSmall(filepath, filename, filesize);
+
+    std::string hex;
+    uint64_t hashed_size = 0;
+    if (!ContentHash::of_file(filepath, hex, hashed_size) || hashed_size != filesize) {
+        std::cerr << "Could not read " << filepath << "\n";
         return false;
     }
 
-    uint64_t filesize_net = htobe64(filesize);
-    if (Network::send_raw(sockfd, &filesize_net, sizeof(filesize_net)) != 0) { perror("Failed to send file size"); closeConnection(); return false; }
+    // The server may already hold this content, from us or another user
+    if (uploadByHash(filename, hex, filesize))
+        return true;
+
+    // Or an older version of it, in which case only the changes are sent
+    bool handled = false;
+    bool delta_ok = uploadDelta(filepath, filename, hex, filesize, handled);
+    if (handled)
+        return delta_ok;
+
+    if (compression)
+        return uploadCompressed(filepath, filename, filesize);
+
+    if (stripe_count > 1 && filesize >= MIN_STRIPE_SIZE)
+        return uploadStriped(filepath, filename, filesize);
 
     std::ifstream infile(filepath, std::ios::binary);
     if (!infile.is_open()) {
         std::cerr << "Could not open file for reading\n";
+        return false;
+    }
+
+    // Resume from whatever an earlier, interrupted upload left on the server
+    uint64_t held = 0;
+    if (!remoteUploadStatus(filename, held)) return false;
+    uint64_t requested = held <= filesize ? held : 0;
+
+    if (!sendCommand("sndr")) return false;
+    if (!sendTokenAndName(filename)) return false;
+
+    uint64_t header[2] = { htobe64(requested), htobe64(filesize) };
+    if (Network::send_raw(conn, header, sizeof(header)) != 0) { perror("Failed to send upload range"); closeConnection(); return false; }
+
+    uint64_t offset_net = 0;
+    if (Network::recv_all(conn, (char*)&offset_net, sizeof(offset_net)) != (ssize_t)sizeof(offset_net)) {
+        perror("Failed to receive resume offset");
         closeConnection();
         return false;
     }
+    uint64_t offset = be64toh(offset_net);
+    if (offset > 0)
+        std::cout << "Resuming upload at byte " << offset << " of " << filesize << "\n";
 
-    char buffer[4096];
-    while (true) {
-        infile.read(buffer, sizeof(buffer));
+    infile.seekg((std::streamoff)offset);
+    BufferPool::Lease buffer = BufferPool::instance().acquire();
+    uint64_t remaining = filesize - offset;
+    uint32_t crc = 0;
+    while (remaining > 0) {
+        infile.read(buffer.data(), (std::streamsize)std::min<uint64_t>(buffer.size(), remaining));
         ssize_t bytes_read = infile.gcount();
-        if (bytes_read <= 0) break;
+        if (bytes_read <= 0) { std::cerr << "Local file shrank during upload\n"; closeConnection(); return false; }
 
-        if (Network::send_raw(sockfd, buffer, (size_t)bytes_read) != 0) { perror("send failed"); infile.close(); closeConnection(); return false; }
+        crc = Checksum::crc32c(crc, buffer.data(), (size_t)bytes_read);
+        if (Network::send_raw(conn, buffer.data(), (size_t)bytes_read) != 0) { perror("send failed"); infile.close(); closeConnection(); return false; }
+        remaining -= (uint64_t)bytes_read;
     }
-
     infile.close();
-    closeConnection();
-    std::cout << "File uploaded successfully\n";
-    return true;
+    if (Network::send_checksum(conn, crc) != 0) { perror("Failed to send checksum"); closeConnection(); return false; }
+
+    std::string feedback;
+    if (Network::recv_string(conn, feedback, "upload_feedback") != 0) {
+        closeConnection();
+        return false;
+    }
+    std::cout << feedback << "\n";
+    return feedback == "Upload complete";
 }
 
-bool Client::downloadFile(const std::string& filename) {
-    if (!connectToServer()) return false;
+// Compressed transfers trade resumability for bandwidth: they always move the whole file
+bool Client::uploadCompressed(const std::string& filepath, const std::string& filename, uint64_t filesize) {
+    int file_fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file_fd == -1) {
+        std::cerr << "Could not open file for reading\n";
+        return false;
+    }
 
-    char command_buffer[] = "get.";
-    if (Network::send_raw(sockfd, command_buffer, 5) != 0) { perror("send command type"); closeConnection(); return false; }
+    bool ok = sendCommand("zsnd") && sendTokenAndName(filename);
+    uint64_t header[2] = { htobe64(filesize), htobe64(Compression::DEFLATE) };
+    uint64_t codec_net = 0;
+    if (ok && (Network::send_raw(conn, header, sizeof(header)) != 0 ||
+               Network::recv_all(conn, (char*)&codec_net, sizeof(codec_net)) != (ssize_t)sizeof(codec_net))) {
+        perror("Failed to negotiate compression");
+        closeConnection();
+        ok = false;
+    }
+    if (ok) {
+        posix_fadvise(file_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        uint32_t crc = 0;
+        ok = Compression::send_stream(conn, file_fd, 0, filesize, (uint8_t)be64toh(codec_net), &crc) == 0 &&
+             Network::send_checksum(conn, crc) == 0;
+        if (!ok) {
+            perror("send failed");
+            closeConnection();
+        }
+    }
+    close(file_fd);
+    if (!ok)
+        return false;
 
-    if (Network::send_string(sockfd, token, "token") != 0) {
-        perror("send token failed");
+    std::string feedback;
+    if (Network::recv_string(conn, feedback, "upload_feedback") != 0) {
         closeConnection();
         return false;
     }
+    std::cout << feedback << "\n";
+    return feedback == "Upload complete";
+}
 
-    if (Network::send_string(sockfd, filename, "filename") != 0) {
+bool Client::downloadCompressed(const std::string& filename) {
+    std::string save_path = "client/" + filename;
+    std::string part_path = "client/." + filename + ".part";
+
+    if (!sendCommand("zget")) return false;
+    if (!sendTokenAndName(filename)) return false;
+
+    uint64_t codec_net = htobe64(Compression::DEFLATE);
+    uint64_t reply[2];
+    if (Network::send_raw(conn, &codec_net, sizeof(codec_net)) != 0 ||
+        Network::recv_all(conn, (char*)reply, sizeof(reply)) != (ssize_t)sizeof(reply)) {
+        perror("Failed to receive file size");
         closeConnection();
         return false;
     }
+    uint64_t filesize = be64toh(reply[0]);
+    if (filesize == UINT64_MAX) {   // server's NOT_FOUND sentinel
+        std::cerr << "File not found on server: " << filename << "\n";
+        return false;
+    }
+    std::cout << "Receiving file: " << filename << " (" << filesize << " bytes, compressed stream)\n";
 
-    uint64_t filesize_net = 0;
-    if (Network::recv_all(sockfd, (char*)&filesize_net, sizeof(filesize_net)) <= 0) {
-        perror("Failed to receive file size");
+    int file_fd = open(part_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file_fd == -1) {
+        std::cerr << "Could not open output file for writing\n";
         closeConnection();
         return false;
     }
+    uint32_t crc = 0;
+    uint64_t received = Compression::recv_stream(conn, file_fd, 0, filesize, &crc);
+    close(file_fd);
 
-    uint64_t filesize = be64toh(filesize_net);
-    std::cout << "Receiving file: " << filename << " (" << filesize << " bytes)\n";
+    uint32_t expected = 0;
+    if (received != filesize || Network::recv_checksum(conn, expected) != 0) {
+        std::cerr << "File transfer interrupted at " << received << " of " << filesize << " bytes\n";
+        closeConnection();
+        return false;
+    }
+    std::error_code ec;
+    if (crc != expected) {
+        std::cerr << "Checksum mismatch on " << filename << "; download discarded\n";
+        std::filesystem::remove(part_path, ec);
+        return false;
+    }
+    std::filesystem::rename(part_path, save_path, ec);
+    if (ec) {
+        std::cerr << "Could not move download into place: " << ec.message() << "\n";
+        return false;
+    }
+    std::cout << "File transfer complete. Received " << received << " bytes.\n";
+    return true;
+}
 
+bool Client::downloadFile(const std::string& filename) {
+    // Bytes from an interrupted download are kept next to the target and resumed
     std::string save_path = "client/" + filename;
-    std::ofstream outfile(save_path, std::ios::binary);
+    std::string part_path = "client/." + filename + ".part";
 
-    if (!outfile.is_open()) {
-        std::cerr << "Could not open output file for writing\n";
+    if (compression)
+        return downloadCompressed(filename);
+
+    if (stripe_count > 1) {
+        uint64_t filesize = 0;
+        if (!remoteFileSize(filename, filesize))
+            return false;
+        if (filesize >= MIN_STRIPE_SIZE)
+            return downloadStriped(filename, filesize);
+    }
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        std::error_code ec;
+        uint64_t offset = std::filesystem::exists(part_path, ec) ? std::filesystem::file_size(part_path, ec) : 0;
+        if (ec)
+            offset = 0;
+
+        if (!sendCommand("getr")) return false;
+        if (!sendTokenAndName(filename)) return false;
+
+        uint64_t range[2] = { htobe64(offset), htobe64(UINT64_MAX) };
+        if (Network::send_raw(conn, range, sizeof(range)) != 0) { perror("Failed to send download range"); closeConnection(); return false; }
+
+        uint64_t reply[2];
+        if (Network::recv_all(conn, (char*)reply, sizeof(reply)) != (ssize_t)sizeof(reply)) {
+            perror("Failed to receive file size");
+            closeConnection();
+            return false;
+        }
+        uint64_t filesize = be64toh(reply[0]);
+        uint64_t length = be64toh(reply[1]);
+
+        if (filesize == UINT64_MAX) {   // server's NOT_FOUND sentinel
+            std::cerr << "File not found on server: " << filename << "\n";
+            return false;
+        }
+
+        // Our partial copy is longer than the server's file: it is stale, start over
+        if (offset + length != filesize) {
+            uint32_t empty_crc = 0;   // trailer of the empty range
+            if (Network::recv_checksum(conn, empty_crc) != 0) {
+                closeConnection();
+                return false;
+            }
+            std::filesystem::remove(part_path, ec);
+            continue;
+        }
+
+        if (offset > 0)
+            std::cout << "Resuming download at byte " << offset << "\n";
+        std::cout << "Receiving file: " << filename << " (" << filesize << " bytes)\n";
+
+        std::ofstream outfile(part_path, std::ios::binary | std::ios::app);
+        if (!outfile.is_open()) {
+            std::cerr << "Could not open output file for writing\n";
+            closeConnection();
+            return false;
+        }
+
+        BufferPool::Lease buffer = BufferPool::instance().acquire();
+        uint64_t total_received = 0;
+        uint32_t crc = 0;
+
+        // Never read past the file: the next reply on this session follows it
+        while (total_received < length) {
+            size_t want = (size_t)std::min<uint64_t>(buffer.size(), length - total_received);
+            ssize_t bytes_received = Network::recv_all(conn, buffer.data(), want);
+            if (bytes_received <= 0) break;
+            crc = Checksum::crc32c(crc, buffer.data(), (size_t)bytes_received);
+            outfile.write(buffer.data(), bytes_received);
+            total_received += (uint64_t)bytes_received;
+            if (bytes_received != (ssize_t)want) break;
+        }
+
+        outfile.close();
+
+        uint32_t expected = 0;
+        if (total_received != length || Network::recv_checksum(conn, expected) != 0) {
+            std::cerr << "File transfer interrupted at " << offset + total_received << " of " << filesize
+                      << " bytes; run get again to resume\n";
+            closeConnection();
+            return false;
+        }
+        if (crc != expected) {
+            // Drop only what this transfer wrote; the next get resumes from there
+            std::filesystem::resize_file(part_path, offset, ec);
+            std::cerr << "Checksum mismatch on " << filename << "; run get again to retry\n";
+            return false;
+        }
+
+        std::filesystem::rename(part_path, save_path, ec);
+        if (ec) {
+            std::cerr << "Could not move download into place: " << ec.message() << "\n";
+            return false;
+        }
+        std::cout << "File transfer complete. Received " << total_received << " bytes.\n";
+        return true;
+    }
+    return false;
+}
+
+// Size of a server file, via a zero-length ranged download
+bool Client::remoteFileSize(const std::string& filename, uint64_t& filesize) {
+    if (!sendCommand("getr")) return false;
+    if (!sendTokenAndName(filename)) return false;
+
+    uint64_t range[2] = { 0, 0 };
+    uint64_t reply[2];
+    if (Network::send_raw(conn, range, sizeof(range)) != 0 ||
+        Network::recv_all(conn, (char*)reply, sizeof(reply)) != (ssize_t)sizeof(reply)) {
+        perror("Failed to query file size");
         closeConnection();
         return false;
     }
+    filesize = be64toh(reply[0]);
+    if (filesize == UINT64_MAX) {   // server's NOT_FOUND sentinel
+        std::cerr << "File not found on server: " << filename << "\n";
+        return false;
+    }
+    uint32_t empty_crc = 0;   // trailer of the empty range
+    if (Network::recv_checksum(conn, empty_crc) != 0) {
+        closeConnection();
+        return false;
+    }
+    return true;
+}
 
-    char buffer[4096];
-    ssize_t bytes_received;
-    uint64_t total_received = 0;
+// Split [0, filesize) into stripe_count contiguous ranges and run fn on each
+// range in its own thread. Succeeds only if every stripe does.
+bool Client::runStripes(uint64_t filesize, const std::function<bool(uint64_t, uint64_t)>& fn) {
+    uint64_t stripe = (filesize + (uint64_t)stripe_count - 1) / (uint64_t)stripe_count;
+    std::vector<std::thread> workers;
+    std::vector<char> ok((size_t)stripe_count, 0);
 
-    while (total_received < filesize) {
-        ssize_t bytes_received = Network::read_some(sockfd, buffer, sizeof(buffer));
-        if (bytes_received <= 0) break;
-        size_t to_write = std::min((size_t)bytes_received, (size_t)(filesize - total_received));
-        outfile.write(buffer, to_write);
-        total_received += to_write;
+    for (int i = 0; i < stripe_count; ++i) {
+        uint64_t offset = (uint64_t)i * stripe;
+        if (offset >= filesize)
+            break;
+        uint64_t length = std::min(stripe, filesize - offset);
+        workers.emplace_back([&fn, &ok, i, offset, length]() {
+            ok[(size_t)i] = fn(offset, length) ? 1 : 0;
+        });
     }
 
-    outfile.close();
+    bool all_ok = true;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+        all_ok = all_ok && ok[i];
+    }
+    return all_ok;
+}
 
-    if (total_received == filesize) {
-        std::cout << "File transfer complete. Received " << total_received << " bytes.\n";
-        closeConnection();
+bool Client::uploadStriped(const std::string& filepath, const std::string& filename, uint64_t filesize) {
+    int file_fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file_fd == -1) {
+        std::cerr << "Could not open file for reading\n";
+        return false;
+    }
+
+    uint64_t transfer_id = 0;
+    RAND_bytes(reinterpret_cast<unsigned char*>(&transfer_id), sizeof(transfer_id));
+    std::cout << "Uploading " << filename << " over " << stripe_count << " streams\n";
+
+    bool ok = runStripes(filesize, [&](uint64_t offset, uint64_t length) {
+        Connection stripe;
+        if (!openConnection(stripe))
+            return false;
+
+        char command_buffer[] = "sndp";
+        uint64_t header[4] = { htobe64(transfer_id), htobe64(offset), htobe64(length), htobe64(filesize) };
+        if (Network::send_raw(stripe, command_buffer, 5) != 0 ||
+            !send_token_and_name(stripe, token, filename) ||
+            Network::send_raw(stripe, header, sizeof(header)) != 0)
+            return false;
+
+        BufferPool::Lease buffer = BufferPool::instance().acquire();
+        uint64_t sent = 0;
+        uint32_t crc = 0;
+        while (sent < length) {
+            ssize_t n = pread(file_fd, buffer.data(), (size_t)std::min<uint64_t>(buffer.size(), length - sent), (off_t)(offset + sent));
+            if (n <= 0 || Network::send_raw(stripe, buffer.data(), (size_t)n) != 0)
+                return false;
+            crc = Checksum::crc32c(crc, buffer.data(), (size_t)n);
+            sent += (uint64_t)n;
+        }
+        if (Network::send_checksum(stripe, crc) != 0)
+            return false;
+
+        std::string feedback;
+        if (Network::recv_string(stripe, feedback, "stripe_feedback") != 0 || feedback != "Stripe complete")
+            return false;
+        say_goodbye(stripe);
         return true;
-    } else {
-        std::cerr << "File transfer incomplete. Expected: " << filesize << ", Received: " << total_received << "\n";
+    });
+    close(file_fd);
+
+    if (!ok) {
+        std::cerr << "Parallel upload failed\n";
+        return false;
+    }
+
+    if (!sendCommand("fnsh")) return false;
+    if (!sendTokenAndName(filename)) return false;
+    uint64_t header[2] = { htobe64(transfer_id), htobe64(filesize) };
+    if (Network::send_raw(conn, header, sizeof(header)) != 0) { closeConnection(); return false; }
+
+    std::string feedback;
+    if (Network::recv_string(conn, feedback, "upload_feedback") != 0) {
         closeConnection();
         return false;
     }
+    std::cout << feedback << "\n";
+    return feedback == "Upload complete";
+}
+
+bool Client::downloadStriped(const std::string& filename, uint64_t filesize) {
+    std::string save_path = "client/" + filename;
+    std::string part_path = "client/." + filename + ".part";
+
+    int file_fd = open(part_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file_fd == -1 || ftruncate(file_fd, (off_t)filesize) == -1) {
+        std::cerr << "Could not open output file for writing\n";
+        if (file_fd != -1)
+            close(file_fd);
+        return false;
+    }
+
+    std::cout << "Receiving file: " << filename << " (" << filesize << " bytes) over " << stripe_count << " streams\n";
+
+    bool ok = runStripes(filesize, [&](uint64_t offset, uint64_t length) {
+        Connection stripe;
+        if (!openConnection(stripe))
+            return false;
+
+        char command_buffer[] = "getr";
+        uint64_t range[2] = { htobe64(offset), htobe64(length) };
+        uint64_t reply[2];
+        if (Network::send_raw(stripe, command_buffer, 5) != 0 ||
+            !send_token_and_name(stripe, token, filename) ||
+            Network::send_raw(stripe, range, sizeof(range)) != 0 ||
+            Network::recv_all(stripe, (char*)reply, sizeof(reply)) != (ssize_t)sizeof(reply))
+            return false;
+        if (be64toh(reply[0]) != filesize || be64toh(reply[1]) != length)
+            return false;
+
+        BufferPool::Lease buffer = BufferPool::instance().acquire();
+        uint64_t received = 0;
+        uint32_t crc = 0;
+        while (received < length) {
+            size_t want = (size_t)std::min<uint64_t>(buffer.size(), length - received);
+            if (Network::recv_all(stripe, buffer.data(), want) != (ssize_t)want)
+                return false;
+            crc = Checksum::crc32c(crc, buffer.data(), want);
+            if (pwrite(file_fd, buffer.data(), want, (off_t)(offset + received)) != (ssize_t)want)
+                return false;
+            received += want;
+        }
+        uint32_t expected = 0;
+        if (Network::recv_checksum(stripe, expected) != 0)
+            return false;
+        if (crc != expected) {
+            std::cerr << "Checksum mismatch in stripe at offset " << offset << "\n";
+            return false;
+        }
+        say_goodbye(stripe);
+        return true;
+    });
+    close(file_fd);
+
+    std::error_code ec;
+    if (!ok) {
+        // Stripes leave holes, so a failed parallel download can't be resumed byte-wise
+        std::filesystem::remove(part_path, ec);
+        std::cerr << "Parallel download failed\n";
+        return false;
+    }
+
+    std::filesystem::rename(part_path, save_path, ec);
+    if (ec) {
+        std::cerr << "Could not move download into place: " << ec.message() << "\n";
+        return false;
+    }
+    std::cout << "File transfer complete. Received " << filesize << " bytes.\n";
+    return true;
+}
+
+// Pages through the catalog so even very large listings stay within one frame each
+bool Client::list(const std::string& prefix, Protocol::ListSort sort, bool descending) {
+    if (!logged_in) {
+        std::cerr << "Not logged in\n";
+        return false;
+    }
+
+    std::string cursor;
+    uint64_t total = 0;
+    do {
+        Protocol::Frame request = make_request(Protocol::Opcode::List);
+        Protocol::Writer out(request.payload);
+        out.put_string(token);
+        out.put_string(prefix);
+        out.put_u8((uint8_t)sort);
+        out.put_u8(descending ? 1 : 0);
+        out.put_u32(LIST_PAGE);
+        out.put_string(cursor);
+        out.put_u8(Protocol::LIST_COMPACT);
+
+        Protocol::Frame response;
+        if (!call(request, response)) return false;
+        if (response.status != Protocol::Status::Ok) {
+            std::cerr << "List failed: " << Protocol::status_name(response.status) << "\n";
+            return false;
+        }
+
+        Protocol::Reader in(response.payload);
+        uint32_t count = in.get_u32();
+        Protocol::ListReader entries(in, false);
+        std::string name, hash;
+        uint64_t size = 0;
+        int64_t modified = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!entries.next(name, size, modified, hash)) {
+                std::cerr << "Malformed list response\n";
+                return false;
+            }
+            time_t mtime = (time_t)modified;
+            char when[32] = "";
+            struct tm tm_local;
+            if (localtime_r(&mtime, &tm_local))
+                strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm_local);
+            std::cout << " - " << name << "  " << size << " bytes  " << when << "\n";
+        }
+        cursor = in.get_string();
+        if (!in.ok()) {
+            std::cerr << "Malformed list response\n";
+            return false;
+        }
+        total += count;
+    } while (!cursor.empty());
+
+    std::cout << "Files: " << total << "\n";
+    return true;
 }
 
-bool Client::list() {
+bool Client::deleteFile(const std::string& filename) {
     if (!logged_in) {
         std::cerr << "Not logged in\n";
         return false;
     }
-    if (!connectToServer()) return false;
 
-    char command_buffer[] = "list";
-    if (Network::send_raw(sockfd, command_buffer, 5) != 0) { perror("send command type"); closeConnection(); return false; }
+    Protocol::Frame request = make_request(Protocol::Opcode::Delete);
+    Protocol::Writer out(request.payload);
+    out.put_string(token);
+    out.put_string(filename);
 
-    if (Network::send_string(sockfd, token, "token") != 0) {
-        perror("send token failed");
-        closeConnection();
+    Protocol::Frame response;
+    if (!call(request, response)) return false;
+    if (response.status != Protocol::Status::Ok) {
+        std::cerr << "Delete failed: " << Protocol::status_name(response.status) << "\n";
         return false;
     }
+    std::cout << "Deleted " << filename << "\n";
+    return true;
+}
 
-    uint32_t count_net = 0;
-    if (Network::recv_all(sockfd, (char*)&count_net, sizeof(count_net)) <= 0) {
-        perror("recv file count failed");
+// mtrc: the server's counters and latency percentiles, printed as sent
+bool Client::metrics() {
+    if (!sendCommand("mtrc")) return false;
+    std::string text;
+    if (Network::recv_string(conn, text, "metrics") != 0) {
         closeConnection();
         return false;
     }
-    uint32_t count = ntohl(count_net);
-    std::cout << "Files (" << count << "):\n";
-    for (uint32_t i = 0; i < count; ++i) {
-        std::string fname;
-        if (Network::recv_string(sockfd, fname, "filename") != 0) {
-            perror("recv filename failed");
-            closeConnection();
+    std::cout << text;
+    return true;
+}
+
+bool Client::uploadDirectory(const std::string& dirpath) {
+    std::vector<std::string> filepaths;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dirpath, ec)) {
+        if (entry.is_regular_file())
+            filepaths.push_back(entry.path().string());
+    }
+    if (ec) {
+        std::cerr << "Cannot read directory " << dirpath << ": " << ec.message() << "\n";
+        return false;
+    }
+    return uploadMany(filepaths);
+}
+
+// Small files are packed into PutMany frames and pipelined a round at a time,
+// so memory stays bounded; larger files go through the streaming upload.
+bool Client::uploadMany(const std::vector<std::string>& filepaths) {
+    if (!logged_in) {
+        std::cerr << "Not logged in\n";
+        return false;
+    }
+
+    std::vector<std::string> large;
+    size_t stored = 0;
+    size_t failed = 0;
+    size_t i = 0;
+
+    while (i < filepaths.size()) {
+        std::vector<Protocol::Frame> requests;
+        std::vector<std::vector<std::string>> batch_names;
+
+        while (i < filepaths.size() && requests.size() < BATCHES_PER_ROUND) {
+            Protocol::Frame request = make_request(Protocol::Opcode::PutMany);
+            Protocol::Writer out(request.payload);
+            out.put_string(token);
+            size_t count_at = out.size();
+            out.put_u32(0);
+
+            std::vector<std::string> names;
+            while (i < filepaths.size() && names.size() < BATCH_FILES) {
+                const std::string& path = filepaths[i];
+                std::string name = std::filesystem::path(path).filename().string();
+                std::error_code ec;
+                uint64_t size = std::filesystem::file_size(path, ec);
+                if (ec) {
+                    std::cerr << "Cannot read " << path << ": " << ec.message() << "\n";
+                    ++failed;
+                    ++i;
+                    continue;
+                }
+                if (size > SMALL_FILE_LIMIT) {
+                    large.push_back(path);
+                    ++i;
+                    continue;
+                }
+                if (!names.empty() && out.size() + name.size() + 12 + size > BATCH_BYTES)
+                    break;
+
+                size_t entry_at = out.size();
+                out.put_string(name);
+                out.put_u64(size);
+                if (!read_whole(path, out.extend((size_t)size), size)) {
+                    std::cerr << "Cannot read " << path << "\n";
+                    out.truncate(entry_at);
+                    ++failed;
+                    ++i;
+                    continue;
+                }
+                names.push_back(name);
+                ++i;
+            }
+            if (names.empty())
+                continue;
+
+            uint32_t count_net = htobe32((uint32_t)names.size());
+            memcpy(request.payload.data() + count_at, &count_net, sizeof(count_net));
+            requests.push_back(std::move(request));
+            batch_names.push_back(std::move(names));
+        }
+        if (requests.empty())
+            continue;
+
+        std::vector<Protocol::Frame> responses;
+        if (!pipeline(requests, responses))
             return false;
+
+        for (size_t b = 0; b < responses.size(); ++b) {
+            const std::vector<std::string>& names = batch_names[b];
+            if (responses[b].status != Protocol::Status::Ok) {
+                std::cerr << "Batch of " << names.size() << " files failed: "
+                          << Protocol::status_name(responses[b].status) << "\n";
+                failed += names.size();
+                continue;
+            }
+            Protocol::Reader in(responses[b].payload);
+            uint32_t count = in.get_u32();
+            for (size_t k = 0; k < names.size(); ++k) {
+                Protocol::Status status = k < count ? (Protocol::Status)in.get_u16() : Protocol::Status::Error;
+                if (in.ok() && status == Protocol::Status::Ok) {
+                    ++stored;
+                } else {
+                    std::cerr << names[k] << ": " << Protocol::status_name(status) << "\n";
+                    ++failed;
+                }
+            }
         }
-        std::cout << " - " << fname << "\n";
     }
 
-    closeConnection();
-    return true;
-}
\ No newline at end of file
+    for (const std::string& path : large) {
+        if (uploadFile(path))
+            ++stored;
+        else
+            ++failed;
+    }
+
+    std::cout << "Uploaded " << stored << " of " << filepaths.size() << " files\n";
+    return failed == 0;
+}
+
+// Names are requested in GetMany frames; files the server defers are asked
+// for again, and files too large for a frame fall back to downloadFile.
+bool Client::downloadMany(const std::vector<std::string>& filenames) {
+    if (!logged_in) {
+        std::cerr << "Not logged in\n";
+        return false;
+    }
+
+    std::vector<std::string> wanted = filenames;
+    std::vector<std::string> large;
+    size_t saved = 0;
+    size_t failed = 0;
+
+    while (!wanted.empty()) {
+        std::vector<std::string> deferred;
+
+        for (size_t start = 0; start < wanted.size(); start += BATCH_FILES * BATCHES_PER_ROUND) {
+            size_t end = std::min(wanted.size(), start + BATCH_FILES * BATCHES_PER_ROUND);
+
+            std::vector<Protocol::Frame> requests;
+            for (size_t first = start; first < end; first += BATCH_FILES) {
+                size_t last = std::min(end, first + BATCH_FILES);
+                Protocol::Frame request = make_request(Protocol::Opcode::GetMany);
+                Protocol::Writer out(request.payload);
+                out.put_string(token);
+                out.put_u32((uint32_t)(last - first));
+                for (size_t k = first; k < last; ++k)
+                    out.put_string(wanted[k]);
+                requests.push_back(std::move(request));
+            }
+
+            std::vector<Protocol::Frame> responses;
+            if (!pipeline(requests, responses))
+                return false;
+
+            for (size_t b = 0; b < responses.size(); ++b) {
+                size_t first = start + b * BATCH_FILES;
+                size_t last = std::min(end, first + BATCH_FILES);
+                if (responses[b].status != Protocol::Status::Ok) {
+                    std::cerr << "Batch of " << last - first << " files failed: "
+                              << Protocol::status_name(responses[b].status) << "\n";
+                    failed += last - first;
+                    continue;
+                }
+
+                Protocol::Reader in(responses[b].payload);
+                uint32_t count = in.get_u32();
+                for (size_t k = first; k < last; ++k) {
+                    const std::string& name = wanted[k];
+                    Protocol::Status status = k - first < count ? (Protocol::Status)in.get_u16() : Protocol::Status::Error;
+                    if (!in.ok())
+                        status = Protocol::Status::Error;
+
+                    if (status == Protocol::Status::Ok) {
+                        uint64_t size = in.get_u64();
+                        const char* data = in.get_bytes((size_t)size);
+                        if (data && save_whole(name, data, (size_t)size)) {
+                            ++saved;
+                        } else {
+                            std::cerr << name << ": could not save\n";
+                            ++failed;
+                        }
+                    } else if (status == Protocol::Status::Deferred) {
+                        deferred.push_back(name);
+                    } else if (status == Protocol::Status::TooLarge) {
+                        large.push_back(name);
+                    } else {
+                        std::cerr << name << ": " << Protocol::status_name(status) << "\n";
+                        ++failed;
+                    }
+                }
+            }
+        }
+
+        // No progress this round: let the streaming path take what is left
+        if (deferred.size() == wanted.size()) {
+            large.insert(large.end(), deferred.begin(), deferred.end());
+            deferred.clear();
+        }
+        wanted.swap(deferred);
+    }
+
+    for (const std::string& name : large) {
+        if (downloadFile(name))
+            ++saved;
+        else
+            ++failed;
+    }
+
+    std::cout << "Downloaded " << saved << " of " << filenames.size() << " files\n";
+    return failed == 0;
+}
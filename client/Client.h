@@ -2,31 +2,85 @@
 
 #include <string>
 #include <optional>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "../common/Connection.h"
+#include "../common/Protocol.h"
+#include "../common/Delta.h"
 
 class Client {
 private:
     std::string server_ip;
     int server_port;
-    int sockfd;
+    Connection conn;
     std::string token;
     bool connected;
     bool logged_in;
+    int stripe_count;            // parallel streams for large transfers (1 = single stream)
+    bool compression;            // compress whole-file transfers (negotiated per transfer)
+    uint32_t next_request_id = 0;
 
-    // Helper method to establish connection
+    // Helper method to establish connection; an open keep-alive session is reused
     bool connectToServer();
+    bool openConnection(Connection& target);
     void closeConnection();
+    bool sendCommand(const char* command);  // (re)connect if needed and send a 5-byte command
+    bool sendTokenAndName(const std::string& filename);
+
+    // Protocol v2: small operations as framed, pipelined requests
+    bool pipeline(std::vector<Protocol::Frame>& requests, std::vector<Protocol::Frame>& responses);
+    bool call(Protocol::Frame& request, Protocol::Frame& response);
+    bool callRetryingBusy(const Protocol::Frame& request, Protocol::Frame& response);
+    bool uploadSmall(const std::string& filepath, const std::string& filename, uint64_t filesize);
+    bool uploadByHash(const std::string& filename, const std::string& hex, uint64_t filesize);
+
+    // Delta uploads against the server's existing copy
+    bool remoteSignatures(const std::string& filename, uint64_t& base_size, uint32_t& block_size,
+                          std::vector<Delta::BlockSignature>& signatures);
+    bool uploadDelta(const std::string& filepath, const std::string& filename, const std::string& hex,
+                     uint64_t filesize, bool& handled);
+
+    // Parallel (striped) transfers, each stripe on its own connection
+    bool remoteFileSize(const std::string& filename, uint64_t& filesize);
+    bool runStripes(uint64_t filesize, const std::function<bool(uint64_t, uint64_t)>& fn);
+    bool uploadStriped(const std::string& filepath, const std::string& filename, uint64_t filesize);
+    bool downloadStriped(const std::string& filename, uint64_t filesize);
+
+    bool uploadCompressed(const std::string& filepath, const std::string& filename, uint64_t filesize);
+    bool downloadCompressed(const std::string& filename);
 
 public:
+    static constexpr int MAX_STRIPES = 16;
+
     Client(const std::string& ip = "127.0.0.1", int port = 8080);
     ~Client();
 
+    void disconnect();  // say goodbye and end the keep-alive session
+
     bool createUser(const std::string& username, const std::string& password);
     bool login(const std::string& username, const std::string& password);
     bool logout();
 
+    // Transfers resume automatically from a previous interrupted attempt
     bool uploadFile(const std::string& filepath);
     bool downloadFile(const std::string& filename);
-    bool list();
+    bool remoteUploadStatus(const std::string& filename, uint64_t& held);  // bytes of a partial upload
+
+    // Many files per request: small files are batched and pipelined
+    bool uploadMany(const std::vector<std::string>& filepaths);
+    bool uploadDirectory(const std::string& dirpath);   // regular files directly inside dirpath
+    bool downloadMany(const std::vector<std::string>& filenames);
+    bool list(const std::string& prefix = "", Protocol::ListSort sort = Protocol::ListSort::Name,
+              bool descending = false);
+    bool deleteFile(const std::string& filename);
+    bool metrics();     // server-side counters and latencies
+
+    void setStripeCount(int count);
+    int getStripeCount() const { return stripe_count; }
+    void setCompression(bool enabled) { compression = enabled; }
+    bool getCompression() const { return compression; }
 
     bool isLoggedIn() const { return logged_in; }
     bool isConnected() const { return connected; }
@@ -1,14 +1,24 @@
 #include "Client.h"
+#include "../common/BufferPool.h"
+#include "../common/Log.h"
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <csignal>
 
 int main() {
+    signal(SIGPIPE, SIG_IGN);  // a dropped keep-alive session is handled by reconnecting
+
+    BufferPool::instance().configure(BufferPool::chunk_size_from_env());
+    // Transfer errors from common/ must land between the prompts that caused them
+    Log::set_synchronous(true);
+
     Client client("127.0.0.1", 8080);
     std::string line;
 
     std::cout << "File Server Client\n";
-    std::cout << "Commands: create_user, login, logout, send <file>, get <file>, list, quit\n\n";
+    std::cout << "Commands: create_user, login, logout, send <file>, get <file>, send-dir <dir>, get-many <file>..., list [--size|--mtime] [--desc] [prefix], delete <file>, metrics, stripes <n>, compress on|off, quit\n\n";
 
     while (true) {
         std::cout << "> ";
@@ -40,6 +50,26 @@ int main() {
                 client.downloadFile(filename);
             }
         }
+        else if (command == "send-dir") {
+            std::string dirpath;
+            ss >> dirpath;
+            if (dirpath.empty()) {
+                std::cerr << "Usage: send-dir <directory>\n";
+            } else {
+                client.uploadDirectory(dirpath);
+            }
+        }
+        else if (command == "get-many") {
+            std::vector<std::string> filenames;
+            std::string filename;
+            while (ss >> filename)
+                filenames.push_back(filename);
+            if (filenames.empty()) {
+                std::cerr << "Usage: get-many <filename> [filename...]\n";
+            } else {
+                client.downloadMany(filenames);
+            }
+        }
         else if (command == "create_user") {
             std::string username, password;
             std::cout << "username: ";
@@ -63,7 +93,52 @@ int main() {
         }
         else if (command == "list") {
             std::cout << "ENTER LSIT\n";
-            client.list();
+            std::string arg, prefix;
+            Protocol::ListSort sort = Protocol::ListSort::Name;
+            bool descending = false;
+            while (ss >> arg) {
+                if (arg == "--size")
+                    sort = Protocol::ListSort::Size;
+                else if (arg == "--mtime")
+                    sort = Protocol::ListSort::Mtime;
+                else if (arg == "--desc")
+                    descending = true;
+                else
+                    prefix = arg;
+            }
+            client.list(prefix, sort, descending);
+        }
+        else if (command == "delete") {
+            std::string filename;
+            ss >> filename;
+            if (filename.empty()) {
+                std::cerr << "Usage: delete <filename>\n";
+            } else {
+                client.deleteFile(filename);
+            }
+        }
+        else if (command == "metrics") {
+            client.metrics();
+        }
+        else if (command == "stripes") {
+            int count = 0;
+            ss >> count;
+            if (count <= 0) {
+                std::cerr << "Usage: stripes <count>   (currently " << client.getStripeCount() << ")\n";
+            } else {
+                client.setStripeCount(count);
+                std::cout << "Large transfers use " << client.getStripeCount() << " streams\n";
+            }
+        }
+        else if (command == "compress") {
+            std::string mode;
+            ss >> mode;
+            if (mode == "on" || mode == "off") {
+                client.setCompression(mode == "on");
+            } else {
+                std::cerr << "Usage: compress on|off\n";
+            }
+            std::cout << "Compression is " << (client.getCompression() ? "on" : "off") << "\n";
         }
         else if (command == "quit") {
             std::cout << "Exiting...\n";
@@ -0,0 +1,116 @@
+#include "BufferPool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <utility>
+
+BufferPool::Lease::Lease(BufferPool* pool, char* buffer, size_t capacity)
+    : pool(pool), buffer(buffer), capacity(capacity)
+{
+}
+
+BufferPool::Lease::~Lease() {
+    release();
+}
+
+BufferPool::Lease::Lease(Lease&& other) noexcept
+    : pool(std::exchange(other.pool, nullptr)),
+      buffer(std::exchange(other.buffer, nullptr)),
+      capacity(std::exchange(other.capacity, 0))
+{
+}
+
+BufferPool::Lease& BufferPool::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool = std::exchange(other.pool, nullptr);
+        buffer = std::exchange(other.buffer, nullptr);
+        capacity = std::exchange(other.capacity, 0);
+    }
+    return *this;
+}
+
+void BufferPool::Lease::release() {
+    if (buffer && pool)
+        pool->give_back(buffer, capacity);
+    pool = nullptr;
+    buffer = nullptr;
+    capacity = 0;
+}
+
+BufferPool& BufferPool::instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+BufferPool::~BufferPool() {
+    for (char* buffer : idle)
+        std::free(buffer);
+}
+
+void BufferPool::configure(size_t chunk_size, size_t max_idle_buffers) {
+    chunk_size = std::clamp(chunk_size, MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+    chunk_size = (chunk_size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (chunk_size != chunk) {
+        // Outstanding leases of the old size are freed when they come back
+        for (char* buffer : idle)
+            std::free(buffer);
+        idle.clear();
+        chunk = chunk_size;
+    }
+    max_idle = max_idle_buffers;
+}
+
+size_t BufferPool::chunk_size() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return chunk;
+}
+
+BufferPool::Lease BufferPool::acquire() {
+    size_t size;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        size = chunk;
+        if (!idle.empty()) {
+            char* buffer = idle.back();
+            idle.pop_back();
+            return Lease(this, buffer, size);
+        }
+    }
+
+    void* buffer = std::aligned_alloc(ALIGNMENT, size);
+    if (!buffer)
+        throw std::bad_alloc();
+    return Lease(this, static_cast<char*>(buffer), size);
+}
+
+void BufferPool::give_back(char* buffer, size_t capacity) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (capacity == chunk && idle.size() < max_idle) {
+            idle.push_back(buffer);
+            return;
+        }
+    }
+    std::free(buffer);
+}
+
+size_t BufferPool::chunk_size_from_env(size_t fallback) {
+    const char* value = std::getenv("FILESERVER_CHUNK_SIZE");
+    if (!value || !*value)
+        return fallback;
+
+    char* end = nullptr;
+    unsigned long long n = std::strtoull(value, &end, 10);
+    if (end == value)
+        return fallback;
+    if (*end == 'k' || *end == 'K')
+        n *= 1024ull;
+    else if (*end == 'm' || *end == 'M')
+        n *= 1024ull * 1024ull;
+    return n ? (size_t)n : fallback;
+}
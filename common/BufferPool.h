@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Process-wide pool of page-aligned transfer buffers. Every transfer loop
+// borrows one chunk-sized buffer per connection, so steady-state transfers
+// never hit the allocator.
+class BufferPool {
+public:
+    static constexpr size_t ALIGNMENT = 4096;
+    static constexpr size_t MIN_CHUNK_SIZE = 64 * 1024;
+    static constexpr size_t MAX_CHUNK_SIZE = 64 * 1024 * 1024;
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+
+    // RAII handle on one pooled buffer; returns it to the pool when destroyed
+    class Lease {
+    public:
+        Lease() = default;
+        ~Lease();
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+
+        char* data() const { return buffer; }
+        size_t size() const { return capacity; }
+        explicit operator bool() const { return buffer != nullptr; }
+
+    private:
+        friend class BufferPool;
+        Lease(BufferPool* pool, char* buffer, size_t capacity);
+        void release();
+
+        BufferPool* pool = nullptr;
+        char* buffer = nullptr;
+        size_t capacity = 0;
+    };
+
+    static BufferPool& instance();
+
+    // Chunk size is clamped to [MIN_CHUNK_SIZE, MAX_CHUNK_SIZE] and rounded to ALIGNMENT.
+    // Idle buffers beyond max_idle are freed instead of cached.
+    void configure(size_t chunk_size, size_t max_idle = 32);
+    size_t chunk_size();
+
+    Lease acquire();
+
+    // FILESERVER_CHUNK_SIZE (bytes, or with a K/M suffix) overrides the fallback
+    static size_t chunk_size_from_env(size_t fallback = DEFAULT_CHUNK_SIZE);
+
+    ~BufferPool();
+
+private:
+    BufferPool() = default;
+    void give_back(char* buffer, size_t capacity);
+
+    std::mutex mtx;
+    std::vector<char*> idle;
+    size_t chunk = DEFAULT_CHUNK_SIZE;
+    size_t max_idle = 32;
+};
@@ -0,0 +1,141 @@
+#include "Checksum.h"
+#include "BufferPool.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace {
+    constexpr uint32_t POLY = 0x82F63B78;   // Castagnoli, reflected
+
+    // table[k][b]: CRC of byte b followed by k zero bytes
+    struct Tables {
+        uint32_t table[8][256];
+
+        Tables() {
+            for (uint32_t b = 0; b < 256; ++b) {
+                uint32_t crc = b;
+                for (int i = 0; i < 8; ++i)
+                    crc = (crc >> 1) ^ (POLY & (0u - (crc & 1)));
+                table[0][b] = crc;
+            }
+            for (uint32_t b = 0; b < 256; ++b) {
+                for (int k = 1; k < 8; ++k)
+                    table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+            }
+        }
+    };
+
+    const Tables& tables() {
+        static const Tables t;
+        return t;
+    }
+
+    uint32_t crc_portable(uint32_t crc, const unsigned char* p, size_t size) {
+        const Tables& t = tables();
+        while (size >= 8) {
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            word ^= crc;    // little-endian: the low four bytes absorb the running CRC
+            crc = t.table[7][word & 0xFF] ^
+                  t.table[6][(word >> 8) & 0xFF] ^
+                  t.table[5][(word >> 16) & 0xFF] ^
+                  t.table[4][(word >> 24) & 0xFF] ^
+                  t.table[3][(word >> 32) & 0xFF] ^
+                  t.table[2][(word >> 40) & 0xFF] ^
+                  t.table[1][(word >> 48) & 0xFF] ^
+                  t.table[0][word >> 56];
+            p += 8;
+            size -= 8;
+        }
+        while (size--)
+            crc = (crc >> 8) ^ t.table[0][(crc ^ *p++) & 0xFF];
+        return crc;
+    }
+
+#if defined(__x86_64__)
+    // One crc32 instruction per 8 bytes; the dependency chain limits it to
+    // roughly 8 bytes every 3 cycles, well above what the network delivers.
+    __attribute__((target("sse4.2")))
+    uint32_t crc_sse42(uint32_t crc, const unsigned char* p, size_t size) {
+        while (size > 0 && ((uintptr_t)p & 7) != 0) {
+            crc = _mm_crc32_u8(crc, *p++);
+            --size;
+        }
+        uint64_t crc64 = crc;
+        while (size >= 32) {
+            uint64_t w0, w1, w2, w3;
+            memcpy(&w0, p, 8);
+            memcpy(&w1, p + 8, 8);
+            memcpy(&w2, p + 16, 8);
+            memcpy(&w3, p + 24, 8);
+            crc64 = _mm_crc32_u64(crc64, w0);
+            crc64 = _mm_crc32_u64(crc64, w1);
+            crc64 = _mm_crc32_u64(crc64, w2);
+            crc64 = _mm_crc32_u64(crc64, w3);
+            p += 32;
+            size -= 32;
+        }
+        while (size >= 8) {
+            uint64_t w;
+            memcpy(&w, p, 8);
+            crc64 = _mm_crc32_u64(crc64, w);
+            p += 8;
+            size -= 8;
+        }
+        crc = (uint32_t)crc64;
+        while (size--)
+            crc = _mm_crc32_u8(crc, *p++);
+        return crc;
+    }
+#endif
+
+    using Kernel = uint32_t (*)(uint32_t, const unsigned char*, size_t);
+
+    // Picked once, on first use
+    Kernel kernel() {
+        static const Kernel k = [] {
+#if defined(__x86_64__)
+            if (__builtin_cpu_supports("sse4.2"))
+                return (Kernel)crc_sse42;
+#endif
+            return (Kernel)crc_portable;
+        }();
+        return k;
+    }
+}
+
+uint32_t Checksum::crc32c(uint32_t crc, const void* data, size_t size) {
+    return ~kernel()(~crc, static_cast<const unsigned char*>(data), size);
+}
+
+uint32_t Checksum::crc32c_portable(uint32_t crc, const void* data, size_t size) {
+    return ~crc_portable(~crc, static_cast<const unsigned char*>(data), size);
+}
+
+bool Checksum::hardware() {
+    return kernel() != (Kernel)crc_portable;
+}
+
+bool Checksum::of_fd(int fd, uint64_t offset, uint64_t length, uint32_t& crc) {
+    BufferPool::Lease buffer = BufferPool::instance().acquire();
+    uint32_t running = 0;
+    uint64_t done = 0;
+    while (done < length) {
+        size_t want = (size_t)std::min<uint64_t>(buffer.size(), length - done);
+        ssize_t r = pread(fd, buffer.data(), want, (off_t)(offset + done));
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        running = crc32c(running, buffer.data(), (size_t)r);
+        done += (uint64_t)r;
+    }
+    crc = running;
+    return true;
+}
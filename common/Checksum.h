@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli) for end-to-end transfer checks. Both sides run it over
+// the bytes as they stream and compare results through a 4-byte trailer, so
+// corruption anywhere between the two disks is caught. x86-64 CPUs with
+// SSE4.2 compute it in hardware; others fall back to slicing-by-8 tables.
+class Checksum {
+public:
+    // Running checksum: start with 0 and feed the previous result back in
+    static uint32_t crc32c(uint32_t crc, const void* data, size_t size);
+
+    // Always the table implementation, whatever the CPU supports
+    static uint32_t crc32c_portable(uint32_t crc, const void* data, size_t size);
+
+    static bool hardware();          // true when crc32c() uses the crc32 instruction
+
+    // Checksum of [offset, offset + length) of fd, read with pread
+    static bool of_fd(int fd, uint64_t offset, uint64_t length, uint32_t& crc);
+};
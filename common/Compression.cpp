@@ -0,0 +1,261 @@
+#include "Compression.h"
+#include "BufferPool.h"
+#include "Network.h"
+#include "Checksum.h"
+#include "Log.h"
+
+#include <zlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <arpa/inet.h>
+
+namespace {
+    constexpr size_t HEADER_SIZE = 9;
+    constexpr size_t ENTROPY_SAMPLE = 64 * 1024;
+    constexpr double MAX_ENTROPY = 7.5;       // bits per byte; compressed or encrypted data sits near 8
+    constexpr size_t QUEUE_DEPTH = 4;         // chunks compressed ahead of the sender
+
+    void put_header(char* header, uint8_t codec, uint32_t raw_len, uint32_t wire_len) {
+        uint32_t raw_net = htonl(raw_len);
+        uint32_t wire_net = htonl(wire_len);
+        header[0] = (char)codec;
+        memcpy(header + 1, &raw_net, sizeof(raw_net));
+        memcpy(header + 5, &wire_net, sizeof(wire_net));
+    }
+
+    bool read_fully(int fd, char* buf, size_t len, uint64_t offset) {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t r = pread(fd, buf + done, len - done, (off_t)(offset + done));
+            if (r == -1 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return false;
+            done += (size_t)r;
+        }
+        return true;
+    }
+
+    bool write_fully(int fd, const char* buf, size_t len, uint64_t offset) {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t w = pwrite(fd, buf + done, len - done, (off_t)(offset + done));
+            if (w == -1 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return false;
+            done += (size_t)w;
+        }
+        return true;
+    }
+
+    // One encoded chunk handed from the compression thread to the sender
+    struct Chunk {
+        uint8_t codec = Compression::NONE;
+        uint32_t raw_len = 0;
+        std::vector<char> raw;
+        std::vector<char> wire;
+    };
+}
+
+uint8_t Compression::negotiate(uint8_t requested) {
+    return requested == DEFLATE ? DEFLATE : NONE;
+}
+
+double Compression::entropy(const char* data, size_t len) {
+    if (len == 0)
+        return 0.0;
+    size_t counts[256] = {0};
+    for (size_t i = 0; i < len; ++i)
+        counts[(unsigned char)data[i]]++;
+    double bits = 0.0;
+    for (size_t c : counts) {
+        if (c == 0)
+            continue;
+        double p = (double)c / (double)len;
+        bits -= p * std::log2(p);
+    }
+    return bits;
+}
+
+bool Compression::worth_compressing(const char* data, size_t len) {
+    return entropy(data, std::min(len, ENTROPY_SAMPLE)) < MAX_ENTROPY;
+}
+
+bool Compression::compress_chunk(uint8_t codec, const char* in, size_t len, std::vector<char>& out) {
+    if (codec != DEFLATE || len == 0)
+        return false;
+    uLongf bound = compressBound((uLong)len);
+    out.resize(bound);
+    if (compress2((Bytef*)out.data(), &bound, (const Bytef*)in, (uLong)len, Z_BEST_SPEED) != Z_OK)
+        return false;
+    if (bound >= len)
+        return false;
+    out.resize(bound);
+    return true;
+}
+
+bool Compression::decompress_chunk(uint8_t codec, const char* in, size_t len, char* out, size_t raw_len) {
+    if (codec != DEFLATE)
+        return false;
+    uLongf out_len = (uLongf)raw_len;
+    return uncompress((Bytef*)out, &out_len, (const Bytef*)in, (uLong)len) == Z_OK && out_len == raw_len;
+}
+
+int Compression::send_stream(Connection& conn, int file_fd, uint64_t offset, uint64_t length, uint8_t codec,
+                             uint32_t* crc) {
+    const size_t chunk_size = std::min<size_t>(BufferPool::instance().chunk_size(), MAX_CHUNK);
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Chunk> ready;
+    std::vector<Chunk> spare;      // sent chunks, reused so steady state does not allocate
+    bool failed = false;           // either side gave up
+    bool producer_done = false;
+    uint32_t running_crc = 0;      // producer thread only
+
+    std::thread producer([&]() {
+        bool compressing = codec != NONE;
+        bool sampled = false;
+        uint64_t done = 0;
+        while (done < length) {
+            Chunk chunk;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&] { return failed || ready.size() < QUEUE_DEPTH; });
+                if (failed)
+                    break;
+                if (!spare.empty()) {
+                    chunk = std::move(spare.back());
+                    spare.pop_back();
+                }
+            }
+
+            chunk.raw_len = (uint32_t)std::min<uint64_t>(chunk_size, length - done);
+            chunk.raw.resize(chunk.raw_len);
+            if (!read_fully(file_fd, chunk.raw.data(), chunk.raw_len, offset + done)) {
+                LOG_ERRNO("read for compressed send failed");
+                std::lock_guard<std::mutex> lock(mtx);
+                failed = true;
+                break;
+            }
+            if (crc)
+                running_crc = Checksum::crc32c(running_crc, chunk.raw.data(), chunk.raw_len);
+
+            // Decide once, from the first chunk, whether the data compresses at all
+            if (compressing && !sampled) {
+                compressing = worth_compressing(chunk.raw.data(), chunk.raw_len);
+                sampled = true;
+            }
+            chunk.codec = compressing && compress_chunk(codec, chunk.raw.data(), chunk.raw_len, chunk.wire)
+                          ? codec : (uint8_t)NONE;
+            done += chunk.raw_len;
+
+            std::lock_guard<std::mutex> lock(mtx);
+            ready.push_back(std::move(chunk));
+            cv.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        producer_done = true;
+        cv.notify_all();
+    });
+
+    uint64_t sent = 0;
+    while (sent < length) {
+        Chunk chunk;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&] { return failed || !ready.empty() || producer_done; });
+            if (failed || ready.empty())
+                break;
+            chunk = std::move(ready.front());
+            ready.pop_front();
+            cv.notify_all();
+        }
+
+        const std::vector<char>& payload = chunk.codec == NONE ? chunk.raw : chunk.wire;
+        size_t wire_len = chunk.codec == NONE ? chunk.raw_len : payload.size();
+        char header[HEADER_SIZE];
+        put_header(header, chunk.codec, chunk.raw_len, (uint32_t)wire_len);
+        if (Network::send_raw(conn, header, sizeof(header)) != 0 ||
+            Network::send_raw(conn, payload.data(), wire_len) != 0) {
+            std::lock_guard<std::mutex> lock(mtx);
+            failed = true;
+            cv.notify_all();
+            break;
+        }
+        sent += chunk.raw_len;
+
+        std::lock_guard<std::mutex> lock(mtx);
+        spare.push_back(std::move(chunk));
+    }
+
+    producer.join();
+    if (crc)
+        *crc = running_crc;
+    return sent == length ? 0 : -1;
+}
+
+uint64_t Compression::recv_stream(Connection& conn, int file_fd, uint64_t offset, uint64_t length,
+                                  uint32_t* crc) {
+    BufferPool::Lease raw_buffer = BufferPool::instance().acquire();
+    std::vector<char> raw;
+    std::vector<char> wire;
+    uint64_t received = 0;
+    uint32_t running_crc = 0;
+
+    while (received < length) {
+        char header[HEADER_SIZE];
+        if (Network::recv_all(conn, header, sizeof(header)) != (ssize_t)sizeof(header))
+            break;
+        uint8_t codec = (uint8_t)header[0];
+        uint32_t raw_net, wire_net;
+        memcpy(&raw_net, header + 1, sizeof(raw_net));
+        memcpy(&wire_net, header + 5, sizeof(wire_net));
+        uint32_t raw_len = ntohl(raw_net);
+        uint32_t wire_len = ntohl(wire_net);
+
+        if (raw_len == 0 || raw_len > MAX_CHUNK || raw_len > length - received ||
+            (codec == NONE && wire_len != raw_len) || (codec != NONE && (codec != DEFLATE || wire_len > raw_len))) {
+            LOG_ERROR("Bad compressed chunk header");
+            break;
+        }
+
+        // Raw chunks land straight in the pooled buffer when they fit
+        char* dest = raw_buffer.data();
+        if (raw_len > raw_buffer.size()) {
+            raw.resize(raw_len);
+            dest = raw.data();
+        }
+        if (codec == NONE) {
+            if (Network::recv_all(conn, dest, raw_len) != (ssize_t)raw_len)
+                break;
+        } else {
+            wire.resize(wire_len);
+            if (Network::recv_all(conn, wire.data(), wire_len) != (ssize_t)wire_len)
+                break;
+            if (!decompress_chunk(codec, wire.data(), wire_len, dest, raw_len)) {
+                LOG_ERROR("Corrupt compressed chunk");
+                break;
+            }
+        }
+
+        if (!write_fully(file_fd, dest, raw_len, offset + received)) {
+            LOG_ERRNO("write failed");
+            break;
+        }
+        if (crc)
+            running_crc = Checksum::crc32c(running_crc, dest, raw_len);
+        received += raw_len;
+    }
+    if (crc)
+        *crc = running_crc;
+    return received;
+}
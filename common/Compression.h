@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/types.h>
+
+#include "Connection.h"
+
+// Optional per-transfer compression for streamed file data. A compressed
+// stream is a sequence of chunks, each with a 9-byte header:
+//
+//   u8 codec, u32 raw length, u32 wire length, then wire-length bytes
+//
+// Every chunk says how it was encoded, so the sender can fall back to storing
+// chunks raw at any point. If a sample of the first chunk looks like
+// already-compressed data, the whole stream goes raw.
+class Compression {
+public:
+    enum Codec : uint8_t {
+        NONE = 0,
+        DEFLATE = 1,    // zlib, fastest level
+    };
+
+    static constexpr uint32_t MAX_CHUNK = 16 * 1024 * 1024;
+
+    // Best codec this build supports out of what the peer asked for
+    static uint8_t negotiate(uint8_t requested);
+
+    static double entropy(const char* data, size_t len);       // bits per byte of a sample
+    static bool worth_compressing(const char* data, size_t len);
+
+    // Reads [offset, offset + length) of file_fd and sends it as chunks.
+    // Reading and compressing run on a helper thread, overlapping the sends.
+    // crc, when given, receives the CRC32C of the raw bytes for the trailer.
+    static int send_stream(Connection& conn, int file_fd, uint64_t offset, uint64_t length, uint8_t codec,
+                           uint32_t* crc = nullptr);
+
+    // Receives chunks for exactly length raw bytes into file_fd at offset.
+    // Returns the raw bytes stored; short only if the stream failed.
+    static uint64_t recv_stream(Connection& conn, int file_fd, uint64_t offset, uint64_t length,
+                                uint32_t* crc = nullptr);
+
+    // Compressed to wire bytes; false when the result would not be smaller
+    static bool compress_chunk(uint8_t codec, const char* in, size_t len, std::vector<char>& out);
+    static bool decompress_chunk(uint8_t codec, const char* in, size_t len, char* out, size_t raw_len);
+};
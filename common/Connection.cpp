@@ -0,0 +1,46 @@
+#include "Connection.h"
+
+#include <unistd.h>
+#include <utility>
+#include <openssl/ssl.h>
+
+Connection::Connection(int fd)
+    : fd(fd), ssl(nullptr)
+{
+}
+
+Connection::~Connection() {
+    close();
+}
+
+Connection::Connection(Connection&& other) noexcept
+    : fd(std::exchange(other.fd, -1)), ssl(std::exchange(other.ssl, nullptr))
+{
+}
+
+Connection& Connection::operator=(Connection&& other) noexcept {
+    if (this != &other) {
+        close();
+        fd = std::exchange(other.fd, -1);
+        ssl = std::exchange(other.ssl, nullptr);
+    }
+    return *this;
+}
+
+void Connection::close_tls() {
+    if (!ssl)
+        return;
+    // Don't wait for bidirectional shutdown, just send close_notify
+    SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    ssl = nullptr;
+}
+
+void Connection::close() {
+    close_tls();
+    if (fd != -1) {
+        ::close(fd);
+        fd = -1;
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+typedef struct ssl_st SSL;
+
+// Transport state of a single connection: the socket and, once wrapped, its TLS session.
+// Each connection owns its SSL*, so I/O on different connections never shares a lock.
+class Connection {
+public:
+    Connection() = default;
+    explicit Connection(int fd);
+    ~Connection();
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+    Connection(Connection&& other) noexcept;
+    Connection& operator=(Connection&& other) noexcept;
+
+    int get_fd() const { return fd; }
+    SSL* get_ssl() const { return ssl; }
+    bool is_tls() const { return ssl != nullptr; }
+    bool is_open() const { return fd != -1; }
+
+    void set_ssl(SSL* session) { ssl = session; }
+
+    void close_tls();   // send close_notify and free the TLS session
+    void close();       // close both TLS and socket
+
+private:
+    int fd = -1;
+    SSL* ssl = nullptr;
+};
@@ -0,0 +1,81 @@
+#include "ContentHash.h"
+#include "BufferPool.h"
+#include "Checksum.h"
+
+#include <sodium.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+namespace {
+    // sodium_init is idempotent and thread-safe; the client never calls it otherwise
+    bool sodium_ready() {
+        static const bool ready = sodium_init() >= 0;
+        return ready;
+    }
+
+    std::string to_hex(const unsigned char* digest) {
+        char hex[ContentHash::HEX_LENGTH + 1];
+        sodium_bin2hex(hex, sizeof(hex), digest, ContentHash::BYTES);
+        return std::string(hex, ContentHash::HEX_LENGTH);
+    }
+}
+
+bool ContentHash::of_fd(int fd, std::string& hex, uint64_t& size, uint32_t* crc) {
+    if (!sodium_ready())
+        return false;
+
+    crypto_generichash_state state;
+    crypto_generichash_init(&state, nullptr, 0, BYTES);
+
+    BufferPool::Lease buffer = BufferPool::instance().acquire();
+    uint64_t total = 0;
+    uint32_t running_crc = 0;
+    while (true) {
+        ssize_t r = pread(fd, buffer.data(), buffer.size(), (off_t)total);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return false;
+        if (r == 0)
+            break;
+        crypto_generichash_update(&state, (const unsigned char*)buffer.data(), (size_t)r);
+        if (crc)
+            running_crc = Checksum::crc32c(running_crc, buffer.data(), (size_t)r);
+        total += (uint64_t)r;
+    }
+
+    unsigned char digest[BYTES];
+    crypto_generichash_final(&state, digest, BYTES);
+    hex = to_hex(digest);
+    size = total;
+    if (crc)
+        *crc = running_crc;
+    return true;
+}
+
+bool ContentHash::of_file(const std::string& path, std::string& hex, uint64_t& size) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    bool ok = of_fd(fd, hex, size);
+    close(fd);
+    return ok;
+}
+
+std::string ContentHash::of_buffer(const void* data, size_t size) {
+    sodium_ready();
+    unsigned char digest[BYTES];
+    crypto_generichash(digest, BYTES, (const unsigned char*)data, size, nullptr, 0);
+    return to_hex(digest);
+}
+
+bool ContentHash::valid_hex(const std::string& hex) {
+    if (hex.size() != HEX_LENGTH)
+        return false;
+    for (char c : hex) {
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// BLAKE2b-256 content digests, hex encoded. Identical bytes give identical
+// digests on client and server, which is what deduplication keys on.
+class ContentHash {
+public:
+    static constexpr size_t BYTES = 32;
+    static constexpr size_t HEX_LENGTH = BYTES * 2;
+
+    // Reads from offset 0. crc, when given, also receives the CRC32C of the
+    // same bytes so callers needing both read the file once.
+    static bool of_fd(int fd, std::string& hex, uint64_t& size, uint32_t* crc = nullptr);
+    static bool of_file(const std::string& path, std::string& hex, uint64_t& size);
+    static std::string of_buffer(const void* data, size_t size);
+
+    static bool valid_hex(const std::string& hex);
+};
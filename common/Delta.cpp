@@ -0,0 +1,154 @@
+#include "Delta.h"
+
+#include <sodium.h>
+#include <unistd.h>
+#include <cerrno>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+    constexpr uint32_t MIN_BLOCK = 2 * 1024;
+    constexpr uint32_t MAX_BLOCK = 128 * 1024;
+
+    // Rolling state of the weak checksum over a window of len bytes
+    struct Rolling {
+        uint32_t a = 0;
+        uint32_t b = 0;
+        size_t len = 0;
+
+        void init(const unsigned char* data, size_t n) {
+            a = b = 0;
+            len = n;
+            for (size_t i = 0; i < n; ++i) {
+                a += data[i];
+                b += (uint32_t)(n - i) * data[i];
+            }
+        }
+
+        void roll(unsigned char out, unsigned char in) {
+            a = a - out + in;
+            b = b - (uint32_t)len * out + a;
+        }
+
+        uint32_t digest() const { return (a & 0xffff) | (b << 16); }
+    };
+}
+
+// About sqrt(size), as rsync does, rounded to a power of two
+uint32_t Delta::block_size_for(uint64_t file_size) {
+    uint32_t block = MIN_BLOCK;
+    uint64_t target = (uint64_t)std::sqrt((double)file_size);
+    while (block < MAX_BLOCK && block < target)
+        block <<= 1;
+    return block;
+}
+
+uint32_t Delta::weak_checksum(const unsigned char* data, size_t len) {
+    Rolling r;
+    r.init(data, len);
+    return r.digest();
+}
+
+void Delta::strong_checksum(const unsigned char* data, size_t len, unsigned char out[STRONG_BYTES]) {
+    crypto_generichash(out, STRONG_BYTES, data, len, nullptr, 0);
+}
+
+bool Delta::signatures_of_fd(int fd, uint32_t block_size, std::vector<BlockSignature>& out) {
+    if (sodium_init() < 0)
+        return false;
+
+    // Read many whole blocks per syscall
+    size_t per_read = std::max<size_t>(1, (1024 * 1024) / block_size);
+    std::vector<unsigned char> buffer(per_read * block_size);
+    out.clear();
+
+    uint64_t offset = 0;
+    while (true) {
+        size_t filled = 0;
+        while (filled < buffer.size()) {
+            ssize_t r = pread(fd, buffer.data() + filled, buffer.size() - filled, (off_t)(offset + filled));
+            if (r == -1 && errno == EINTR)
+                continue;
+            if (r < 0)
+                return false;
+            if (r == 0)
+                break;
+            filled += (size_t)r;
+        }
+
+        for (size_t pos = 0; pos + block_size <= filled; pos += block_size) {
+            BlockSignature sig;
+            sig.weak = weak_checksum(buffer.data() + pos, block_size);
+            strong_checksum(buffer.data() + pos, block_size, sig.strong);
+            out.push_back(sig);
+        }
+        if (filled < buffer.size())
+            return true;    // a trailing partial block is never matched
+        offset += filled;
+    }
+}
+
+std::vector<Delta::Op> Delta::compute(const unsigned char* data, uint64_t size, uint32_t block_size,
+                                      const std::vector<BlockSignature>& base) {
+    std::vector<Op> ops;
+    auto emit_literal = [&](uint64_t from, uint64_t to) {
+        if (to > from)
+            ops.push_back(Op{OP_LITERAL, from, to - from});
+    };
+    auto emit_copy = [&](uint64_t block) {
+        // Consecutive blocks of the base collapse into one reference
+        if (!ops.empty() && ops.back().kind == OP_COPY && ops.back().start + ops.back().length == block)
+            ops.back().length++;
+        else
+            ops.push_back(Op{OP_COPY, block, 1});
+    };
+
+    if (sodium_init() < 0 || base.empty() || size < block_size) {
+        emit_literal(0, size);
+        return ops;
+    }
+
+    std::unordered_map<uint32_t, std::vector<uint32_t>> by_weak;
+    by_weak.reserve(base.size());
+    for (uint32_t i = 0; i < base.size(); ++i)
+        by_weak[base[i].weak].push_back(i);
+
+    uint64_t literal_from = 0;
+    uint64_t pos = 0;
+    Rolling rolling;
+    rolling.init(data, block_size);
+
+    while (pos + block_size <= size) {
+        auto it = by_weak.find(rolling.digest());
+        if (it != by_weak.end()) {
+            unsigned char strong[STRONG_BYTES];
+            strong_checksum(data + pos, block_size, strong);
+            // Prefer the block right after the previous match so runs stay contiguous
+            uint32_t match = UINT32_MAX;
+            for (uint32_t candidate : it->second) {
+                if (memcmp(base[candidate].strong, strong, STRONG_BYTES) == 0) {
+                    match = candidate;
+                    if (!ops.empty() && ops.back().kind == OP_COPY && ops.back().start + ops.back().length == candidate)
+                        break;
+                }
+            }
+            if (match != UINT32_MAX) {
+                emit_literal(literal_from, pos);
+                emit_copy(match);
+                pos += block_size;
+                literal_from = pos;
+                if (pos + block_size <= size)
+                    rolling.init(data + pos, block_size);
+                continue;
+            }
+        }
+        if (pos + block_size < size)
+            rolling.roll(data[pos], data[pos + block_size]);
+        ++pos;
+    }
+
+    emit_literal(literal_from, size);
+    return ops;
+}
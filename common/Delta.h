@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// rsync-style delta encoding. The receiver describes the copy it already has
+// as per-block signatures (a rolling weak checksum plus a truncated BLAKE2b);
+// the sender slides a window over the new version and emits block references
+// wherever a block matches and literal bytes everywhere else.
+class Delta {
+public:
+    static constexpr size_t STRONG_BYTES = 16;
+
+    // Wire opcodes of a delta stream
+    static constexpr uint8_t OP_COPY = 'C';       // u64 first block, u32 block count
+    static constexpr uint8_t OP_LITERAL = 'L';    // u32 length, bytes
+    static constexpr uint8_t OP_END = 'E';        // 64-char hex digest of the result
+
+    struct BlockSignature {
+        uint32_t weak;
+        unsigned char strong[STRONG_BYTES];
+    };
+
+    struct Op {
+        uint8_t kind;        // OP_COPY or OP_LITERAL
+        uint64_t start;      // first block, or offset in the new file
+        uint64_t length;     // block count, or literal byte count
+    };
+
+    static uint32_t block_size_for(uint64_t file_size);
+
+    static uint32_t weak_checksum(const unsigned char* data, size_t len);
+    static void strong_checksum(const unsigned char* data, size_t len, unsigned char out[STRONG_BYTES]);
+
+    // Signatures of every full block of an open file
+    static bool signatures_of_fd(int fd, uint32_t block_size, std::vector<BlockSignature>& out);
+
+    // Ops that rebuild data[0, size) from a base with the given signatures
+    static std::vector<Op> compute(const unsigned char* data, uint64_t size, uint32_t block_size,
+                                   const std::vector<BlockSignature>& base);
+};
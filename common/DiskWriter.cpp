@@ -0,0 +1,424 @@
+#include "DiskWriter.h"
+#include "Log.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+namespace {
+    constexpr uint64_t SYNC_TAG = UINT64_MAX;   // user_data of linked fdatasync requests
+
+    DiskWriter::Options defaults;
+
+    int io_uring_setup(unsigned entries, struct io_uring_params* params) {
+        return (int)syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+    }
+
+    bool env_flag(const char* name, bool fallback) {
+        const char* value = std::getenv(name);
+        if (!value || !*value)
+            return fallback;
+        return !(strcmp(value, "0") == 0 || strcasecmp(value, "off") == 0 || strcasecmp(value, "false") == 0);
+    }
+}
+
+DiskWriter::Options DiskWriter::options_from_env() {
+    Options options;
+    if (const char* depth = std::getenv("FILESERVER_WRITE_DEPTH")) {
+        unsigned long n = std::strtoul(depth, nullptr, 10);
+        if (n > 0)
+            options.queue_depth = (unsigned)std::min<unsigned long>(n, 64);
+    }
+    options.direct = env_flag("FILESERVER_O_DIRECT", options.direct);
+    options.preallocate = env_flag("FILESERVER_FALLOCATE", options.preallocate);
+    options.io_uring = env_flag("FILESERVER_IO_URING", options.io_uring);
+    if (const char* sync = std::getenv("FILESERVER_FSYNC")) {
+        if (strcasecmp(sync, "end") == 0)
+            options.sync = Sync::End;
+        else if (strcasecmp(sync, "always") == 0)
+            options.sync = Sync::Always;
+    }
+    return options;
+}
+
+void DiskWriter::set_defaults(const Options& options) {
+    defaults = options;
+}
+
+DiskWriter::DiskWriter(int fd, uint64_t offset, uint64_t length)
+    : DiskWriter(fd, offset, length, defaults)
+{
+}
+
+DiskWriter::DiskWriter(int fd, uint64_t offset, uint64_t length, const Options& opts)
+    : fd(fd), options(opts)
+{
+    if (options.queue_depth == 0)
+        options.queue_depth = 1;
+
+    // KEEP_SIZE: the file length still says how much was really received,
+    // which is what resumable uploads go by
+    if (options.preallocate && length > 0)
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)length);
+
+    // Filesystems without O_DIRECT support refuse the flag; write buffered then
+    if (options.direct && offset % BufferPool::ALIGNMENT == 0) {
+        int flags = fcntl(fd, F_GETFL);
+        direct_mode = flags != -1 && fcntl(fd, F_SETFL, flags | O_DIRECT) == 0;
+    }
+
+    if (!options.io_uring || !ring_setup(options.queue_depth))
+        writer = std::thread(&DiskWriter::writer_loop, this);
+}
+
+DiskWriter::~DiskWriter() {
+    drain();
+    leave_direct_mode();
+    if (writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        writer.join();
+    }
+    ring_teardown();
+}
+
+BufferPool::Lease DiskWriter::acquire() {
+    if (ring_fd != -1) {
+        while (!failed && in_flight >= options.queue_depth) {
+            if (!ring_reap(true))
+                failed = true;
+        }
+        if (failed)
+            return BufferPool::Lease();
+    } else {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this] { return failed || outstanding < options.queue_depth; });
+        if (failed)
+            return BufferPool::Lease();
+        for (BufferPool::Lease& lease : written)
+            spare.push_back(std::move(lease));
+        written.clear();
+    }
+
+    if (!spare.empty()) {
+        BufferPool::Lease lease = std::move(spare.back());
+        spare.pop_back();
+        return lease;
+    }
+    return BufferPool::instance().acquire();
+}
+
+void DiskWriter::submit(BufferPool::Lease buffer, size_t len, uint64_t offset) {
+    if (len == 0) {
+        spare.push_back(std::move(buffer));
+        return;
+    }
+    // The short last chunk cannot go through O_DIRECT
+    if (direct_mode && !aligned(len, offset)) {
+        drain();
+        leave_direct_mode();
+    }
+
+    Pending pending;
+    pending.buffer = std::move(buffer);
+    pending.len = len;
+    pending.offset = offset;
+
+    if (ring_fd != -1) {
+        while (!failed && free_slots.empty()) {
+            if (!ring_reap(true))
+                failed = true;
+        }
+        if (failed)
+            return;
+        size_t slot = free_slots.back();
+        free_slots.pop_back();
+        slots[slot] = std::move(pending);
+        ++in_flight;
+        if (!ring_push(slot))
+            failed = true;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (failed)
+        return;
+    queue.push_back(std::move(pending));
+    ++outstanding;
+    cv.notify_all();
+}
+
+bool DiskWriter::finish() {
+    bool ok = drain();
+    leave_direct_mode();
+    if (ok && options.sync == Sync::End && fdatasync(fd) == -1) {
+        LOG_ERRNO("fdatasync failed");
+        ok = false;
+    }
+    return ok;
+}
+
+bool DiskWriter::drain() {
+    if (ring_fd != -1) {
+        while (in_flight > 0) {
+            if (!ring_reap(true)) {
+                // The ring is unusable; nothing more will complete through it
+                failed = true;
+                break;
+            }
+        }
+        return !failed;
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this] { return outstanding == 0; });
+    for (BufferPool::Lease& lease : written)
+        spare.push_back(std::move(lease));
+    written.clear();
+    return !failed;
+}
+
+bool DiskWriter::aligned(size_t len, uint64_t offset) const {
+    return len % BufferPool::ALIGNMENT == 0 && offset % BufferPool::ALIGNMENT == 0;
+}
+
+void DiskWriter::leave_direct_mode() {
+    if (!direct_mode)
+        return;
+    int flags = fcntl(fd, F_GETFL);
+    if (flags != -1)
+        fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+    direct_mode = false;
+}
+
+bool DiskWriter::write_now(const char* data, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t w = pwrite(fd, data + done, len - done, (off_t)(offset + done));
+        if (w == -1 && errno == EINTR)
+            continue;
+        if (w <= 0) {
+            LOG_ERRNO("write failed");
+            return false;
+        }
+        done += (size_t)w;
+    }
+    return true;
+}
+
+void DiskWriter::writer_loop() {
+    while (true) {
+        Pending pending;
+        bool skip;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+            pending = std::move(queue.front());
+            queue.pop_front();
+            skip = failed;
+        }
+
+        bool ok = skip || write_now(pending.buffer.data(), pending.len, pending.offset);
+        if (ok && !skip && options.sync == Sync::Always && fdatasync(fd) == -1) {
+            LOG_ERRNO("fdatasync failed");
+            ok = false;
+        }
+
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!ok)
+            failed = true;
+        written.push_back(std::move(pending.buffer));
+        --outstanding;
+        cv.notify_all();
+    }
+}
+
+// Room for every write plus the fdatasync linked behind it
+bool DiskWriter::ring_setup(unsigned depth) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int rfd = io_uring_setup(depth * 2, &params);
+    if (rfd == -1)
+        return false;   // ENOSYS, EPERM under seccomp, or memlock limits
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+        sq_size = cq_size = std::max(sq_size, cq_size);
+
+    sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        sq_ptr = nullptr;
+        close(rfd);
+        return false;
+    }
+    cq_ptr = single_mmap ? sq_ptr
+                         : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_CQ_RING);
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQES);
+    if (cq_ptr == MAP_FAILED || sqes_ptr == MAP_FAILED) {
+        if (cq_ptr == MAP_FAILED)
+            cq_ptr = nullptr;
+        if (sqes_ptr == MAP_FAILED)
+            sqes_ptr = nullptr;
+        ring_fd = rfd;
+        ring_teardown();
+        return false;
+    }
+
+    char* sq = static_cast<char*>(sq_ptr);
+    char* cq = static_cast<char*>(cq_ptr);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+
+    ring_fd = rfd;
+    slots.resize(depth);
+    for (size_t i = depth; i > 0; --i)
+        free_slots.push_back(i - 1);
+    return true;
+}
+
+void DiskWriter::ring_teardown() {
+    if (sqes_ptr)
+        munmap(sqes_ptr, sqes_size);
+    if (cq_ptr && cq_ptr != sq_ptr)
+        munmap(cq_ptr, cq_size);
+    if (sq_ptr)
+        munmap(sq_ptr, sq_size);
+    sqes_ptr = cq_ptr = sq_ptr = nullptr;
+    if (ring_fd != -1)
+        close(ring_fd);
+    ring_fd = -1;
+}
+
+// Queue the rest of a slot's write, plus a linked fdatasync under Sync::Always
+bool DiskWriter::ring_push(size_t slot) {
+    const Pending& pending = slots[slot];
+    struct io_uring_sqe* sqes = static_cast<struct io_uring_sqe*>(sqes_ptr);
+    unsigned tail = *sq_tail;
+    unsigned count = 0;
+
+    unsigned index = (tail + count) & *sq_mask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)(pending.buffer.data() + pending.done);
+    sqe->len = (uint32_t)(pending.len - pending.done);
+    sqe->off = pending.offset + pending.done;
+    sqe->user_data = slot;
+    sq_array[index] = index;
+    ++count;
+
+    if (options.sync == Sync::Always) {
+        sqe->flags |= IOSQE_IO_LINK;
+        index = (tail + count) & *sq_mask;
+        sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = fd;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->user_data = SYNC_TAG;
+        sq_array[index] = index;
+        ++count;
+        ++in_flight;
+    }
+
+    __atomic_store_n(sq_tail, tail + count, __ATOMIC_RELEASE);
+    while (true) {
+        int r = io_uring_enter(ring_fd, count, 0, 0);
+        if (r >= 0)
+            return true;
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            LOG_ERRNO("io_uring_enter failed");
+            return false;
+        }
+        if (errno != EINTR)
+            ring_reap(true);   // completion queue full: make room first
+    }
+}
+
+bool DiskWriter::ring_reap(bool wait) {
+    unsigned head = *cq_head;
+    if (wait && head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        while (io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) == -1) {
+            if (errno != EINTR) {
+                LOG_ERRNO("io_uring_enter wait failed");
+                return false;
+            }
+        }
+    }
+
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe* completions = static_cast<struct io_uring_cqe*>(cqes);
+    std::vector<size_t> resubmit;
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe& cqe = completions[head & *cq_mask];
+        --in_flight;
+
+        if (cqe.user_data == SYNC_TAG) {
+            // Cancelled when its write came up short; that write is requeued with a new one
+            if (cqe.res < 0 && cqe.res != -ECANCELED) {
+                errno = -cqe.res;
+                LOG_ERRNO("fdatasync failed");
+                failed = true;
+            }
+            continue;
+        }
+
+        size_t slot = (size_t)cqe.user_data;
+        Pending& pending = slots[slot];
+        if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+            resubmit.push_back(slot);
+            continue;
+        }
+        if (cqe.res <= 0) {
+            errno = cqe.res < 0 ? -cqe.res : EIO;
+            LOG_ERRNO("write failed");
+            failed = true;
+        } else {
+            pending.done += (size_t)cqe.res;
+            if (pending.done < pending.len) {
+                resubmit.push_back(slot);
+                continue;
+            }
+        }
+        spare.push_back(std::move(pending.buffer));
+        free_slots.push_back(slot);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+    for (size_t slot : resubmit) {
+        ++in_flight;
+        if (failed || !ring_push(slot)) {
+            --in_flight;
+            failed = true;
+            spare.push_back(std::move(slots[slot].buffer));
+            free_slots.push_back(slot);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "BufferPool.h"
+
+// Write-behind for received file data. The receiving thread fills pooled
+// buffers and hands them over with submit(); earlier buffers are written
+// while it goes back to the socket, so network and disk time overlap instead
+// of adding up. Writes go through io_uring when the kernel allows it and
+// through a writer thread with pwrite otherwise.
+class DiskWriter {
+public:
+    enum class Sync { None, End, Always };   // fdatasync: never, once in finish(), after every write
+
+    struct Options {
+        unsigned queue_depth = 4;       // buffers written or waiting to be written at once
+        bool direct = false;            // O_DIRECT for aligned chunks; the unaligned tail is buffered
+        bool preallocate = true;        // fallocate the expected range up front
+        Sync sync = Sync::None;
+        bool io_uring = true;           // false forces the writer thread
+    };
+
+    // FILESERVER_WRITE_DEPTH, FILESERVER_O_DIRECT, FILESERVER_FALLOCATE,
+    // FILESERVER_FSYNC (none|end|always) and FILESERVER_IO_URING override the defaults
+    static Options options_from_env();
+    static void set_defaults(const Options& options);
+
+    // Writes to fd, expecting roughly [offset, offset + length)
+    DiskWriter(int fd, uint64_t offset, uint64_t length);
+    DiskWriter(int fd, uint64_t offset, uint64_t length, const Options& options);
+    ~DiskWriter();
+
+    DiskWriter(const DiskWriter&) = delete;
+    DiskWriter& operator=(const DiskWriter&) = delete;
+
+    // A buffer to fill; blocks while queue_depth writes are outstanding.
+    // Empty once a write has failed.
+    BufferPool::Lease acquire();
+
+    // Queue len bytes of buffer for writing at offset
+    void submit(BufferPool::Lease buffer, size_t len, uint64_t offset);
+
+    // Wait for every write and apply the sync policy. False if anything failed.
+    bool finish();
+
+    bool using_io_uring() const { return ring_fd != -1; }
+
+private:
+    struct Pending {
+        BufferPool::Lease buffer;
+        size_t len = 0;
+        size_t done = 0;
+        uint64_t offset = 0;
+    };
+
+    // io_uring backend; the ring is driven from the submitting thread
+    bool ring_setup(unsigned entries);
+    void ring_teardown();
+    bool ring_push(size_t slot);
+    bool ring_reap(bool wait);
+
+    // Writer-thread backend
+    void writer_loop();
+
+    bool write_now(const char* data, size_t len, uint64_t offset);   // synchronous pwrite
+    bool drain();
+    bool aligned(size_t len, uint64_t offset) const;
+    void leave_direct_mode();
+
+    int fd;
+    Options options;
+    bool failed = false;
+    bool direct_mode = false;
+    std::vector<BufferPool::Lease> spare;
+
+    // io_uring state
+    int ring_fd = -1;
+    void* sq_ptr = nullptr;
+    size_t sq_size = 0;
+    void* cq_ptr = nullptr;
+    size_t cq_size = 0;
+    void* sqes_ptr = nullptr;
+    size_t sqes_size = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    void* cqes = nullptr;
+    std::vector<Pending> slots;           // indexed by user_data
+    std::vector<size_t> free_slots;
+    size_t in_flight = 0;                 // requests submitted to the ring, not yet completed
+
+    // Writer-thread state
+    std::thread writer;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Pending> queue;            // waiting for the writer
+    std::vector<BufferPool::Lease> written;   // returned by the writer
+    size_t outstanding = 0;               // queued plus being written
+    bool stopping = false;
+};
@@ -0,0 +1,353 @@
+#include "Log.h"
+
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+int Log::min_level = FILESERVER_LOG_LEVEL;
+
+namespace {
+    constexpr size_t RING_RECORDS = 512;            // per thread, 256 KiB
+    constexpr auto IDLE_WAIT = std::chrono::milliseconds(10);
+
+    const char* const LEVEL_NAMES[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+    // Single producer (the owning thread), single consumer (the flusher)
+    struct Ring {
+        alignas(64) std::atomic<uint64_t> tail{0};  // next slot the producer fills
+        alignas(64) std::atomic<uint64_t> head{0};  // next slot the flusher reads
+        std::atomic<uint64_t> dropped{0};
+        uint32_t thread = 0;
+        Log::Record records[RING_RECORDS];
+    };
+
+    struct Registry {
+        std::mutex mtx;
+        std::vector<Ring*> rings;                   // never freed
+        std::vector<Ring*> idle;                    // left behind by exited threads
+        std::thread flusher;
+        bool started = false;
+        bool synchronous = false;
+        std::mutex write_mtx;                       // whole lines in synchronous mode
+
+        std::mutex flush_mtx;
+        std::condition_variable flush_cv;
+        uint64_t passes = 0;                        // completed flusher passes
+    };
+
+    // Deliberately leaked: threads may still log during static destruction
+    Registry& registry() {
+        static Registry* r = new Registry;
+        return *r;
+    }
+
+    void flusher_loop();
+
+    void drain_at_exit() {
+        Log::flush();
+    }
+
+    void start_flusher(Registry& r) {
+        // Caller holds r.mtx
+        if (r.started)
+            return;
+        r.started = true;
+        r.flusher = std::thread(flusher_loop);
+        r.flusher.detach();
+        atexit(drain_at_exit);
+    }
+
+    struct RingHandle {
+        Ring* ring = nullptr;
+        ~RingHandle() {
+            if (!ring)
+                return;
+            Registry& r = registry();
+            std::lock_guard<std::mutex> lock(r.mtx);
+            r.idle.push_back(ring);
+        }
+    };
+
+    Ring& local_ring() {
+        thread_local RingHandle handle;
+        if (!handle.ring) {
+            Registry& r = registry();
+            std::lock_guard<std::mutex> lock(r.mtx);
+            if (!r.idle.empty()) {
+                handle.ring = r.idle.back();
+                r.idle.pop_back();
+            } else {
+                handle.ring = new Ring();
+                r.rings.push_back(handle.ring);
+            }
+            handle.ring->thread = (uint32_t)syscall(SYS_gettid);
+            start_flusher(r);
+        }
+        return *handle.ring;
+    }
+
+    thread_local Log::Record sync_record;          // synchronous mode formats from here
+
+    uint64_t now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    }
+
+    void format_arg(std::string& out, const Log::Record& record, const Log::Arg& arg) {
+        char buf[64];
+        switch (arg.type) {
+            case Log::Arg::Type::Signed:
+                snprintf(buf, sizeof(buf), "%lld", (long long)arg.i);
+                out += buf;
+                break;
+            case Log::Arg::Type::Unsigned:
+                snprintf(buf, sizeof(buf), "%llu", (unsigned long long)arg.u);
+                out += buf;
+                break;
+            case Log::Arg::Type::Double:
+                snprintf(buf, sizeof(buf), "%g", arg.d);
+                out += buf;
+                break;
+            case Log::Arg::Type::Hex:
+                snprintf(buf, sizeof(buf), "%llx", (unsigned long long)arg.u);
+                out += buf;
+                break;
+            case Log::Arg::Type::Text:
+                out.append(record.text + arg.offset, arg.len);
+                break;
+            case Log::Arg::Type::Errno: {
+                char err[128];
+                out += strerror_r((int)arg.i, err, sizeof(err));
+                break;
+            }
+        }
+    }
+
+    // "2026-01-02 03:04:05.678901 INFO  [tid] message\n"
+    void format_record(std::string& out, const Log::Record& record) {
+        time_t seconds = (time_t)(record.time_ns / 1000000000ull);
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        char prefix[64];
+        size_t n = strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &tm);
+        snprintf(prefix + n, sizeof(prefix) - n, ".%06u %s [%u] ",
+                 (unsigned)(record.time_ns % 1000000000ull / 1000), LEVEL_NAMES[(int)record.level], record.thread);
+        out += prefix;
+
+        size_t next = 0;
+        for (const char* p = record.format; *p; ++p) {
+            if (p[0] == '{' && p[1] == '}') {
+                if (next < record.nargs)
+                    format_arg(out, record, record.args[next++]);
+                ++p;
+            } else {
+                out += *p;
+            }
+        }
+        out += '\n';
+    }
+
+    void write_fd(int fd, const std::string& data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return;
+            done += (size_t)n;
+        }
+    }
+
+    struct Pending {
+        uint64_t time_ns;
+        bool error;
+        std::string line;
+    };
+
+    // One pass over every ring; lines from all threads go out in time order.
+    // Warnings and errors go to stderr, the rest to stdout.
+    bool drain_once() {
+        Registry& r = registry();
+        std::vector<Ring*> rings;
+        {
+            std::lock_guard<std::mutex> lock(r.mtx);
+            rings = r.rings;
+        }
+
+        std::vector<Pending> pending;
+        uint64_t dropped = 0;
+        for (Ring* ring : rings) {
+            uint64_t head = ring->head.load(std::memory_order_relaxed);
+            uint64_t tail = ring->tail.load(std::memory_order_acquire);
+            for (; head != tail; ++head) {
+                const Log::Record& record = ring->records[head % RING_RECORDS];
+                Pending p{record.time_ns, record.level >= Log::Level::Warn, std::string()};
+                format_record(p.line, record);
+                pending.push_back(std::move(p));
+            }
+            ring->head.store(head, std::memory_order_release);
+            dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+        }
+        if (pending.empty() && dropped == 0)
+            return false;
+
+        std::stable_sort(pending.begin(), pending.end(),
+                         [](const Pending& a, const Pending& b) { return a.time_ns < b.time_ns; });
+        std::string out, err;
+        for (const Pending& p : pending)
+            (p.error ? err : out) += p.line;
+        if (dropped > 0)
+            err += "log: " + std::to_string(dropped) + " records dropped, ring full\n";
+        if (!out.empty())
+            write_fd(STDOUT_FILENO, out);
+        if (!err.empty())
+            write_fd(STDERR_FILENO, err);
+        return true;
+    }
+
+    void flusher_loop() {
+        Registry& r = registry();
+        while (true) {
+            bool busy = drain_once();
+            {
+                std::lock_guard<std::mutex> lock(r.flush_mtx);
+                ++r.passes;
+            }
+            r.flush_cv.notify_all();
+            if (!busy)
+                std::this_thread::sleep_for(IDLE_WAIT);
+        }
+    }
+}
+
+Log::Record* Log::begin(Level level, const char* format) {
+    Record* record;
+    if (registry().synchronous) {
+        record = &sync_record;
+        record->thread = (uint32_t)syscall(SYS_gettid);
+    } else {
+        Ring& ring = local_ring();
+        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        if (tail - ring.head.load(std::memory_order_acquire) == RING_RECORDS) {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        record = &ring.records[tail % RING_RECORDS];
+        record->thread = ring.thread;
+    }
+    record->time_ns = now_ns();
+    record->format = format;
+    record->level = level;
+    record->nargs = 0;
+    record->text_used = 0;
+    return record;
+}
+
+void Log::commit(Record* record) {
+    Registry& r = registry();
+    if (record == &sync_record) {
+        std::string line;
+        format_record(line, *record);
+        std::lock_guard<std::mutex> lock(r.write_mtx);
+        write_fd(record->level >= Level::Warn ? STDERR_FILENO : STDOUT_FILENO, line);
+        return;
+    }
+    Ring& ring = local_ring();
+    ring.tail.store(ring.tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void Log::put_signed(Record& record, int64_t value) {
+    if (record.nargs == MAX_ARGS)
+        return;
+    Arg& arg = record.args[record.nargs++];
+    arg.type = Arg::Type::Signed;
+    arg.i = value;
+}
+
+void Log::put_unsigned(Record& record, uint64_t value) {
+    if (record.nargs == MAX_ARGS)
+        return;
+    Arg& arg = record.args[record.nargs++];
+    arg.type = Arg::Type::Unsigned;
+    arg.u = value;
+}
+
+void Log::put(Record& record, double value) {
+    if (record.nargs == MAX_ARGS)
+        return;
+    Arg& arg = record.args[record.nargs++];
+    arg.type = Arg::Type::Double;
+    arg.d = value;
+}
+
+void Log::put(Record& record, Errno value) {
+    if (record.nargs == MAX_ARGS)
+        return;
+    Arg& arg = record.args[record.nargs++];
+    arg.type = Arg::Type::Errno;
+    arg.i = value.code;
+}
+
+void Log::put(Record& record, Hex value) {
+    if (record.nargs == MAX_ARGS)
+        return;
+    Arg& arg = record.args[record.nargs++];
+    arg.type = Arg::Type::Hex;
+    arg.u = value.value;
+}
+
+// Strings are truncated to what is left of the record's text area
+void Log::put_text(Record& record, std::string_view text) {
+    if (record.nargs == MAX_ARGS)
+        return;
+    size_t len = std::min(text.size(), TEXT_BYTES - record.text_used);
+    memcpy(record.text + record.text_used, text.data(), len);
+    Arg& arg = record.args[record.nargs++];
+    arg.type = Arg::Type::Text;
+    arg.offset = record.text_used;
+    arg.len = (uint16_t)len;
+    record.text_used = (uint16_t)(record.text_used + len);
+}
+
+void Log::set_synchronous(bool synchronous) {
+    flush();
+    registry().synchronous = synchronous;
+}
+
+void Log::flush() {
+    Registry& r = registry();
+    {
+        std::lock_guard<std::mutex> lock(r.mtx);
+        if (!r.started)
+            return;
+    }
+    // Two full passes after this point: the first may have started before
+    // the caller's last record was committed
+    std::unique_lock<std::mutex> lock(r.flush_mtx);
+    uint64_t target = r.passes + 2;
+    r.flush_cv.wait_for(lock, std::chrono::seconds(2), [&] { return r.passes >= target; });
+}
+
+Log::Level Log::level_from_env() {
+    const char* value = std::getenv("FILESERVER_LOG_LEVEL");
+    if (!value)
+        return (Level)std::max(FILESERVER_LOG_LEVEL, 0);
+    if (strcasecmp(value, "debug") == 0) return Level::Debug;
+    if (strcasecmp(value, "info") == 0)  return Level::Info;
+    if (strcasecmp(value, "warn") == 0)  return Level::Warn;
+    if (strcasecmp(value, "error") == 0) return Level::Error;
+    return (Level)std::max(FILESERVER_LOG_LEVEL, 0);
+}
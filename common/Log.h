@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Levels below FILESERVER_LOG_LEVEL are compiled out (0 debug, 1 info,
+// 2 warn, 3 error); FILESERVER_LOG_LEVEL in the environment raises the
+// threshold further at run time.
+#ifndef FILESERVER_LOG_LEVEL
+#define FILESERVER_LOG_LEVEL 1
+#endif
+
+#define LOG_AT(level, ...)                                                  \
+    do {                                                                    \
+        if constexpr ((int)(level) >= FILESERVER_LOG_LEVEL)                 \
+            ::Log::write((level), __VA_ARGS__);                             \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(::Log::Level::Debug, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(::Log::Level::Info, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(::Log::Level::Warn, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(::Log::Level::Error, __VA_ARGS__)
+// perror() replacement: "<what>: <strerror(errno)>"
+#define LOG_ERRNO(what) LOG_ERROR(what ": {}", ::Log::Errno{errno})
+
+// Asynchronous logger. A log call copies its format string pointer and
+// arguments into a fixed-size binary record in the calling thread's
+// single-producer ring (no locks, no formatting, no syscalls); a background
+// thread formats the records and writes them out in batches. A full ring
+// drops the record and counts it rather than stall the caller.
+//
+// The format must be a string literal; each {} takes the next argument.
+class Log {
+public:
+    enum class Level : uint8_t { Debug = 0, Info, Warn, Error };
+
+    struct Errno { int code; };                // formatted with strerror
+    struct Hex { uint64_t value; };
+
+    static constexpr size_t MAX_ARGS = 8;
+    static constexpr size_t TEXT_BYTES = 352;   // inline copies of string arguments
+
+    struct Arg {
+        enum class Type : uint8_t { Signed, Unsigned, Double, Text, Errno, Hex };
+        Type type;
+        uint16_t len;                           // Text: bytes at text + offset
+        union {
+            int64_t i;
+            uint64_t u;
+            double d;
+            uint16_t offset;
+        };
+    };
+
+    struct Record {
+        uint64_t time_ns;
+        const char* format;
+        uint32_t thread;
+        Level level;
+        uint8_t nargs;
+        uint16_t text_used;
+        Arg args[MAX_ARGS];
+        char text[TEXT_BYTES];
+    };
+
+    template <typename... Args>
+    static void write(Level level, const char* format, const Args&... args) {
+        static_assert(sizeof...(Args) <= MAX_ARGS, "too many log arguments");
+        if ((int)level < min_level)
+            return;
+        Record* record = begin(level, format);
+        if (!record)
+            return;
+        (put(*record, args), ...);
+        commit(record);
+    }
+
+    // Format and write on the calling thread instead; for interactive tools
+    // whose log lines must interleave with their own output
+    static void set_synchronous(bool synchronous);
+
+    // Block until everything logged before the call has been written
+    static void flush();
+
+    static Level level_from_env();
+    static void set_level(Level level) { min_level = (int)level; }
+
+private:
+    static Record* begin(Level level, const char* format);
+    static void commit(Record* record);
+
+    static void put_signed(Record& record, int64_t value);
+    static void put_unsigned(Record& record, uint64_t value);
+    static void put_text(Record& record, std::string_view text);
+    static void put(Record& record, double value);
+    static void put(Record& record, Errno value);
+    static void put(Record& record, Hex value);
+    static void put(Record& record, const std::string& value) { put_text(record, value); }
+    static void put(Record& record, std::string_view value) { put_text(record, value); }
+    static void put(Record& record, const char* value) { put_text(record, value ? value : "(null)"); }
+    static void put(Record& record, char value) { put_text(record, std::string_view(&value, 1)); }
+    static void put(Record& record, bool value) { put_text(record, value ? "true" : "false"); }
+
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>>>
+    static void put(Record& record, T value) {
+        if constexpr (std::is_enum_v<T>)
+            put_signed(record, (int64_t)value);
+        else if constexpr (std::is_signed_v<T>)
+            put_signed(record, (int64_t)value);
+        else
+            put_unsigned(record, (uint64_t)value);
+    }
+
+    static int min_level;
+};
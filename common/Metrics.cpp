@@ -0,0 +1,325 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace {
+    constexpr size_t SUB_BITS = 3;
+    constexpr size_t SUB = size_t(1) << SUB_BITS;
+    constexpr size_t COUNTERS = (size_t)Metrics::Counter::COUNT;
+    constexpr size_t GAUGES = (size_t)Metrics::Gauge::COUNT;
+    constexpr size_t TIMERS = (size_t)Metrics::Timer::COUNT;
+
+    // Only the owning thread writes, so a plain load and store is enough
+    inline void bump(std::atomic<uint64_t>& value, uint64_t n) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    struct Histogram {
+        std::atomic<uint64_t> buckets[Metrics::BUCKETS];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum_us;
+
+        void record(uint64_t us) {
+            bump(buckets[Metrics::bucket_of(us)], 1);
+            bump(count, 1);
+            bump(sum_us, us);
+        }
+
+        void merge_into(Metrics::Snapshot& snapshot) const {
+            for (size_t i = 0; i < Metrics::BUCKETS; ++i)
+                snapshot.buckets[i] += buckets[i].load(std::memory_order_relaxed);
+            snapshot.count += count.load(std::memory_order_relaxed);
+            snapshot.sum_us += sum_us.load(std::memory_order_relaxed);
+        }
+    };
+
+    struct Shard {
+        std::atomic<uint64_t> counters[COUNTERS];
+        Histogram timers[TIMERS];
+        Histogram commands[Metrics::MAX_COMMANDS];
+    };
+
+    struct Registry {
+        std::mutex mtx;
+        std::vector<Shard*> shards;          // every shard ever created; never freed
+        std::vector<Shard*> idle;            // left behind by exited threads
+        std::atomic<int64_t> gauges[GAUGES] = {};
+
+        std::string names[Metrics::MAX_COMMANDS];
+        std::atomic<size_t> command_count{1};   // 0 is "other"
+
+        Registry() { names[0] = "other"; }
+    };
+
+    // Deliberately leaked: threads may still record during static destruction
+    Registry& registry() {
+        static Registry* r = new Registry;
+        return *r;
+    }
+
+    struct ShardHandle {
+        Shard* shard = nullptr;
+        ~ShardHandle() {
+            if (!shard)
+                return;
+            Registry& r = registry();
+            std::lock_guard<std::mutex> lock(r.mtx);
+            r.idle.push_back(shard);
+        }
+    };
+
+    Shard& local() {
+        thread_local ShardHandle handle;
+        if (!handle.shard) {
+            Registry& r = registry();
+            std::lock_guard<std::mutex> lock(r.mtx);
+            if (!r.idle.empty()) {
+                handle.shard = r.idle.back();
+                r.idle.pop_back();
+            } else {
+                handle.shard = new Shard();
+                r.shards.push_back(handle.shard);
+            }
+        }
+        return *handle.shard;
+    }
+
+    template <typename F>
+    void each_shard(F&& fn) {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mtx);
+        for (const Shard* shard : r.shards)
+            fn(*shard);
+    }
+
+    Metrics::Snapshot merged_command(size_t id) {
+        Metrics::Snapshot snapshot = {};
+        each_shard([&](const Shard& shard) { shard.commands[id].merge_into(snapshot); });
+        return snapshot;
+    }
+
+    // Prometheus bucket bounds, in microseconds and as printed
+    struct Bound {
+        uint64_t us;
+        const char* le;
+    };
+    const Bound BOUNDS[] = {
+        {50, "5e-05"}, {100, "0.0001"}, {250, "0.00025"}, {500, "0.0005"},
+        {1000, "0.001"}, {2500, "0.0025"}, {5000, "0.005"}, {10000, "0.01"},
+        {25000, "0.025"}, {50000, "0.05"}, {100000, "0.1"}, {250000, "0.25"},
+        {500000, "0.5"}, {1000000, "1"}, {2500000, "2.5"}, {5000000, "5"},
+        {10000000, "10"}, {30000000, "30"}, {60000000, "60"},
+    };
+
+    struct CounterInfo {
+        const char* name;
+        const char* help;
+    };
+    const CounterInfo COUNTER_INFO[COUNTERS] = {
+        {"fileserver_bytes_received_total", "Bytes read from client connections."},
+        {"fileserver_bytes_sent_total", "Bytes written to client connections."},
+        {"fileserver_connections_accepted_total", "Client connections accepted."},
+        {"fileserver_command_errors_total", "Commands whose handler ended the session."},
+        {"fileserver_threadpool_steals_total", "Tasks an idle worker thread stole from another worker's queue."},
+        {"fileserver_password_hash_rejected_total", "Password hashes refused because every hashing slot was taken."},
+        {"fileserver_password_hash_expired_total", "Password hashes dropped after waiting too long in the queue."},
+    };
+    const CounterInfo GAUGE_INFO[GAUGES] = {
+        {"fileserver_active_connections", "Open client sessions."},
+        {"fileserver_threadpool_queue_depth", "Tasks waiting for a worker thread."},
+    };
+    const CounterInfo TIMER_INFO[TIMERS] = {
+        {"fileserver_tls_handshake_seconds", "Time from accept to a completed TLS handshake."},
+        {"fileserver_auth_lookup_seconds", "Time to resolve a session token to a user."},
+        {"fileserver_password_hash_seconds", "Time to run one password hash or verification."},
+        {"fileserver_password_hash_wait_seconds", "Time a password hash waited for a hashing thread."},
+    };
+
+    void append(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void append(std::string& out, const char* format, ...) {
+        char line[512];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        if (n > 0)
+            out.append(line, std::min<size_t>((size_t)n, sizeof(line) - 1));
+    }
+
+    // Buckets are rounded up to the histogram's precision: an observation
+    // counts under the first bound at or above its bucket's upper edge
+    void histogram_lines(std::string& out, const char* name, const std::string& labels,
+                         const Metrics::Snapshot& snapshot) {
+        std::string sep = labels.empty() ? "" : ",";
+        size_t fine = 0;
+        uint64_t cumulative = 0;
+        for (const Bound& bound : BOUNDS) {
+            while (fine < Metrics::BUCKETS && Metrics::bucket_upper(fine) <= bound.us)
+                cumulative += snapshot.buckets[fine++];
+            append(out, "%s_bucket{%s%sle=\"%s\"} %llu\n", name, labels.c_str(), sep.c_str(), bound.le,
+                   (unsigned long long)cumulative);
+        }
+        append(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels.c_str(), sep.c_str(),
+               (unsigned long long)snapshot.count);
+        std::string braces = labels.empty() ? "" : "{" + labels + "}";
+        append(out, "%s_sum%s %.6f\n", name, braces.c_str(), (double)snapshot.sum_us / 1e6);
+        append(out, "%s_count%s %llu\n", name, braces.c_str(), (unsigned long long)snapshot.count);
+    }
+
+    void summary_line(std::string& out, const std::string& name, const Metrics::Snapshot& snapshot) {
+        append(out, "%-16s count=%llu avg=%lluus p50=%lluus p99=%lluus p999=%lluus\n", name.c_str(),
+               (unsigned long long)snapshot.count,
+               (unsigned long long)(snapshot.count ? snapshot.sum_us / snapshot.count : 0),
+               (unsigned long long)snapshot.percentile(0.5),
+               (unsigned long long)snapshot.percentile(0.99),
+               (unsigned long long)snapshot.percentile(0.999));
+    }
+}
+
+size_t Metrics::bucket_of(uint64_t us) {
+    if (us < SUB)
+        return (size_t)us;
+    size_t msb = 63 - (size_t)__builtin_clzll(us);
+    size_t shift = msb - SUB_BITS;
+    size_t index = (shift + 1) * SUB + (size_t)((us >> shift) & (SUB - 1));
+    return std::min(index, BUCKETS - 1);
+}
+
+uint64_t Metrics::bucket_upper(size_t index) {
+    if (index < SUB)
+        return index;
+    size_t shift = index / SUB - 1;
+    uint64_t lower = (uint64_t)(SUB + index % SUB) << shift;
+    return lower + (uint64_t(1) << shift) - 1;
+}
+
+uint64_t Metrics::Snapshot::percentile(double q) const {
+    if (count == 0)
+        return 0;
+    uint64_t target = std::max<uint64_t>(1, (uint64_t)std::ceil(q * (double)count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= target)
+            return bucket_upper(i);
+    }
+    return bucket_upper(BUCKETS - 1);
+}
+
+void Metrics::add(Counter counter, uint64_t n) {
+    bump(local().counters[(size_t)counter], n);
+}
+
+void Metrics::set(Gauge gauge, int64_t value) {
+    registry().gauges[(size_t)gauge].store(value, std::memory_order_relaxed);
+}
+
+void Metrics::observe(Timer timer, uint64_t us) {
+    local().timers[(size_t)timer].record(us);
+}
+
+int Metrics::register_command(const std::string& name) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mtx);
+    size_t count = r.command_count.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+        if (r.names[i] == name)
+            return (int)i;
+    }
+    if (count == MAX_COMMANDS)
+        return 0;
+    r.names[count] = name;
+    r.command_count.store(count + 1, std::memory_order_release);
+    return (int)count;
+}
+
+int Metrics::command_id(const char* name) {
+    Registry& r = registry();
+    size_t count = r.command_count.load(std::memory_order_acquire);
+    for (size_t i = 1; i < count; ++i) {
+        if (r.names[i] == name)
+            return (int)i;
+    }
+    return 0;
+}
+
+void Metrics::observe_command(int id, uint64_t us) {
+    if (id < 0 || (size_t)id >= MAX_COMMANDS)
+        id = 0;
+    local().commands[id].record(us);
+}
+
+uint64_t Metrics::now_us() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t Metrics::counter(Counter counter) {
+    uint64_t total = 0;
+    each_shard([&](const Shard& shard) { total += shard.counters[(size_t)counter].load(std::memory_order_relaxed); });
+    return total;
+}
+
+Metrics::Snapshot Metrics::timer(Timer timer) {
+    Snapshot snapshot = {};
+    each_shard([&](const Shard& shard) { shard.timers[(size_t)timer].merge_into(snapshot); });
+    return snapshot;
+}
+
+std::string Metrics::prometheus() {
+    std::string out;
+    for (size_t i = 0; i < COUNTERS; ++i) {
+        append(out, "# HELP %s %s\n# TYPE %s counter\n", COUNTER_INFO[i].name, COUNTER_INFO[i].help, COUNTER_INFO[i].name);
+        append(out, "%s %llu\n", COUNTER_INFO[i].name, (unsigned long long)counter((Counter)i));
+    }
+    for (size_t i = 0; i < GAUGES; ++i) {
+        append(out, "# HELP %s %s\n# TYPE %s gauge\n", GAUGE_INFO[i].name, GAUGE_INFO[i].help, GAUGE_INFO[i].name);
+        append(out, "%s %lld\n", GAUGE_INFO[i].name, (long long)registry().gauges[i].load(std::memory_order_relaxed));
+    }
+    for (size_t i = 0; i < TIMERS; ++i) {
+        append(out, "# HELP %s %s\n# TYPE %s histogram\n", TIMER_INFO[i].name, TIMER_INFO[i].help, TIMER_INFO[i].name);
+        histogram_lines(out, TIMER_INFO[i].name, "", timer((Timer)i));
+    }
+
+    const char* name = "fileserver_command_duration_seconds";
+    append(out, "# HELP %s Time spent handling each command.\n# TYPE %s histogram\n", name, name);
+    size_t count = registry().command_count.load(std::memory_order_acquire);
+    for (size_t id = 0; id < count; ++id) {
+        Snapshot snapshot = merged_command(id);
+        if (snapshot.count > 0)
+            histogram_lines(out, name, "command=\"" + registry().names[id] + "\"", snapshot);
+    }
+    return out;
+}
+
+std::string Metrics::summary() {
+    std::string out;
+    append(out, "bytes in %llu, out %llu; %llu connections accepted, %lld active; %llu command errors; pool queue %lld, %llu steals\n",
+           (unsigned long long)counter(Counter::BytesIn), (unsigned long long)counter(Counter::BytesOut),
+           (unsigned long long)counter(Counter::ConnectionsAccepted),
+           (long long)registry().gauges[(size_t)Gauge::ActiveConnections].load(std::memory_order_relaxed),
+           (unsigned long long)counter(Counter::CommandErrors),
+           (long long)registry().gauges[(size_t)Gauge::PoolQueueDepth].load(std::memory_order_relaxed),
+           (unsigned long long)counter(Counter::PoolSteals));
+    summary_line(out, "tls handshake", timer(Timer::TlsHandshake));
+    summary_line(out, "auth lookup", timer(Timer::AuthLookup));
+    append(out, "password hashes: %llu rejected, %llu expired\n",
+           (unsigned long long)counter(Counter::HashRejected), (unsigned long long)counter(Counter::HashExpired));
+    summary_line(out, "password hash", timer(Timer::PasswordHash));
+    summary_line(out, "hash queue wait", timer(Timer::HashQueueWait));
+    size_t count = registry().command_count.load(std::memory_order_acquire);
+    for (size_t id = 0; id < count; ++id) {
+        Snapshot snapshot = merged_command(id);
+        if (snapshot.count > 0)
+            summary_line(out, registry().names[id], snapshot);
+    }
+    return out;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Process-wide counters, gauges and latency histograms. Every thread that
+// records gets its own shard, written only by that thread with relaxed
+// loads and stores (no locked instructions); readers add the shards up. A
+// shard outlives its thread and is handed to the next new thread, so totals
+// never go backwards.
+//
+// Histograms are log-linear in microseconds (HDR style): values below 8 are
+// exact, above that each power of two is split into 8 buckets, so any
+// reported latency is within 12.5% of the real one.
+class Metrics {
+public:
+    enum class Counter : uint8_t {
+        BytesIn,                // read from client connections
+        BytesOut,
+        ConnectionsAccepted,
+        CommandErrors,          // handlers that ended their session
+        PoolSteals,             // tasks an idle worker took from another's deque
+        HashRejected,           // logins and sign-ups refused with "Server busy"
+        HashExpired,            // hashes skipped after waiting too long in the queue
+        COUNT
+    };
+
+    enum class Gauge : uint8_t {
+        ActiveConnections,
+        PoolQueueDepth,         // tasks waiting for a worker
+        COUNT
+    };
+
+    enum class Timer : uint8_t {
+        TlsHandshake,           // accept to handshake done
+        AuthLookup,             // token -> user resolution
+        PasswordHash,           // one Argon2 hash or verification
+        HashQueueWait,          // queued before a hashing thread took it
+        COUNT
+    };
+
+    static constexpr size_t MAX_COMMANDS = 32;
+    static constexpr size_t BUCKETS = 296;           // up to 2^39 us, about six days
+
+    // Merged view of one histogram
+    struct Snapshot {
+        uint64_t buckets[BUCKETS];
+        uint64_t count;
+        uint64_t sum_us;
+
+        uint64_t percentile(double q) const;         // upper bound of the bucket holding q
+    };
+
+    static void add(Counter counter, uint64_t n = 1);
+    static void set(Gauge gauge, int64_t value);
+    static void observe(Timer timer, uint64_t us);
+
+    // Commands are registered once at startup; unknown names record as "other"
+    static int register_command(const std::string& name);
+    static int command_id(const char* name);
+    static void observe_command(int id, uint64_t us);
+
+    static uint64_t now_us();                        // steady clock
+
+    static uint64_t counter(Counter counter);
+    static Snapshot timer(Timer timer);
+
+    // Prometheus text exposition format (version 0.0.4)
+    static std::string prometheus();
+    // One line per metric with p50/p99/p999, for the mtrc command
+    static std::string summary();
+
+    static size_t bucket_of(uint64_t us);
+    static uint64_t bucket_upper(size_t index);
+};
@@ -1,40 +1,73 @@
 #include "Network.h"
+#include "BufferPool.h"
+#include "ReadAhead.h"
+#include "Metrics.h"
+#include "Log.h"
 
 #include <arpa/inet.h>
 #include <cstring>
-#include <iostream>
 #include <vector>
 #include <climits>
 #include <cstdint>
+#include <cerrno>
+#include <algorithm>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
-#include <unordered_map>
-#include <mutex>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
 
 namespace {
     SSL_CTX* g_server_ctx = nullptr;
     SSL_CTX* g_client_ctx = nullptr;
-    std::unordered_map<int, SSL*> g_fd_ssl;
-    std::mutex g_ssl_mutex;  // Thread safety for g_fd_ssl
-
-    bool is_tls(int fd) { 
-        std::lock_guard<std::mutex> lock(g_ssl_mutex);
-        return g_fd_ssl.find(fd) != g_fd_ssl.end(); 
-    }
 
     void log_errors(const char* tag) {
         unsigned long e;
         while ((e = ERR_get_error()) != 0) {
             char buf[256];
             ERR_error_string_n(e, buf, sizeof(buf));
-            std::cerr << tag << ": " << buf << "\n";
+            LOG_ERROR("{}: {}", tag, buf);
+        }
+    }
+
+    // Sockets may be non-blocking (server sessions handed over by the reactor);
+    // a would-block result waits for readiness instead of failing the transfer.
+    constexpr int IO_TIMEOUT_MS = 60 * 1000;
+
+    bool wait_io(int fd, short events) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = events;
+        pfd.revents = 0;
+        int r;
+        do {
+            r = poll(&pfd, 1, IO_TIMEOUT_MS);
+        } while (r == -1 && errno == EINTR);
+        return r > 0;
+    }
+
+    // Returns true if the failed SSL call can be retried once the socket is ready
+    bool ssl_wait(SSL* ssl, int r) {
+        int err = SSL_get_error(ssl, r);
+        if (err == SSL_ERROR_WANT_READ)
+            return wait_io(SSL_get_fd(ssl), POLLIN);
+        if (err == SSL_ERROR_WANT_WRITE)
+            return wait_io(SSL_get_fd(ssl), POLLOUT);
+        return false;
+    }
+
+    ssize_t ssl_read_some(SSL* ssl, void* buf, size_t len) {
+        while (true) {
+            int r = SSL_read(ssl, buf, (int)std::min(len, (size_t)INT_MAX));
+            if (r > 0 || !ssl_wait(ssl, r))
+                return r;
         }
     }
 
     ssize_t ssl_read_all(SSL* ssl, char* buf, size_t len) {
         size_t total = 0;
         while (total < len) {
-            int r = SSL_read(ssl, buf + total, (int)(len - total));
+            ssize_t r = ssl_read_some(ssl, buf + total, len - total);
             if (r <= 0) 
                 return (total == 0) ? r : (ssize_t)total;
             total += (size_t)r;
@@ -45,13 +78,46 @@ namespace {
     ssize_t ssl_write_all(SSL* ssl, const char* buf, size_t len) {
         size_t total = 0;
         while (total < len) {
-            int r = SSL_write(ssl, buf + total, (int)(len - total));
-            if (r <= 0) 
+            int r = SSL_write(ssl, buf + total, (int)std::min(len - total, (size_t)INT_MAX));
+            if (r <= 0) {
+                if (ssl_wait(ssl, r))
+                    continue;
                 return (total == 0) ? r : (ssize_t)total;
+            }
             total += (size_t)r;
         }
         return (ssize_t)total;
     }
+
+    ssize_t sock_recv_some(int fd, void* buf, size_t len) {
+        while (true) {
+            ssize_t n = recv(fd, buf, len, 0);
+            if (n >= 0)
+                return n;
+            if (errno == EINTR)
+                continue;
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_io(fd, POLLIN))
+                continue;
+            return -1;
+        }
+    }
+
+    ssize_t sock_send_all(int fd, const char* buf, size_t len) {
+        size_t sent = 0;
+        while (sent < len) {
+            ssize_t n = send(fd, buf + sent, len - sent, MSG_NOSIGNAL);
+            if (n > 0) {
+                sent += (size_t)n;
+                continue;
+            }
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) && wait_io(fd, POLLOUT))
+                continue;
+            return -1;
+        }
+        return (ssize_t)sent;
+    }
 }
 
 // TLS init (server)
@@ -73,6 +139,10 @@ int Network::init_server_tls(const std::string& cert_path, const std::string& ke
         return -1; 
     }
     SSL_CTX_set_min_proto_version(g_server_ctx, TLS1_2_VERSION);
+#ifdef SSL_OP_ENABLE_KTLS
+    // Let the kernel do record encryption when it can, so downloads can use SSL_sendfile
+    SSL_CTX_set_options(g_server_ctx, SSL_OP_ENABLE_KTLS);
+#endif
     if (SSL_CTX_use_certificate_file(g_server_ctx, cert_path.c_str(), SSL_FILETYPE_PEM) != 1) { 
         log_errors("cert"); 
         return -1; 
@@ -82,7 +152,7 @@ int Network::init_server_tls(const std::string& cert_path, const std::string& ke
         return -1; 
     }
     if (SSL_CTX_check_private_key(g_server_ctx) != 1) { 
-        std::cerr << "Cert/key mismatch\n"; 
+        LOG_ERROR("Cert/key mismatch");
         return -1; 
     }
     return 0;
@@ -105,20 +175,20 @@ int Network::init_client_tls(bool verify_peer) {
     if (verify_peer) {
         // Production mode: verify certificates
         if (SSL_CTX_set_default_verify_paths(g_client_ctx) != 1) { 
-            std::cerr << "CA paths load failed\n"; 
+            LOG_ERROR("CA paths load failed");
         }
         SSL_CTX_set_verify(g_client_ctx, SSL_VERIFY_PEER, nullptr);
     } else {
         // Development mode: skip verification for self-signed certs
         SSL_CTX_set_verify(g_client_ctx, SSL_VERIFY_NONE, nullptr);
-        std::cout << "WARNING: TLS certificate verification disabled (development mode)\n";
+        LOG_WARN("TLS certificate verification disabled (development mode)");
     }
     
     return 0;
 }
 
 // Wrap accepted server socket
-int Network::wrap_server_connection(int fd) {
+int Network::wrap_server_connection(Connection& conn) {
     if (!g_server_ctx) 
         return -1;
 
@@ -126,20 +196,54 @@ int Network::wrap_server_connection(int fd) {
     if (!ssl) 
         return -1;
 
-    SSL_set_fd(ssl, fd);
+    SSL_set_fd(ssl, conn.get_fd());
     if (SSL_accept(ssl) != 1) { 
         log_errors("SSL_accept"); 
         SSL_free(ssl); 
         return -1; 
     }
-    std::lock_guard<std::mutex> lock(g_ssl_mutex);
-    g_fd_ssl[fd] = ssl;
+    conn.set_ssl(ssl);
+
+    return 0;
+}
+
+// Attach a TLS session to a non-blocking accepted socket; the handshake is
+// then driven by continue_handshake() whenever the socket becomes ready.
+int Network::begin_server_handshake(Connection& conn) {
+    if (!g_server_ctx) 
+        return -1;
 
+    SSL* ssl = SSL_new(g_server_ctx);
+    if (!ssl) 
+        return -1;
+
+    SSL_set_fd(ssl, conn.get_fd());
+    SSL_set_accept_state(ssl);
+    conn.set_ssl(ssl);
     return 0;
 }
 
+Network::HandshakeStatus Network::continue_handshake(Connection& conn) {
+    if (!conn.is_tls())
+        return HandshakeStatus::Failed;
+
+    int r = SSL_do_handshake(conn.get_ssl());
+    if (r == 1)
+        return HandshakeStatus::Done;
+
+    switch (SSL_get_error(conn.get_ssl(), r)) {
+    case SSL_ERROR_WANT_READ:
+        return HandshakeStatus::WantRead;
+    case SSL_ERROR_WANT_WRITE:
+        return HandshakeStatus::WantWrite;
+    default:
+        log_errors("SSL_do_handshake");
+        return HandshakeStatus::Failed;
+    }
+}
+
 // Wrap connected client socket
-int Network::wrap_client_connection(int fd) {
+int Network::wrap_client_connection(Connection& conn) {
     if (!g_client_ctx) 
         return -1;
     
@@ -148,7 +252,7 @@ int Network::wrap_client_connection(int fd) {
     if (!ssl) 
         return -1;
     
-    SSL_set_fd(ssl, fd);
+    SSL_set_fd(ssl, conn.get_fd());
     
     if (SSL_connect(ssl) != 1) { 
         log_errors("SSL_connect"); 
@@ -163,33 +267,66 @@ int Network::wrap_client_connection(int fd) {
         if (cert) {
             long vr = SSL_get_verify_result(ssl);
             if (vr != X509_V_OK) 
-                std::cerr << "Peer certificate verify failed: " << X509_verify_cert_error_string(vr) << "\n";
+                LOG_ERROR("Peer certificate verify failed: {}", X509_verify_cert_error_string(vr));
             X509_free(cert);
         } else {
-            std::cerr << "No peer certificate\n";
+            LOG_ERROR("No peer certificate");
         }
     }
     
-    std::lock_guard<std::mutex> lock(g_ssl_mutex);
-    g_fd_ssl[fd] = ssl;
+    conn.set_ssl(ssl);
     return 0;
 }
 
-void Network::close_tls(int fd) {
-    std::lock_guard<std::mutex> lock(g_ssl_mutex);
-    auto it = g_fd_ssl.find(fd);
-    if (it != g_fd_ssl.end()) {
-        // Don't wait for bidirectional shutdown, just send close_notify
-        SSL_set_shutdown(it->second, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
-        SSL_shutdown(it->second);
-        SSL_free(it->second);
-        g_fd_ssl.erase(it);
-    }
+void Network::close_tls(Connection& conn) {
+    conn.close_tls();
+}
+
+void Network::close_connection(Connection& conn) {
+    conn.close();
+}
+
+// Another request is already waiting: decrypted inside the TLS session, or
+// still in the socket buffer
+bool Network::has_pending_input(Connection& conn) {
+    if (!conn.is_open())
+        return false;
+    if (conn.is_tls() && SSL_pending(conn.get_ssl()) > 0)
+        return true;
+    char c;
+    return recv(conn.get_fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
 }
 
-void Network::close_connection(int fd) {
-    close_tls(fd);
-    close(fd);
+// An idle keep-alive connection has nothing to read unless the peer went away
+// (FIN or close_notify). TLS 1.3 session tickets may also be pending; reading
+// them non-blocking consumes them without application data.
+bool Network::peer_closed(Connection& conn) {
+    if (!conn.is_open())
+        return true;
+
+    struct pollfd pfd;
+    pfd.fd = conn.get_fd();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) <= 0)
+        return false;
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+        return true;
+
+    if (!conn.is_tls()) {
+        char c;
+        return recv(conn.get_fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0;
+    }
+
+    int flags = fcntl(conn.get_fd(), F_GETFL, 0);
+    fcntl(conn.get_fd(), F_SETFL, flags | O_NONBLOCK);
+    char c;
+    int r = SSL_read(conn.get_ssl(), &c, 1);
+    int err = SSL_get_error(conn.get_ssl(), r);
+    fcntl(conn.get_fd(), F_SETFL, flags);
+
+    // Unsolicited application data means the stream is out of sync, treat as closed
+    return !(r <= 0 && err == SSL_ERROR_WANT_READ);
 }
 
 void Network::cleanup_tls() {
@@ -204,125 +341,201 @@ void Network::cleanup_tls() {
 }
 
 // TLS-aware raw send
-int Network::send_raw(int fd, const void* data, size_t len) {
-    if (is_tls(fd)) {
-        std::lock_guard<std::mutex> lock(g_ssl_mutex);
-        return ssl_write_all(g_fd_ssl[fd], (const char*)data, len) == (ssize_t)len ? 0 : -1;
-    }
-    size_t sent = 0;
-    const char* p = (const char*)data;
-    while (sent < len) {
-        ssize_t r = send(fd, p + sent, len - sent, 0);
-        if (r <= 0) return -1;
-        sent += (size_t)r;
-    }
+int Network::send_raw(Connection& conn, const void* data, size_t len) {
+    ssize_t sent = conn.is_tls() ? ssl_write_all(conn.get_ssl(), (const char*)data, len)
+                                 : sock_send_all(conn.get_fd(), (const char*)data, len);
+    if (sent != (ssize_t)len)
+        return -1;
+    Metrics::add(Metrics::Counter::BytesOut, len);
     return 0;
 }
 
 // TLS-aware partial read
-ssize_t Network::read_some(int fd, void* buf, size_t len) {
-    if (is_tls(fd)) {
-        std::lock_guard<std::mutex> lock(g_ssl_mutex);
-        return SSL_read(g_fd_ssl[fd], buf, (int)len);
-    }
-    return recv(fd, buf, len, 0);
+ssize_t Network::read_some(Connection& conn, void* buf, size_t len) {
+    ssize_t n = conn.is_tls() ? ssl_read_some(conn.get_ssl(), buf, len)
+                              : sock_recv_some(conn.get_fd(), buf, len);
+    if (n > 0)
+        Metrics::add(Metrics::Counter::BytesIn, (uint64_t)n);
+    return n;
 }
 
-ssize_t Network::recv_all(int sockfd, char *buf, size_t len) {
-    if (is_tls(sockfd)) {
-        std::lock_guard<std::mutex> lock(g_ssl_mutex);
-        return ssl_read_all(g_fd_ssl[sockfd], buf, len);
+ssize_t Network::recv_all(Connection& conn, char *buf, size_t len) {
+    if (conn.is_tls()) {
+        ssize_t n = ssl_read_all(conn.get_ssl(), buf, len);
+        if (n > 0)
+            Metrics::add(Metrics::Counter::BytesIn, (uint64_t)n);
+        return n;
     }
     size_t total = 0; ssize_t n;
     while (total < len) {
-        n = recv(sockfd, buf + total, len - total, 0);
-        if (n <= 0) return n;
+        n = sock_recv_some(conn.get_fd(), buf + total, len - total);
+        if (n <= 0) {
+            Metrics::add(Metrics::Counter::BytesIn, total);
+            return n;
+        }
         total += (size_t)n;
     }
+    Metrics::add(Metrics::Counter::BytesIn, total);
     return (ssize_t)total;
 }
 
-int Network::send_bytes(int client_fd, const void* data, size_t size, const std::string& debug_name) {
+int Network::send_bytes(Connection& conn, const void* data, size_t size, const std::string& debug_name) {
     if (size > UINT32_MAX) { 
-        std::cerr << debug_name << " too large\n"; 
+        LOG_ERROR("{} too large", debug_name);
         return -1; 
     }
     uint32_t len_net = htonl((uint32_t)size);
-    if (is_tls(client_fd)) {
-        std::lock_guard<std::mutex> lock(g_ssl_mutex);
-        if (ssl_write_all(g_fd_ssl[client_fd], (char*)&len_net, sizeof(len_net)) <= 0) 
+
+    // Small messages go out with their length prefix in a single write (one TLS record)
+    const size_t COALESCE_MAX = 16 * 1024 - sizeof(len_net);
+    if (size <= COALESCE_MAX) {
+        char frame[16 * 1024];
+        memcpy(frame, &len_net, sizeof(len_net));
+        if (size > 0)
+            memcpy(frame + sizeof(len_net), data, size);
+        if (send_raw(conn, frame, sizeof(len_net) + size) != 0) {
+            if (!conn.is_tls())
+                LOG_ERROR("send {} failed: {}", debug_name, ::Log::Errno{errno});
             return -1;
-        const char* p = (const char*)data;
-        size_t sent = 0;
-        while (sent < size) {
-            ssize_t r = ssl_write_all(g_fd_ssl[client_fd], p + sent, size - sent);
-            if (r <= 0) 
-                return -1;
-            sent += (size_t)r;
         }
         return 0;
     }
-    // Non-TLS path
-    if (send(client_fd, &len_net, sizeof(len_net), 0) == -1) { 
-        perror(("send " + debug_name + " length failed").c_str()); 
+
+    if (send_raw(conn, &len_net, sizeof(len_net)) != 0) { 
+        if (!conn.is_tls())
+            LOG_ERROR("send {} length failed: {}", debug_name, ::Log::Errno{errno});
         return -1; 
     }
-    const char* p = (const char*)data; size_t sent = 0;
-    while (sent < size) {
-        ssize_t n = send(client_fd, p + sent, size - sent, 0);
-        if (n <= 0) { 
-            perror(("send " + debug_name + " data failed").c_str()); 
-            return -1; 
-        }
-        sent += (size_t)n;
+    if (send_raw(conn, data, size) != 0) { 
+        if (!conn.is_tls())
+            LOG_ERROR("send {} data failed: {}", debug_name, ::Log::Errno{errno});
+        return -1; 
     }
     return 0;
 }
 
-int Network::recv_bytes(int client_fd, std::vector<char>& buffer, const std::string& debug_name) {
+int Network::recv_bytes(Connection& conn, std::vector<char>& buffer, const std::string& debug_name) {
     uint32_t len_net = 0;
-    if (is_tls(client_fd)) {
-        std::lock_guard<std::mutex> lock(g_ssl_mutex);
-        if (ssl_read_all(g_fd_ssl[client_fd], (char*)&len_net, sizeof(len_net)) <= 0) 
-            return -1;
-    } else {
-        if (recv_all(client_fd, (char*)&len_net, sizeof(len_net)) <= 0) { 
-            perror(("recv " + debug_name + " length failed").c_str()); 
-            return -1; 
-        }
+    if (recv_all(conn, (char*)&len_net, sizeof(len_net)) <= 0) { 
+        if (!conn.is_tls())
+            LOG_ERROR("recv {} length failed: {}", debug_name, ::Log::Errno{errno});
+        return -1; 
     }
     uint32_t len = ntohl(len_net);
     const uint32_t MAX = 10u * 1024u * 1024u;
     if (len > MAX) { 
-        std::cerr << debug_name << " too large: " << len << "\n"; 
+        LOG_ERROR("{} too large: {}", debug_name, len);
         return -1; 
     }
     buffer.resize(len);
     if (len == 0) return 0;
-    if (is_tls(client_fd)) {
-        std::lock_guard<std::mutex> lock(g_ssl_mutex);
-        if (ssl_read_all(g_fd_ssl[client_fd], buffer.data(), len) <= 0) 
-        return -1;
-    } else {
-        if (recv_all(client_fd, buffer.data(), len) <= 0) { 
-            perror(("recv " + debug_name + " data failed").c_str()); 
-            return -1; 
-        }
+    if (recv_all(conn, buffer.data(), len) != (ssize_t)len) { 
+        if (!conn.is_tls())
+            LOG_ERROR("recv {} data failed: {}", debug_name, ::Log::Errno{errno});
+        return -1; 
     }
     return 0;
 }
 
-int Network::send_string(int client_fd, const std::string& str, const std::string& debug_name) {
-    return send_bytes(client_fd, str.data(), str.size(), debug_name);
+int Network::send_string(Connection& conn, const std::string& str, const std::string& debug_name) {
+    return send_bytes(conn, str.data(), str.size(), debug_name);
 }
 
-int Network::recv_string(int client_fd, std::string& str, const std::string& debug_name) {
+int Network::recv_string(Connection& conn, std::string& str, const std::string& debug_name) {
     std::vector<char> buffer;
-    if (recv_bytes(client_fd, buffer, debug_name) != 0) 
+    if (recv_bytes(conn, buffer, debug_name) != 0) 
         return -1;
     str.assign(buffer.begin(), buffer.end());
     return 0;
 }
 
-int Network::get_file(int) { return 0; }
-int Network::send_file(int) { return 0; }
\ No newline at end of file
+int Network::send_checksum(Connection& conn, uint32_t crc) {
+    uint32_t crc_net = htonl(crc);
+    return send_raw(conn, &crc_net, sizeof(crc_net));
+}
+
+int Network::recv_checksum(Connection& conn, uint32_t& crc) {
+    uint32_t crc_net = 0;
+    if (recv_all(conn, (char*)&crc_net, sizeof(crc_net)) != (ssize_t)sizeof(crc_net))
+        return -1;
+    crc = ntohl(crc_net);
+    return 0;
+}
+
+int Network::get_file(Connection&) { return 0; }
+
+bool Network::zero_copy_capable(Connection& conn) {
+    if (!conn.is_tls())
+        return true;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    return BIO_get_ktls_send(SSL_get_wbio(conn.get_ssl()));
+#else
+    return false;
+#endif
+}
+
+// Send count bytes of file_fd starting at offset. Plain sockets use sendfile(2);
+// TLS sessions with kernel TLS offload use SSL_sendfile; anything else falls back
+// to pooled buffers filled by a ReadAhead reader.
+int Network::send_file(Connection& conn, int file_fd, off_t offset, uint64_t count) {
+    // sendfile reads the file itself; going a span at a time and hinting the
+    // next span lets the disk work on it while the current one is sent
+    const size_t MAX_CHUNK = (size_t)std::min<uint64_t>(ReadAhead::prefetch_span(), 1u << 30);
+    uint64_t hinted = (uint64_t)offset;
+    auto prefetch = [&](uint64_t from) {
+        uint64_t ahead = from + std::min<uint64_t>(count, 2 * (uint64_t)MAX_CHUNK);
+        if (ahead > hinted) {
+            posix_fadvise(file_fd, (off_t)hinted, (off_t)(ahead - hinted), POSIX_FADV_WILLNEED);
+            hinted = ahead;
+        }
+    };
+
+    if (!conn.is_tls()) {
+        while (count > 0) {
+            prefetch((uint64_t)offset);
+            ssize_t n = sendfile(conn.get_fd(), file_fd, &offset, (size_t)std::min<uint64_t>(count, MAX_CHUNK));
+            if (n > 0) {
+                Metrics::add(Metrics::Counter::BytesOut, (uint64_t)n);
+                count -= (uint64_t)n;
+                continue;
+            }
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) && wait_io(conn.get_fd(), POLLOUT))
+                continue;
+            if (n == -1 && (errno == EINVAL || errno == ENOSYS))
+                break;   // file type not supported by sendfile, finish with buffered I/O
+            return -1;
+        }
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    else if (zero_copy_capable(conn)) {
+        while (count > 0) {
+            prefetch((uint64_t)offset);
+            ossl_ssize_t n = SSL_sendfile(conn.get_ssl(), file_fd, offset, (size_t)std::min<uint64_t>(count, MAX_CHUNK), 0);
+            if (n > 0) {
+                Metrics::add(Metrics::Counter::BytesOut, (uint64_t)n);
+                offset += n;
+                count -= (uint64_t)n;
+                continue;
+            }
+            if (ssl_wait(conn.get_ssl(), (int)n))
+                continue;
+            return -1;
+        }
+    }
+#endif
+
+    // Buffered: the next chunks are read while this one is being sent
+    ReadAhead reader(file_fd, (uint64_t)offset, count);
+    BufferPool::Lease buffer;
+    size_t n = 0;
+    while (true) {
+        if (!reader.next(buffer, n))
+            return -1;
+        if (n == 0)
+            return 0;
+        if (send_raw(conn, buffer.data(), n) != 0)
+            return -1;
+    }
+}
\ No newline at end of file
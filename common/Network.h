@@ -4,29 +4,44 @@
 #include <unistd.h>
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <sys/types.h>
 #include <arpa/inet.h>
 
+#include "Connection.h"
+
 class Network {
 public:
-    static ssize_t recv_all(int sockfd, char *buf, size_t len);
+    enum class HandshakeStatus { Done, WantRead, WantWrite, Failed };
+
+    static ssize_t recv_all(Connection& conn, char *buf, size_t len);
+
+    static int send_bytes(Connection& conn, const void* data, size_t size, const std::string& debug_name);
+    static int recv_bytes(Connection& conn, std::vector<char>& buffer, const std::string& debug_name);
 
-    static int send_bytes(int client_fd, const void* data, size_t size, const std::string& debug_name);
-    static int recv_bytes(int client_fd, std::vector<char>& buffer, const std::string& debug_name);
+    static int send_string(Connection& conn, const std::string& str, const std::string& debug_name);
+    static int recv_string(Connection& conn, std::string& str, const std::string& debug_name);
 
-    static int send_string(int client_fd, const std::string& str, const std::string& debug_name);
-    static int recv_string(int client_fd, std::string& str, const std::string& debug_name);
+    // Integrity trailer that follows streamed file data: CRC32C, big-endian
+    static int send_checksum(Connection& conn, uint32_t crc);
+    static int recv_checksum(Connection& conn, uint32_t& crc);
 
-    static int get_file(int client_fd);
-    static int send_file(int client_fd);
+    static int get_file(Connection& conn);
+    static int send_file(Connection& conn, int file_fd, off_t offset, uint64_t count);  // zero-copy when possible
+    static bool zero_copy_capable(Connection& conn);   // plain socket, or TLS with kernel offload
 
     static int init_server_tls(const std::string& cert_path, const std::string& key_path);
     static int init_client_tls(bool verify_peer = false);
-    static int wrap_server_connection(int fd);
-    static int wrap_client_connection(int fd);
+    static int wrap_server_connection(Connection& conn);
+    static int wrap_client_connection(Connection& conn);
+    static int begin_server_handshake(Connection& conn);               // non-blocking accept side
+    static HandshakeStatus continue_handshake(Connection& conn);      // drive until Done/Failed
     static void cleanup_tls();
-    static void close_tls(int fd);
-    static void close_connection(int fd);  // Close both TLS and socket
+    static void close_tls(Connection& conn);
+    static void close_connection(Connection& conn);  // Close both TLS and socket
+    static bool peer_closed(Connection& conn);       // non-blocking check of an idle connection
+    static bool has_pending_input(Connection& conn); // non-blocking: is more request data queued?
 
-    static int send_raw(int fd, const void* data, size_t len);      // fixed-size send (TLS aware)
-    static ssize_t read_some(int fd, void* buf, size_t len);        // read up to len (TLS aware)
-};
\ No newline at end of file
+    static int send_raw(Connection& conn, const void* data, size_t len);      // fixed-size send (TLS aware)
+    static ssize_t read_some(Connection& conn, void* buf, size_t len);        // read up to len (TLS aware)
+};
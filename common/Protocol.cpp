@@ -0,0 +1,250 @@
+#include "Protocol.h"
+#include "Network.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <endian.h>
+
+void Protocol::Writer::put_u16(uint16_t value) {
+    uint16_t net = htobe16(value);
+    put_bytes(&net, sizeof(net));
+}
+
+void Protocol::Writer::put_u32(uint32_t value) {
+    uint32_t net = htobe32(value);
+    put_bytes(&net, sizeof(net));
+}
+
+void Protocol::Writer::put_u64(uint64_t value) {
+    uint64_t net = htobe64(value);
+    put_bytes(&net, sizeof(net));
+}
+
+void Protocol::Writer::put_string(const std::string& value) {
+    put_u32((uint32_t)value.size());
+    put_bytes(value.data(), value.size());
+}
+
+void Protocol::Writer::put_varint(uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+void Protocol::Writer::put_bytes(const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    out.insert(out.end(), p, p + size);
+}
+
+char* Protocol::Writer::extend(size_t size) {
+    out.resize(out.size() + size);
+    return out.data() + out.size() - size;
+}
+
+bool Protocol::Reader::take(void* dst, size_t size) {
+    if (!good || in.size() - pos < size) {
+        good = false;
+        return false;
+    }
+    memcpy(dst, in.data() + pos, size);
+    pos += size;
+    return true;
+}
+
+uint8_t Protocol::Reader::get_u8() {
+    uint8_t value = 0;
+    return take(&value, sizeof(value)) ? value : 0;
+}
+
+uint16_t Protocol::Reader::get_u16() {
+    uint16_t net = 0;
+    return take(&net, sizeof(net)) ? be16toh(net) : 0;
+}
+
+uint32_t Protocol::Reader::get_u32() {
+    uint32_t net = 0;
+    return take(&net, sizeof(net)) ? be32toh(net) : 0;
+}
+
+uint64_t Protocol::Reader::get_u64() {
+    uint64_t net = 0;
+    return take(&net, sizeof(net)) ? be64toh(net) : 0;
+}
+
+std::string Protocol::Reader::get_string() {
+    uint32_t len = get_u32();
+    if (!good || in.size() - pos < len) {
+        good = false;
+        return std::string();
+    }
+    std::string value(in.data() + pos, len);
+    pos += len;
+    return value;
+}
+
+uint64_t Protocol::Reader::get_varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = 0;
+        if (!take(&byte, sizeof(byte)))
+            return 0;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return value;
+    }
+    good = false;   // longer than any 64-bit value
+    return 0;
+}
+
+const char* Protocol::Reader::get_bytes(size_t size) {
+    if (!good || in.size() - pos < size) {
+        good = false;
+        return nullptr;
+    }
+    const char* p = in.data() + pos;
+    pos += size;
+    return p;
+}
+
+const char* Protocol::Reader::rest(size_t& size) {
+    size = good ? in.size() - pos : 0;
+    const char* p = in.data() + pos;
+    pos = in.size();
+    return p;
+}
+
+void Protocol::ListWriter::add(const std::string& name, uint64_t size, int64_t mtime, const std::string& hash) {
+    size_t shared = 0;
+    size_t limit = std::min(name.size(), prev_name.size());
+    while (shared < limit && name[shared] == prev_name[shared])
+        ++shared;
+
+    out.put_varint(shared);
+    out.put_varint(name.size() - shared);
+    out.put_bytes(name.data() + shared, name.size() - shared);
+    out.put_varint(size);
+    int64_t delta = (int64_t)((uint64_t)mtime - (uint64_t)prev_mtime);
+    out.put_varint(((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));   // zigzag
+    if (with_hashes) {
+        out.put_varint(hash.size());
+        out.put_bytes(hash.data(), hash.size());
+    }
+    prev_name = name;
+    prev_mtime = mtime;
+}
+
+bool Protocol::ListReader::next(std::string& name, uint64_t& size, int64_t& mtime, std::string& hash) {
+    uint64_t shared = in.get_varint();
+    uint64_t suffix_len = in.get_varint();
+    if (!in.ok() || shared > prev_name.size())
+        return false;
+    const char* suffix = in.get_bytes((size_t)suffix_len);
+    if (suffix == nullptr)
+        return false;
+    name.assign(prev_name, 0, (size_t)shared);
+    name.append(suffix, (size_t)suffix_len);
+
+    size = in.get_varint();
+    uint64_t zigzag = in.get_varint();
+    int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    mtime = (int64_t)((uint64_t)prev_mtime + (uint64_t)delta);
+    hash.clear();
+    if (with_hashes) {
+        uint64_t hash_len = in.get_varint();
+        const char* h = in.ok() ? in.get_bytes((size_t)hash_len) : nullptr;
+        if (h == nullptr)
+            return false;
+        hash.assign(h, (size_t)hash_len);
+    }
+    if (!in.ok())
+        return false;
+    prev_name = name;
+    prev_mtime = mtime;
+    return true;
+}
+
+int Protocol::send_frame(Connection& conn, const Frame& frame) {
+    if (frame.payload.size() > MAX_PAYLOAD) {
+        LOG_ERROR("frame payload too large: {}", frame.payload.size());
+        return -1;
+    }
+
+    unsigned char header[HEADER_SIZE] = {0};
+    header[0] = MAGIC;
+    header[1] = VERSION;
+    header[2] = (unsigned char)frame.opcode;
+    header[3] = frame.flags;
+    uint16_t status_net = htobe16((uint16_t)frame.status);
+    uint32_t id_net = htobe32(frame.request_id);
+    uint32_t len_net = htobe32((uint32_t)frame.payload.size());
+    memcpy(header + 4, &status_net, sizeof(status_net));
+    memcpy(header + 8, &id_net, sizeof(id_net));
+    memcpy(header + 12, &len_net, sizeof(len_net));
+
+    // Small frames go out in a single write so pipelined requests pack densely
+    const size_t COALESCE_MAX = 16 * 1024;
+    if (HEADER_SIZE + frame.payload.size() <= COALESCE_MAX) {
+        char buf[COALESCE_MAX];
+        memcpy(buf, header, HEADER_SIZE);
+        if (!frame.payload.empty())
+            memcpy(buf + HEADER_SIZE, frame.payload.data(), frame.payload.size());
+        return Network::send_raw(conn, buf, HEADER_SIZE + frame.payload.size());
+    }
+
+    if (Network::send_raw(conn, header, HEADER_SIZE) != 0)
+        return -1;
+    return Network::send_raw(conn, frame.payload.data(), frame.payload.size());
+}
+
+int Protocol::recv_frame(Connection& conn, Frame& frame, bool magic_read) {
+    unsigned char header[HEADER_SIZE];
+    size_t have = 0;
+    if (magic_read) {
+        header[0] = MAGIC;
+        have = 1;
+    }
+    if (Network::recv_all(conn, (char*)header + have, HEADER_SIZE - have) != (ssize_t)(HEADER_SIZE - have))
+        return -1;
+
+    if (header[0] != MAGIC || header[1] != VERSION) {
+        LOG_ERROR("Bad frame header (magic {}, version {})", (int)header[0], (int)header[1]);
+        return -1;
+    }
+
+    uint16_t status_net;
+    uint32_t id_net, len_net;
+    memcpy(&status_net, header + 4, sizeof(status_net));
+    memcpy(&id_net, header + 8, sizeof(id_net));
+    memcpy(&len_net, header + 12, sizeof(len_net));
+    uint32_t len = be32toh(len_net);
+    if (len > MAX_PAYLOAD) {
+        LOG_ERROR("Frame payload too large: {}", len);
+        return -1;
+    }
+
+    frame.opcode = (Opcode)header[2];
+    frame.flags = header[3];
+    frame.status = (Status)be16toh(status_net);
+    frame.request_id = be32toh(id_net);
+    frame.payload.resize(len);
+    if (len > 0 && Network::recv_all(conn, frame.payload.data(), len) != (ssize_t)len)
+        return -1;
+    return 0;
+}
+
+const char* Protocol::status_name(Status status) {
+    switch (status) {
+        case Status::Ok:           return "ok";
+        case Status::Error:        return "error";
+        case Status::BadRequest:   return "bad request";
+        case Status::Unauthorized: return "unauthorized";
+        case Status::NotFound:     return "not found";
+        case Status::Busy:         return "server busy";
+        case Status::TooLarge:     return "too large";
+        case Status::Deferred:     return "deferred";
+    }
+    return "unknown";
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Connection.h"
+
+// Protocol v2: every request and response is one binary frame.
+//
+//   0      magic (0xF2, never the first byte of a legacy 5-byte command)
+//   1      version
+//   2      opcode
+//   3      flags
+//   4..5   status (responses)
+//   6..7   reserved, zero
+//   8..11  request id, echoed in the response
+//   12..15 payload length
+//
+// Integers are big-endian. A client may send many frames before reading any
+// response and must match responses by request id, not by order.
+class Protocol {
+public:
+    static constexpr uint8_t MAGIC = 0xF2;
+    static constexpr uint8_t VERSION = 2;
+    static constexpr size_t HEADER_SIZE = 16;
+    static constexpr uint32_t MAX_PAYLOAD = 4 * 1024 * 1024;
+
+    enum class Opcode : uint8_t {
+        Ping = 1,
+        CreateUser,     // username, password
+        Login,          // username, password -> token
+        Logout,         // token
+        List,           // token, [prefix, u8 sort, u8 descending, u32 limit, cursor, [u8 list flags]]
+                        //   -> count, entries (see ListWriter), next cursor
+        UploadStatus,   // token, filename -> u64 bytes held
+        Get,            // token, filename -> u64 size, data
+        Put,            // token, filename, data
+        PutMany,        // token, count, {filename, u64 size, data}... -> count, u16 status...
+        GetMany,        // token, count, filename... -> count, {u16 status, [u64 size, data]}...
+        PutByHash,      // token, filename, content hash, u64 size; NotFound means upload the data
+                        // (only content the caller already stores is linked)
+        Delete,         // token, filename
+    };
+
+    // List sort orders; the next cursor is empty after the last page
+    enum class ListSort : uint8_t { Name = 0, Size, Mtime };
+
+    // List flags. Without LIST_COMPACT every entry is {name, u64 size,
+    // u64 mtime, hash}; with it entries are front-coded (ListWriter) and the
+    // hash is only sent when LIST_HASHES asks for it.
+    static constexpr uint8_t LIST_COMPACT = 0x01;
+    static constexpr uint8_t LIST_HASHES = 0x02;
+
+    enum class Status : uint16_t {
+        Ok = 0,
+        Error,
+        BadRequest,
+        Unauthorized,
+        NotFound,
+        Busy,
+        TooLarge,
+        Deferred,       // did not fit in this batch response; ask again
+    };
+
+    static constexpr uint8_t FLAG_RESPONSE = 0x01;
+
+    struct Frame {
+        Opcode opcode = Opcode::Ping;
+        uint8_t flags = 0;
+        Status status = Status::Ok;
+        uint32_t request_id = 0;
+        std::vector<char> payload;
+    };
+
+    // Appends fields to a payload
+    class Writer {
+    public:
+        explicit Writer(std::vector<char>& out) : out(out) {}
+        void put_u8(uint8_t value) { out.push_back((char)value); }
+        void put_u16(uint16_t value);
+        void put_u32(uint32_t value);
+        void put_u64(uint64_t value);
+        void put_string(const std::string& value);          // u32 length + bytes
+        void put_varint(uint64_t value);                    // LEB128, 1-10 bytes
+        void put_bytes(const void* data, size_t size);      // raw, no length
+        char* extend(size_t size);                          // room for size raw bytes, filled by the caller
+        size_t size() const { return out.size(); }
+        void truncate(size_t size) { out.resize(size); }    // drop a partly written entry
+    private:
+        std::vector<char>& out;
+    };
+
+    // Reads fields back; any overrun leaves ok() false
+    class Reader {
+    public:
+        explicit Reader(const std::vector<char>& in) : in(in) {}
+        uint8_t get_u8();
+        uint16_t get_u16();
+        uint32_t get_u32();
+        uint64_t get_u64();
+        std::string get_string();
+        uint64_t get_varint();
+        const char* get_bytes(size_t size);                 // size raw bytes, or nullptr
+        const char* rest(size_t& size);                     // everything not yet read
+        bool ok() const { return good; }
+        size_t remaining() const { return good ? in.size() - pos : 0; }
+    private:
+        bool take(void* dst, size_t size);
+        const std::vector<char>& in;
+        size_t pos = 0;
+        bool good = true;
+    };
+
+    // Compact listing entries. Each name is stored as the length it shares with
+    // the previous name plus the differing suffix, sizes as varints and mtimes
+    // as zigzag varint deltas, so a page of similar names costs a few bytes
+    // per entry:
+    //
+    //   varint shared, varint suffix length, suffix, varint size,
+    //   varint mtime delta, [varint hash length, hash]
+    class ListWriter {
+    public:
+        ListWriter(Writer& out, bool with_hashes) : out(out), with_hashes(with_hashes) {}
+        void add(const std::string& name, uint64_t size, int64_t mtime, const std::string& hash);
+    private:
+        Writer& out;
+        bool with_hashes;
+        std::string prev_name;
+        int64_t prev_mtime = 0;
+    };
+
+    class ListReader {
+    public:
+        ListReader(Reader& in, bool with_hashes) : in(in), with_hashes(with_hashes) {}
+        bool next(std::string& name, uint64_t& size, int64_t& mtime, std::string& hash);
+    private:
+        Reader& in;
+        bool with_hashes;
+        std::string prev_name;
+        int64_t prev_mtime = 0;
+    };
+
+    static int send_frame(Connection& conn, const Frame& frame);
+    // magic_read: the caller already consumed the magic byte to tell v2 from legacy
+    static int recv_frame(Connection& conn, Frame& frame, bool magic_read = false);
+
+    static const char* status_name(Status status);
+};
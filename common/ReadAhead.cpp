@@ -0,0 +1,166 @@
+#include "ReadAhead.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+
+namespace {
+    constexpr unsigned SHRINK_AFTER = 32;   // chunks without a stall before the window narrows
+    constexpr unsigned MAX_WINDOW = 64;
+
+    ReadAhead::Options defaults;
+}
+
+ReadAhead::Options ReadAhead::options_from_env() {
+    Options options;
+    if (const char* window = std::getenv("FILESERVER_READ_AHEAD")) {
+        unsigned long n = std::strtoul(window, nullptr, 10);
+        if (n > 0) {
+            options.max_window = (unsigned)std::min<unsigned long>(n, MAX_WINDOW);
+            options.initial_window = std::min(options.initial_window, options.max_window);
+        }
+    }
+    return options;
+}
+
+void ReadAhead::set_defaults(const Options& options) {
+    defaults = options;
+}
+
+uint64_t ReadAhead::prefetch_span() {
+    return (uint64_t)defaults.max_window * BufferPool::instance().chunk_size();
+}
+
+ReadAhead::ReadAhead(int fd, uint64_t offset, uint64_t count)
+    : ReadAhead(fd, offset, count, defaults)
+{
+}
+
+ReadAhead::ReadAhead(int fd, uint64_t offset, uint64_t count, const Options& opts)
+    : fd(fd), offset(offset), end(offset + count), options(opts)
+{
+    options.max_window = std::max(options.max_window, 1u);
+    options.initial_window = std::clamp(options.initial_window, 1u, options.max_window);
+    current_window = options.initial_window;
+
+    posix_fadvise(fd, (off_t)offset, (off_t)count, POSIX_FADV_SEQUENTIAL);
+    if (count > BufferPool::instance().chunk_size())
+        reader = std::thread(&ReadAhead::reader_loop, this);
+}
+
+ReadAhead::~ReadAhead() {
+    if (reader.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        reader.join();
+    }
+}
+
+bool ReadAhead::read_chunk(char* data, size_t len, uint64_t at) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t r = pread(fd, data + done, len - done, (off_t)(at + done));
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        done += (size_t)r;
+    }
+    return true;
+}
+
+void ReadAhead::reader_loop() {
+    uint64_t pos = offset;
+    uint64_t hinted = offset;
+    while (pos < end) {
+        BufferPool::Lease buffer;
+        unsigned window;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this] { return stopping || busy < current_window; });
+            if (stopping)
+                return;
+            ++busy;
+            window = current_window;
+            if (!spare.empty()) {
+                buffer = std::move(spare.back());
+                spare.pop_back();
+            }
+        }
+        if (!buffer)
+            buffer = BufferPool::instance().acquire();
+
+        // The kernel fetches the rest of the window while this chunk is read
+        uint64_t ahead = std::min<uint64_t>(end, pos + (uint64_t)window * buffer.size());
+        if (ahead > hinted) {
+            posix_fadvise(fd, (off_t)hinted, (off_t)(ahead - hinted), POSIX_FADV_WILLNEED);
+            hinted = ahead;
+        }
+
+        size_t len = (size_t)std::min<uint64_t>(buffer.size(), end - pos);
+        bool ok = read_chunk(buffer.data(), len, pos);
+        pos += len;
+
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!ok) {
+            failed = true;
+            cv.notify_all();
+            return;
+        }
+        ready.push_back(Chunk{std::move(buffer), len});
+        if (pos >= end)
+            done = true;
+        cv.notify_all();
+    }
+}
+
+bool ReadAhead::next(BufferPool::Lease& buffer, size_t& len) {
+    len = 0;
+    if (!reader.joinable()) {
+        // Nothing to overlap with for a single buffer: read it here
+        if (delivered || offset == end)
+            return true;
+        delivered = true;
+        if (!buffer)
+            buffer = BufferPool::instance().acquire();
+        len = (size_t)(end - offset);
+        return read_chunk(buffer.data(), len, offset);
+    }
+
+    std::unique_lock<std::mutex> lock(mtx);
+    if (ready.empty() && !done && !failed) {
+        // Sender outran the disk: read further ahead
+        if (delivered && current_window < options.max_window) {
+            current_window = std::min(current_window * 2, options.max_window);
+            cv.notify_all();
+        }
+        streak = 0;
+        cv.wait(lock, [this] { return !ready.empty() || done || failed; });
+    } else if (++streak >= SHRINK_AFTER) {
+        streak = 0;
+        if (current_window > options.initial_window)
+            --current_window;
+    }
+    if (ready.empty())
+        return !failed;
+
+    if (buffer)
+        spare.push_back(std::move(buffer));
+    buffer = std::move(ready.front().buffer);
+    len = ready.front().len;
+    ready.pop_front();
+    --busy;
+    delivered = true;
+    cv.notify_all();
+    return true;
+}
+
+unsigned ReadAhead::window() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return current_window;
+}
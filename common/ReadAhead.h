@@ -0,0 +1,73 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "BufferPool.h"
+
+// Read-ahead for outgoing file data. A reader thread preads the range into
+// pooled buffers ahead of the sender and keeps the kernel prefetching the
+// window beyond that with POSIX_FADV_WILLNEED, so disk latency overlaps with
+// sending instead of adding to it. The window starts small and widens
+// whenever the sender finds nothing ready, then shrinks back slowly once the
+// disk keeps up.
+class ReadAhead {
+public:
+    struct Options {
+        unsigned initial_window = 2;    // buffers read ahead of the sender at first
+        unsigned max_window = 8;
+    };
+
+    // FILESERVER_READ_AHEAD (maximum window, in buffers) overrides the default
+    static Options options_from_env();
+    static void set_defaults(const Options& options);
+
+    // Bytes worth hinting ahead of a sendfile transfer, which the kernel reads itself
+    static uint64_t prefetch_span();
+
+    ReadAhead(int fd, uint64_t offset, uint64_t count);
+    ReadAhead(int fd, uint64_t offset, uint64_t count, const Options& options);
+    ~ReadAhead();
+
+    ReadAhead(const ReadAhead&) = delete;
+    ReadAhead& operator=(const ReadAhead&) = delete;
+
+    // Replace buffer with the next chunk of the range, in file order; the
+    // previous chunk is taken back for reuse. len is 0 once the whole range
+    // has been delivered. False on a read error or a file that got shorter.
+    bool next(BufferPool::Lease& buffer, size_t& len);
+
+    unsigned window();
+
+private:
+    struct Chunk {
+        BufferPool::Lease buffer;
+        size_t len = 0;
+    };
+
+    void reader_loop();
+    bool read_chunk(char* data, size_t len, uint64_t offset);
+
+    int fd;
+    uint64_t offset;
+    uint64_t end;
+    Options options;
+
+    std::thread reader;                   // only started for ranges longer than a buffer
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Chunk> ready;              // read, waiting for the sender
+    std::vector<BufferPool::Lease> spare;
+    unsigned current_window;
+    unsigned busy = 0;                    // buffers ready or being read
+    unsigned streak = 0;                  // chunks in a row the sender did not wait for
+    bool delivered = false;
+    bool done = false;
+    bool failed = false;
+    bool stopping = false;
+};
@@ -1,21 +1,99 @@
 #include "Database.h"
 
-Database::Database(const std::string& file) {
-    if (sqlite3_open(file.c_str(), &db) != SQLITE_OK) {
-        throw std::runtime_error("Failed to open database: " + std::string(sqlite3_errmsg(db)));
+namespace {
+    void exec_on(sqlite3* db, const std::string& sql) {
+        char* errMsg = nullptr;
+        if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
+            std::string error = errMsg ? errMsg : sqlite3_errmsg(db);
+            sqlite3_free(errMsg);
+            throw std::runtime_error("SQLite error: " + error);
+        }
+    }
+}
+
+Database::Database(const std::string& file, size_t pool_size) {
+    if (pool_size == 0)
+        pool_size = 1;
+
+    for (size_t i = 0; i < pool_size; ++i) {
+        auto conn = std::make_unique<PooledConnection>();
+        int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
+        if (sqlite3_open_v2(file.c_str(), &conn->db, flags, nullptr) != SQLITE_OK) {
+            std::string error = conn->db ? sqlite3_errmsg(conn->db) : "out of memory";
+            sqlite3_close(conn->db);
+            throw std::runtime_error("Failed to open database: " + error);
+        }
+
+        // Readers and the writer don't block each other in WAL mode; NORMAL sync
+        // is durable at checkpoints and safe against corruption.
+        sqlite3_busy_timeout(conn->db, 5000);
+        if (i == 0)
+            exec_on(conn->db, "PRAGMA journal_mode=WAL;");
+        exec_on(conn->db,
+            "PRAGMA synchronous=NORMAL;"
+            "PRAGMA temp_store=MEMORY;"
+            "PRAGMA cache_size=-16384;"        // 16 MiB page cache per connection
+            "PRAGMA mmap_size=268435456;");    // 256 MiB memory-mapped reads
+
+        idle.push_back(conn.get());
+        connections.push_back(std::move(conn));
     }
 }
 
 Database::~Database() {
-    if (db)
-        sqlite3_close(db);
+    for (auto& conn : connections) {
+        for (auto& [sql, stmt] : conn->statements)
+            sqlite3_finalize(stmt);
+        if (conn->db)
+            sqlite3_close(conn->db);
+    }
+}
+
+Database::Handle Database::acquire() {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this]() { return !idle.empty(); });
+    PooledConnection* conn = idle.back();
+    idle.pop_back();
+    return Handle(this, conn);
+}
+
+void Database::release(PooledConnection* conn) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        idle.push_back(conn);
+    }
+    cv.notify_one();
 }
 
 void Database::exec(const std::string& sql) {
-    char* errMsg = nullptr;
-    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
-        std::string error = errMsg;
-        sqlite3_free(errMsg);
-        throw std::runtime_error("SQLite error: " + error);
+    Handle handle = acquire();
+    handle.exec(sql);
+}
+
+Database::Handle::~Handle() {
+    if (conn)
+        owner->release(conn);
+}
+
+Database::Statement Database::Handle::prepare(const std::string& sql) {
+    auto it = conn->statements.find(sql);
+    if (it != conn->statements.end())
+        return Statement(it->second);
+
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v3(conn->db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK)
+        return Statement(nullptr);
+    conn->statements.emplace(sql, stmt);
+    return Statement(stmt);
+}
+
+void Database::Handle::exec(const std::string& sql) {
+    exec_on(conn->db, sql);
+}
+
+Database::Statement::~Statement() {
+    if (stmt) {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
     }
-}
\ No newline at end of file
+}
@@ -2,16 +2,69 @@
 #include <sqlite3.h>
 #include <string>
 #include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <vector>
 
+// Pool of SQLite connections to one database file. Each connection is used by
+// one thread at a time and keeps its own cache of prepared statements.
 class Database {
+private:
+    struct PooledConnection {
+        sqlite3* db = nullptr;
+        std::unordered_map<std::string, sqlite3_stmt*> statements;
+    };
+
 public:
-    Database(const std::string& file);
+    // A cached prepared statement; reset and unbound when it goes out of scope
+    class Statement {
+    public:
+        explicit Statement(sqlite3_stmt* stmt = nullptr) : stmt(stmt) {}
+        ~Statement();
+        Statement(const Statement&) = delete;
+        Statement& operator=(const Statement&) = delete;
+        Statement(Statement&& other) noexcept : stmt(other.stmt) { other.stmt = nullptr; }
+
+        sqlite3_stmt* get() const { return stmt; }
+        operator sqlite3_stmt*() const { return stmt; }
+        explicit operator bool() const { return stmt != nullptr; }
+
+    private:
+        sqlite3_stmt* stmt;
+    };
+
+    // Exclusive lease on one pooled connection
+    class Handle {
+    public:
+        Handle(Database* owner, PooledConnection* conn) : owner(owner), conn(conn) {}
+        ~Handle();
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+        Handle(Handle&& other) noexcept : owner(other.owner), conn(other.conn) { other.conn = nullptr; }
+
+        sqlite3* get() const { return conn->db; }
+        Statement prepare(const std::string& sql);   // from this connection's cache
+        void exec(const std::string& sql);
+        const char* errmsg() const { return sqlite3_errmsg(conn->db); }
+
+    private:
+        Database* owner;
+        PooledConnection* conn;
+    };
+
+    Database(const std::string& file, size_t pool_size = 4);
     ~Database();
 
+    Handle acquire();   // blocks until a connection is free
     void exec(const std::string& sql);
 
-    sqlite3* get_handle() { return db; }
-
 private:
-    sqlite3* db = nullptr;
-};
\ No newline at end of file
+    void release(PooledConnection* conn);
+
+    std::vector<std::unique_ptr<PooledConnection>> connections;
+    std::vector<PooledConnection*> idle;
+    std::mutex mtx;
+    std::condition_variable cv;
+};
@@ -31,4 +31,41 @@ void initialize_schema(Database& db) {
             FOREIGN KEY(user_id) REFERENCES users(id)
         );
     )");
+
+    // Content-addressed blobs and the per-user names that refer to them
+    db.exec(R"(
+        CREATE TABLE IF NOT EXISTS blobs (
+            hash TEXT PRIMARY KEY,
+            size INTEGER NOT NULL,
+            crc32c INTEGER,
+            created_at INTEGER NOT NULL
+        );
+    )");
+
+    // Databases created before transfer checksums were recorded lack the column
+    bool has_crc = false;
+    {
+        Database::Handle conn = db.acquire();
+        Database::Statement stmt = conn.prepare("SELECT 1 FROM pragma_table_info('blobs') WHERE name = 'crc32c';");
+        has_crc = stmt && sqlite3_step(stmt) == SQLITE_ROW;
+    }
+    if (!has_crc)
+        db.exec("ALTER TABLE blobs ADD COLUMN crc32c INTEGER;");
+
+    db.exec(R"(
+        CREATE TABLE IF NOT EXISTS files (
+            username TEXT NOT NULL,
+            name TEXT NOT NULL,
+            hash TEXT NOT NULL,
+            size INTEGER NOT NULL,
+            updated_at INTEGER NOT NULL,
+            PRIMARY KEY(username, name)
+        );
+    )");
+
+    // Listing sorted by size or mtime pages through these instead of sorting
+    db.exec("CREATE INDEX IF NOT EXISTS files_by_size ON files(username, size, name);");
+    db.exec("CREATE INDEX IF NOT EXISTS files_by_mtime ON files(username, updated_at, name);");
+    // Hash-only uploads check that the user already holds the content
+    db.exec("CREATE INDEX IF NOT EXISTS files_by_hash ON files(username, hash);");
 }
@@ -0,0 +1,207 @@
+#include "BlobStore.h"
+#include "../common/ContentHash.h"
+#include "../database/Database.h"
+#include "../common/Log.h"
+
+#include <filesystem>
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+BlobStore::BlobStore(Database& db, const std::string& root)
+    : db(db), root(root)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(root, ec);
+    if (ec)
+        LOG_ERROR("Failed to create blob store {}: {}", root, ec.message());
+}
+
+// Blobs fan out over 256 directories by the first digest byte
+std::string BlobStore::blob_path(const std::string& hex) const {
+    return root + "/" + hex.substr(0, 2) + "/" + hex;
+}
+
+// Atomically turn path into another name for blob
+bool BlobStore::replace_with_link(const std::string& blob, const std::string& path) {
+    std::filesystem::path target(path);
+    std::string tmp = (target.parent_path() / ("." + target.filename().string() + ".link")).string();
+    unlink(tmp.c_str());
+    if (link(blob.c_str(), tmp.c_str()) == -1) {
+        LOG_ERRNO("link blob failed");
+        return false;
+    }
+    if (rename(tmp.c_str(), path.c_str()) == -1) {
+        LOG_ERRNO("rename blob link failed");
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool BlobStore::adopt(const std::string& username, const std::string& filename, const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        LOG_ERRNO("open committed file failed");
+        return false;
+    }
+    struct stat st;
+    std::string hex;
+    uint64_t size = 0;
+    uint32_t crc = 0;
+    bool hashed = fstat(fd, &st) == 0 && ContentHash::of_fd(fd, hex, size, &crc);
+    close(fd);
+    if (!hashed) {
+        LOG_ERROR("Failed to hash {}", path);
+        return false;
+    }
+
+    std::string blob = blob_path(hex);
+    mkdir((root + "/" + hex.substr(0, 2)).c_str(), 0755);
+
+    if (link(path.c_str(), blob.c_str()) == -1) {
+        if (errno != EEXIST) {
+            // Still catalogued, just not shared
+            LOG_ERRNO("link into blob store failed");
+            record(username, filename, hex, size, crc);
+            return false;
+        }
+        // Same content is already stored: drop our copy in favour of the blob
+        struct stat bst;
+        if (stat(blob.c_str(), &bst) == 0 && bst.st_ino != st.st_ino && (uint64_t)bst.st_size == size) {
+            if (!replace_with_link(blob, path)) {
+                record(username, filename, hex, size, crc);
+                return false;
+            }
+        }
+    }
+
+    return record(username, filename, hex, size, crc);
+}
+
+bool BlobStore::link_existing(const std::string& hex, uint64_t size,
+                              const std::string& username, const std::string& filename, const std::string& path) {
+    // Knowing a digest is not proof of holding the content: only blobs the
+    // user already has under some name can be linked, so another user's
+    // files can neither be copied nor probed for
+    {
+        Database::Handle conn = db.acquire();
+        Database::Statement stmt = conn.prepare(
+            "SELECT 1 FROM files WHERE username = ? AND hash = ? AND size = ? LIMIT 1;");
+        if (!stmt)
+            return false;
+        sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, hex.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 3, (sqlite3_int64)size);
+        if (sqlite3_step(stmt) != SQLITE_ROW)
+            return false;
+    }
+
+    std::string blob = blob_path(hex);
+    struct stat bst;
+    if (stat(blob.c_str(), &bst) == -1 || !S_ISREG(bst.st_mode) || (uint64_t)bst.st_size != size)
+        return false;
+    if (!replace_with_link(blob, path))
+        return false;
+    return record(username, filename, hex, size, std::nullopt);
+}
+
+bool BlobStore::stored_checksum(int fd, const std::string& username, const std::string& filename, uint32_t& crc) {
+    std::string hex;
+    {
+        Database::Handle conn = db.acquire();
+        Database::Statement stmt = conn.prepare(
+            "SELECT f.hash, b.crc32c FROM files f JOIN blobs b ON b.hash = f.hash "
+            "WHERE f.username = ? AND f.name = ?;");
+        if (!stmt)
+            return false;
+        sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, filename.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt) != SQLITE_ROW || sqlite3_column_type(stmt, 1) == SQLITE_NULL)
+            return false;
+        hex = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        crc = (uint32_t)sqlite3_column_int64(stmt, 1);
+    }
+
+    // The row describes whatever was committed last; it applies to fd only if
+    // fd is the same inode as the blob (a newer upload may have replaced it)
+    struct stat st, bst;
+    return fstat(fd, &st) == 0 && stat(blob_path(hex).c_str(), &bst) == 0 &&
+           st.st_ino == bst.st_ino && st.st_dev == bst.st_dev;
+}
+
+// The blob and the catalog row that names it are written in one transaction
+bool BlobStore::record(const std::string& username, const std::string& filename, const std::string& hex, uint64_t size,
+                       std::optional<uint32_t> crc) {
+    sqlite3_int64 now = (sqlite3_int64)time(nullptr);
+    Database::Handle conn = db.acquire();
+    if (sqlite3_exec(conn.get(), "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        LOG_ERROR("blob record begin failed: {}", conn.errmsg());
+        return false;
+    }
+
+    bool ok = false;
+    {
+        // Fill in the checksum of blobs recorded before it was known
+        Database::Statement blob = conn.prepare(
+            "INSERT INTO blobs (hash, size, crc32c, created_at) VALUES (?, ?, ?, ?) "
+            "ON CONFLICT(hash) DO UPDATE SET crc32c = excluded.crc32c "
+            "WHERE blobs.crc32c IS NULL AND excluded.crc32c IS NOT NULL;");
+        if (blob) {
+            sqlite3_bind_text(blob, 1, hex.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(blob, 2, (sqlite3_int64)size);
+            if (crc)
+                sqlite3_bind_int64(blob, 3, (sqlite3_int64)*crc);
+            else
+                sqlite3_bind_null(blob, 3);
+            sqlite3_bind_int64(blob, 4, now);
+            ok = sqlite3_step(blob) == SQLITE_DONE;
+        }
+    }
+    if (ok) {
+        Database::Statement file = conn.prepare(
+            "INSERT OR REPLACE INTO files (username, name, hash, size, updated_at) VALUES (?, ?, ?, ?, ?);");
+        ok = false;
+        if (file) {
+            sqlite3_bind_text(file, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(file, 2, filename.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(file, 3, hex.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(file, 4, (sqlite3_int64)size);
+            sqlite3_bind_int64(file, 5, now);
+            ok = sqlite3_step(file) == SQLITE_DONE;
+        }
+    }
+
+    if (!ok || sqlite3_exec(conn.get(), "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        LOG_ERROR("file record failed: {}", conn.errmsg());
+        sqlite3_exec(conn.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+    return true;
+}
+
+// A blob whose only link is the store's own is referenced by nobody
+size_t BlobStore::collect_garbage() {
+    size_t removed = 0;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(root, ec)) {
+        struct stat st;
+        if (stat(entry.path().c_str(), &st) == -1 || !S_ISREG(st.st_mode) || st.st_nlink > 1)
+            continue;
+        std::string hex = entry.path().filename().string();
+        if (unlink(entry.path().c_str()) == -1)
+            continue;
+        ++removed;
+
+        Database::Handle conn = db.acquire();
+        Database::Statement stmt = conn.prepare("DELETE FROM blobs WHERE hash = ?;");
+        if (stmt) {
+            sqlite3_bind_text(stmt, 1, hex.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_step(stmt);
+        }
+    }
+    return removed;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+class Database;
+
+// Content-addressed storage for uploaded files. Every stored file is a hard
+// link to a blob named by its BLAKE2b digest, so identical uploads from any
+// number of users share one copy on disk while server/<user>/<name> stays an
+// ordinary file for sendfile and ranged reads. Blobs and the per-user
+// catalog rows (user, name) -> digest (see FileCatalog) are recorded in
+// SQLite, along with each blob's CRC32C so downloads can send their
+// integrity trailer without reading the file twice.
+class BlobStore {
+public:
+    BlobStore(Database& db, const std::string& root);
+
+    // Hash a freshly committed file and share storage with an identical blob
+    bool adopt(const std::string& username, const std::string& filename, const std::string& path);
+
+    // Publish an existing blob as username/filename without any data transfer.
+    // Only blobs username already references qualify; false otherwise, or
+    // when no blob with that digest and size is stored.
+    bool link_existing(const std::string& hex, uint64_t size,
+                       const std::string& username, const std::string& filename, const std::string& path);
+
+    // CRC32C recorded for username/filename, provided fd is still open on that
+    // stored content. False when unknown; callers then compute it from fd.
+    bool stored_checksum(int fd, const std::string& username, const std::string& filename, uint32_t& crc);
+
+    // Remove blobs no user file links to any more. Not safe to run
+    // concurrently with uploads; the server calls it once at startup.
+    size_t collect_garbage();
+
+private:
+    std::string blob_path(const std::string& hex) const;
+    bool replace_with_link(const std::string& blob, const std::string& path);
+    bool record(const std::string& username, const std::string& filename, const std::string& hex, uint64_t size,
+                std::optional<uint32_t> crc);
+
+    Database& db;
+    std::string root;
+};
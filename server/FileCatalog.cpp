@@ -0,0 +1,194 @@
+#include "FileCatalog.h"
+#include "../database/Database.h"
+#include "../common/Log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+namespace {
+    constexpr int CATALOG_VERSION = 1;   // PRAGMA user_version once existing files are indexed
+
+    // Smallest string greater than every string starting with prefix, or
+    // empty when there is none (prefix is all 0xFF bytes)
+    std::string prefix_end(const std::string& prefix) {
+        std::string end = prefix;
+        while (!end.empty() && (unsigned char)end.back() == 0xFF)
+            end.pop_back();
+        if (!end.empty())
+            end.back() = (char)((unsigned char)end.back() + 1);
+        return end;
+    }
+
+    // Cursors are "<sort key>/<name>" for size and mtime order and the bare
+    // name for name order. Names never contain '/', so the split is unambiguous.
+    bool parse_cursor(const std::string& cursor, int64_t& key, std::string& name) {
+        size_t slash = cursor.find('/');
+        if (slash == std::string::npos || slash == 0)
+            return false;
+        errno = 0;
+        char* end = nullptr;
+        long long value = strtoll(cursor.c_str(), &end, 10);
+        if (errno != 0 || end != cursor.c_str() + slash)
+            return false;
+        key = value;
+        name = cursor.substr(slash + 1);
+        return true;
+    }
+
+    const char* sort_column(FileCatalog::Sort sort) {
+        switch (sort) {
+            case FileCatalog::Sort::Size:  return "size";
+            case FileCatalog::Sort::Mtime: return "updated_at";
+            case FileCatalog::Sort::Name:  break;
+        }
+        return nullptr;
+    }
+}
+
+FileCatalog::FileCatalog(Database& db)
+    : db(db)
+{
+}
+
+bool FileCatalog::list(const std::string& username, const Query& query,
+                       std::vector<Entry>& entries, std::string& next_cursor) {
+    entries.clear();
+    next_cursor.clear();
+
+    const char* key = sort_column(query.sort);
+    const char* cmp = query.descending ? " < " : " > ";
+    const char* dir = query.descending ? " DESC" : "";
+
+    int64_t cursor_key = 0;
+    std::string cursor_name;
+    if (!query.cursor.empty()) {
+        if (key == nullptr)
+            cursor_name = query.cursor;
+        else if (!parse_cursor(query.cursor, cursor_key, cursor_name))
+            return false;
+    }
+    std::string end = query.prefix.empty() ? std::string() : prefix_end(query.prefix);
+
+    // Every shape of query is its own cached statement, each answerable from
+    // the primary key or one of the (username, key, name) indexes
+    std::string sql = "SELECT name, size, updated_at, hash FROM files WHERE username = ?";
+    if (!query.prefix.empty())
+        sql += " AND name >= ?";
+    if (!end.empty())
+        sql += " AND name < ?";
+    if (!query.cursor.empty())
+        sql += key ? std::string(" AND (") + key + ", name)" + cmp + "(?, ?)" : std::string(" AND name") + cmp + "?";
+    sql += " ORDER BY ";
+    if (key)
+        sql += std::string(key) + dir + ", ";
+    sql += std::string("name") + dir + " LIMIT ?;";
+
+    uint32_t limit = std::clamp<uint32_t>(query.limit, 1, MAX_PAGE);
+
+    Database::Handle conn = db.acquire();
+    Database::Statement stmt = conn.prepare(sql);
+    if (!stmt) {
+        LOG_ERROR("catalog list prepare failed: {}", conn.errmsg());
+        return false;
+    }
+    int index = 1;
+    sqlite3_bind_text(stmt, index++, username.c_str(), -1, SQLITE_TRANSIENT);
+    if (!query.prefix.empty())
+        sqlite3_bind_text(stmt, index++, query.prefix.c_str(), (int)query.prefix.size(), SQLITE_TRANSIENT);
+    if (!end.empty())
+        sqlite3_bind_text(stmt, index++, end.c_str(), (int)end.size(), SQLITE_TRANSIENT);
+    if (!query.cursor.empty()) {
+        if (key)
+            sqlite3_bind_int64(stmt, index++, (sqlite3_int64)cursor_key);
+        sqlite3_bind_text(stmt, index++, cursor_name.c_str(), (int)cursor_name.size(), SQLITE_TRANSIENT);
+    }
+    // One extra row tells us whether another page follows
+    sqlite3_bind_int64(stmt, index++, (sqlite3_int64)limit + 1);
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (entries.size() == limit) {
+            const Entry& last = entries.back();
+            if (query.sort == Sort::Name)
+                next_cursor = last.name;
+            else
+                next_cursor = std::to_string(query.sort == Sort::Size ? (int64_t)last.size : last.mtime) + "/" + last.name;
+            break;
+        }
+        Entry entry;
+        entry.name.assign(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)), (size_t)sqlite3_column_bytes(stmt, 0));
+        entry.size = (uint64_t)sqlite3_column_int64(stmt, 1);
+        entry.mtime = (int64_t)sqlite3_column_int64(stmt, 2);
+        entry.hash.assign(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3)), (size_t)sqlite3_column_bytes(stmt, 3));
+        entries.push_back(std::move(entry));
+    }
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        LOG_ERROR("catalog list failed: {}", conn.errmsg());
+        return false;
+    }
+    return true;
+}
+
+FileCatalog::RemoveResult FileCatalog::remove(const std::string& username, const std::string& filename,
+                                              const std::string& path) {
+    Database::Handle conn = db.acquire();
+    if (sqlite3_exec(conn.get(), "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        LOG_ERROR("catalog remove begin failed: {}", conn.errmsg());
+        return RemoveResult::Failed;
+    }
+
+    bool deleted = false;
+    {
+        Database::Statement stmt = conn.prepare("DELETE FROM files WHERE username = ? AND name = ?;");
+        if (stmt) {
+            sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(stmt, 2, filename.c_str(), -1, SQLITE_TRANSIENT);
+            deleted = sqlite3_step(stmt) == SQLITE_DONE;
+        }
+    }
+    if (!deleted) {
+        LOG_ERROR("catalog remove failed: {}", conn.errmsg());
+        sqlite3_exec(conn.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+        return RemoveResult::Failed;
+    }
+    bool had_row = sqlite3_changes(conn.get()) > 0;
+
+    // The blob keeps its other links; an orphaned one is collected at startup
+    if (unlink(path.c_str()) == -1 && !(errno == ENOENT && had_row)) {
+        bool missing = errno == ENOENT;
+        if (!missing)
+            LOG_ERRNO("unlink failed");
+        sqlite3_exec(conn.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+        return missing ? RemoveResult::NotFound : RemoveResult::Failed;
+    }
+
+    if (sqlite3_exec(conn.get(), "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        LOG_ERROR("catalog remove commit failed: {}", conn.errmsg());
+        sqlite3_exec(conn.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+        return RemoveResult::Failed;
+    }
+    return RemoveResult::Ok;
+}
+
+bool FileCatalog::contains(const std::string& username, const std::string& filename) {
+    Database::Handle conn = db.acquire();
+    Database::Statement stmt = conn.prepare("SELECT 1 FROM files WHERE username = ? AND name = ?;");
+    if (!stmt)
+        return false;
+    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, filename.c_str(), -1, SQLITE_TRANSIENT);
+    return sqlite3_step(stmt) == SQLITE_ROW;
+}
+
+bool FileCatalog::imported() {
+    Database::Handle conn = db.acquire();
+    Database::Statement stmt = conn.prepare("PRAGMA user_version;");
+    return stmt && sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) >= CATALOG_VERSION;
+}
+
+void FileCatalog::mark_imported() {
+    db.exec("PRAGMA user_version = " + std::to_string(CATALOG_VERSION) + ";");
+}
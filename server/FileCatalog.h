@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Database;
+
+// Index of every stored file: name, size, mtime and content hash per user,
+// held in the SQLite files table. BlobStore writes a row in the same
+// transaction that records the blob whenever an upload commits; listing and
+// deletion are answered here from the table's indexes, so their cost does not
+// depend on how many files the user's directory holds.
+class FileCatalog {
+public:
+    static constexpr uint32_t MAX_PAGE = 1000;
+
+    enum class Sort : uint8_t { Name = 0, Size, Mtime };
+
+    struct Entry {
+        std::string name;
+        uint64_t size;
+        int64_t mtime;
+        std::string hash;
+    };
+
+    // Keyset pagination: pass the previous page's next_cursor to continue
+    struct Query {
+        std::string prefix;
+        Sort sort = Sort::Name;
+        bool descending = false;
+        uint32_t limit = MAX_PAGE;      // clamped to [1, MAX_PAGE]
+        std::string cursor;
+    };
+
+    enum class RemoveResult { Ok, NotFound, Failed };
+
+    explicit FileCatalog(Database& db);
+
+    // One page of username's files. next_cursor is empty after the last page.
+    // False on a malformed cursor or a database error.
+    bool list(const std::string& username, const Query& query,
+              std::vector<Entry>& entries, std::string& next_cursor);
+
+    // Drop username/filename from the catalog and unlink path, as one step:
+    // the row is only removed if the file is gone from disk as well.
+    RemoveResult remove(const std::string& username, const std::string& filename, const std::string& path);
+
+    bool contains(const std::string& username, const std::string& filename);
+
+    // Files written before the catalog existed are indexed once per database
+    bool imported();
+    void mark_imported();
+
+private:
+    Database& db;
+};
@@ -0,0 +1,82 @@
+#include "MappedFiles.h"
+#include "../common/Log.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+    constexpr size_t DEFAULT_MIN_MB = 16;
+}
+
+MappedFiles::Mapping::~Mapping() {
+    munmap(addr, length);
+}
+
+// Readers sit at different offsets of one mapping, so there is no
+// MADV_SEQUENTIAL (it drops pages behind the first reader); each one asks
+// for the window ahead of itself instead
+void MappedFiles::Mapping::prefetch(uint64_t offset, uint64_t len) const {
+    if (offset >= length)
+        return;
+    static const uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t start = offset & ~(page - 1);
+    uint64_t end = std::min<uint64_t>(length, offset + len);
+    madvise(static_cast<char*>(addr) + start, (size_t)(end - start), MADV_WILLNEED);
+}
+
+MappedFiles::MappedFiles(size_t min_size)
+    : min_size(min_size)
+{
+}
+
+size_t MappedFiles::min_size_from_env() {
+    size_t mb = DEFAULT_MIN_MB;
+    if (const char* value = std::getenv("FILESERVER_MMAP_MIN_MB")) {
+        char* end = nullptr;
+        unsigned long long n = std::strtoull(value, &end, 10);
+        if (end != value && *end == '\0')
+            mb = (size_t)n;
+    }
+    return mb * 1024 * 1024;
+}
+
+MappedFiles::Ref MappedFiles::map(int fd, const struct stat& st) {
+    if (min_size == 0 || st.st_size <= 0 || (uint64_t)st.st_size < min_size)
+        return nullptr;
+
+    Key key(st.st_dev, st.st_ino, st.st_size, (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec);
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = mappings.find(key);
+    if (it != mappings.end()) {
+        if (Ref shared = it->second.lock())
+            return shared;
+    }
+
+    void* addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        LOG_ERRNO("mmap failed");
+        return nullptr;
+    }
+
+    // The last reader unmaps and drops the registry entry, unless a newer
+    // mapping of the same file has taken its place meanwhile
+    Ref mapping(new Mapping(addr, (size_t)st.st_size), [this, key](const Mapping* m) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto found = mappings.find(key);
+            if (found != mappings.end() && found->second.expired())
+                mappings.erase(found);
+        }
+        delete m;
+    });
+    mappings[key] = mapping;
+    return mapping;
+}
+
+size_t MappedFiles::active() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return mappings.size();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+// Read-only mappings of large files, shared by every download of the same
+// file that is in flight. TLS sessions without kernel offload hand the mapped
+// pages straight to SSL_write, so N concurrent readers cost one mapping and
+// the page cache instead of N read buffers. Mappings are keyed by inode, size
+// and mtime: a re-upload is a new inode (uploads are renamed into place) and
+// deduplicated copies of one blob share a mapping. The last reader unmaps.
+//
+// Stored files are never truncated in place, which is what makes mapping them
+// safe; a file shrinking under a mapping would fault its readers with SIGBUS.
+class MappedFiles {
+public:
+    class Mapping {
+    public:
+        Mapping(void* addr, size_t length) : addr(addr), length(length) {}
+        ~Mapping();
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+
+        const char* data() const { return static_cast<const char*>(addr); }
+        size_t size() const { return length; }
+
+        // Ask the kernel to start reading [offset, offset + len) in
+        void prefetch(uint64_t offset, uint64_t len) const;
+
+    private:
+        void* addr;
+        size_t length;
+    };
+    using Ref = std::shared_ptr<const Mapping>;
+
+    // Files smaller than min_size are not mapped; 0 disables mapping
+    explicit MappedFiles(size_t min_size);
+
+    // FILESERVER_MMAP_MIN_MB overrides the 16 MiB default
+    static size_t min_size_from_env();
+
+    // The shared mapping of the regular file open as fd, which st describes.
+    // Null when the file is below the threshold or cannot be mapped.
+    Ref map(int fd, const struct stat& st);
+
+    size_t active();
+
+private:
+    using Key = std::tuple<dev_t, ino_t, off_t, int64_t>;   // device, inode, size, mtime (ns)
+
+    std::mutex mtx;
+    std::map<Key, std::weak_ptr<const Mapping>> mappings;
+    size_t min_size;
+};
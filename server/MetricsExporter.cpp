@@ -0,0 +1,141 @@
+#include "MetricsExporter.h"
+#include "../common/Log.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+    constexpr uint16_t DEFAULT_PORT = 9464;
+    constexpr int POLL_MS = 250;                 // how quickly stop() is noticed
+    constexpr int CLIENT_TIMEOUT_MS = 2000;
+    constexpr size_t MAX_REQUEST = 8192;
+
+    bool send_all(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            len -= (size_t)n;
+        }
+        return true;
+    }
+}
+
+MetricsExporter::MetricsExporter(uint16_t port, std::function<std::string()> render)
+    : port(port), render(std::move(render))
+{
+}
+
+MetricsExporter::~MetricsExporter() {
+    stop();
+}
+
+uint16_t MetricsExporter::port_from_env() {
+    if (const char* value = std::getenv("FILESERVER_METRICS_PORT")) {
+        char* end = nullptr;
+        unsigned long n = std::strtoul(value, &end, 10);
+        if (end != value && *end == '\0' && n <= 65535)
+            return (uint16_t)n;
+    }
+    return DEFAULT_PORT;
+}
+
+bool MetricsExporter::start() {
+    if (port == 0)
+        return true;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) {
+        LOG_ERRNO("metrics socket failed");
+        return false;
+    }
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(listen_fd, 16) == -1) {
+        LOG_ERRNO("metrics bind failed");
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    running = true;
+    thread = std::thread(&MetricsExporter::serve_loop, this);
+    LOG_INFO("Metrics on http://127.0.0.1:{}/metrics", port);
+    return true;
+}
+
+void MetricsExporter::stop() {
+    running = false;
+    if (thread.joinable())
+        thread.join();
+    if (listen_fd != -1) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+}
+
+void MetricsExporter::serve_loop() {
+    while (running) {
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, POLL_MS);
+        if (ready <= 0)
+            continue;
+        int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd == -1)
+            continue;
+        serve_client(client_fd);
+        close(client_fd);
+    }
+}
+
+void MetricsExporter::serve_client(int client_fd) {
+    struct timeval timeout = {CLIENT_TIMEOUT_MS / 1000, 0};
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Only the request line matters; read until the end of the headers
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST) {
+        struct pollfd pfd = {client_fd, POLLIN, 0};
+        if (poll(&pfd, 1, CLIENT_TIMEOUT_MS) <= 0)
+            return;
+        ssize_t n = recv(client_fd, buf, sizeof(buf), 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        request.append(buf, (size_t)n);
+    }
+
+    std::string status = "200 OK";
+    std::string body;
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+        body = render();
+    } else {
+        status = "404 Not Found";
+        body = "not found\n";
+    }
+
+    std::string response = "HTTP/1.1 " + status + "\r\n"
+                           "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                           "Connection: close\r\n\r\n";
+    if (send_all(client_fd, response.data(), response.size()))
+        send_all(client_fd, body.data(), body.size());
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Plain-HTTP endpoint on 127.0.0.1 that answers every GET /metrics with the
+// text render() produces, for Prometheus to scrape. It runs on its own
+// thread, one short request at a time, so a slow scraper never touches the
+// reactor or the workers.
+class MetricsExporter {
+public:
+    MetricsExporter(uint16_t port, std::function<std::string()> render);
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    // FILESERVER_METRICS_PORT overrides the default of 9464; 0 disables
+    static uint16_t port_from_env();
+
+    bool start();
+    void stop();
+
+private:
+    void serve_loop();
+    void serve_client(int client_fd);
+
+    uint16_t port;
+    std::function<std::string()> render;
+    int listen_fd = -1;
+    std::atomic<bool> running{false};
+    std::thread thread;
+};
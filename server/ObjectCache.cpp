@@ -0,0 +1,136 @@
+#include "ObjectCache.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+
+namespace {
+    constexpr size_t DEFAULT_BUDGET_MB = 256;
+}
+
+ObjectCache::ObjectCache(size_t budget_bytes)
+    : shard_budget(budget_bytes / SHARDS), max_object_bytes(shard_budget / 2)
+{
+}
+
+size_t ObjectCache::budget_from_env() {
+    size_t mb = DEFAULT_BUDGET_MB;
+    if (const char* value = std::getenv("FILESERVER_CACHE_MB")) {
+        char* end = nullptr;
+        unsigned long long n = std::strtoull(value, &end, 10);
+        if (end != value && *end == '\0')
+            mb = (size_t)n;
+    }
+    return mb * 1024 * 1024;
+}
+
+ObjectCache::Shard& ObjectCache::shard_for(const std::string& key) {
+    return shards[std::hash<std::string>{}(key) % SHARDS];
+}
+
+ObjectCache::Ref ObjectCache::lookup(const std::string& key, bool& admit, uint64_t& ticket) {
+    admit = false;
+    ticket = 0;
+    if (max_object_bytes == 0)
+        return nullptr;
+
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto it = shard.map.find(key);
+    if (it != shard.map.end()) {
+        ++shard.hits;
+        auto node = it->second;
+        if (node->is_protected) {
+            shard.protect.splice(shard.protect.begin(), shard.protect, node);
+        } else {
+            // Second hit: promote, demoting protected entries beyond their share
+            size_t size = node->object->data.size();
+            node->is_protected = true;
+            shard.probation_bytes -= size;
+            shard.protected_bytes += size;
+            shard.protect.splice(shard.protect.begin(), shard.probation, node);
+            while (shard.protected_bytes > shard_budget * PROTECTED_PERCENT / 100 && shard.protect.size() > 1) {
+                auto last = std::prev(shard.protect.end());
+                size_t last_size = last->object->data.size();
+                last->is_protected = false;
+                shard.protected_bytes -= last_size;
+                shard.probation_bytes += last_size;
+                shard.probation.splice(shard.probation.begin(), shard.protect, last);
+            }
+        }
+        return node->object;
+    }
+
+    ++shard.misses;
+    ticket = shard.generation;
+    if (shard.ghosts.erase(key) > 0) {
+        admit = true;
+        return nullptr;
+    }
+    if (shard.ghost_order.size() >= GHOSTS_PER_SHARD) {
+        shard.ghosts.erase(shard.ghost_order.front());
+        shard.ghost_order.pop_front();
+    }
+    shard.ghosts.insert(key);
+    shard.ghost_order.push_back(key);
+    return nullptr;
+}
+
+void ObjectCache::insert(const std::string& key, Ref object, uint64_t ticket) {
+    if (!object || object->data.size() > max_object_bytes)
+        return;
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    // Something invalidated this shard after the caller read the file; its
+    // copy may predate that change
+    if (shard.generation != ticket || shard.map.count(key))
+        return;
+    shard.probation.push_front(Node{key, std::move(object), false});
+    shard.map[key] = shard.probation.begin();
+    shard.probation_bytes += shard.probation.front().object->data.size();
+    evict(shard);
+}
+
+void ObjectCache::evict(Shard& shard) {
+    while (shard.probation_bytes + shard.protected_bytes > shard_budget) {
+        std::list<Node>& from = shard.probation.empty() ? shard.protect : shard.probation;
+        Node& last = from.back();
+        size_t size = last.object->data.size();
+        (last.is_protected ? shard.protected_bytes : shard.probation_bytes) -= size;
+        shard.map.erase(last.key);
+        from.pop_back();
+    }
+}
+
+void ObjectCache::invalidate(const std::string& key) {
+    if (max_object_bytes == 0)
+        return;
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    ++shard.generation;
+    auto it = shard.map.find(key);
+    if (it == shard.map.end())
+        return;
+    auto node = it->second;
+    size_t size = node->object->data.size();
+    if (node->is_protected) {
+        shard.protected_bytes -= size;
+        shard.protect.erase(node);
+    } else {
+        shard.probation_bytes -= size;
+        shard.probation.erase(node);
+    }
+    shard.map.erase(it);
+}
+
+ObjectCache::Stats ObjectCache::stats() {
+    Stats total{0, 0, 0, 0};
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        total.hits += shard.hits;
+        total.misses += shard.misses;
+        total.bytes += shard.probation_bytes + shard.protected_bytes;
+        total.entries += shard.map.size();
+    }
+    return total;
+}
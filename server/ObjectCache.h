@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Whole contents of frequently downloaded files, keyed by "<user>/<name>".
+// Each shard is a segmented LRU: a file enters the probationary segment and
+// moves to the protected one on its next hit, so a burst of one-off downloads
+// cannot push out the files that are fetched over and over. A file is only
+// admitted the second time it misses. Entries are never revalidated against
+// the disk; the server invalidates a key whenever it changes that file.
+class ObjectCache {
+public:
+    struct Object {
+        std::string data;
+        uint32_t crc;          // CRC32C of data, for download trailers
+    };
+    using Ref = std::shared_ptr<const Object>;
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t bytes;
+        uint64_t entries;
+    };
+
+    // A budget of 0 disables the cache
+    explicit ObjectCache(size_t budget_bytes);
+
+    // FILESERVER_CACHE_MB overrides the 256 MiB default
+    static size_t budget_from_env();
+
+    // On a miss, admit says whether the caller should load the file and
+    // insert() it, passing back ticket
+    Ref lookup(const std::string& key, bool& admit, uint64_t& ticket);
+
+    // Dropped if key was invalidated since the lookup that produced ticket
+    void insert(const std::string& key, Ref object, uint64_t ticket);
+    void invalidate(const std::string& key);
+
+    size_t max_object() const { return max_object_bytes; }
+    Stats stats();
+
+private:
+    static constexpr size_t SHARDS = 16;
+    static constexpr size_t GHOSTS_PER_SHARD = 1024;   // remembered first misses
+    static constexpr unsigned PROTECTED_PERCENT = 80;
+
+    struct Node {
+        std::string key;
+        Ref object;
+        bool is_protected;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::list<Node> probation;         // front is most recently used
+        std::list<Node> protect;
+        std::unordered_map<std::string, std::list<Node>::iterator> map;
+        size_t probation_bytes = 0;
+        size_t protected_bytes = 0;
+        std::unordered_set<std::string> ghosts;
+        std::deque<std::string> ghost_order;
+        uint64_t generation = 0;           // bumped by every invalidate
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    Shard& shard_for(const std::string& key);
+    void evict(Shard& shard);
+
+    std::array<Shard, SHARDS> shards;
+    size_t shard_budget;
+    size_t max_object_bytes;
+};
@@ -1,57 +1,184 @@
 #include "Server.h"
 #include "../common/Network.h"
+#include "../common/BufferPool.h"
+#include "../common/ContentHash.h"
+#include "../common/Delta.h"
+#include "../common/Compression.h"
+#include "../common/Checksum.h"
+#include "../common/DiskWriter.h"
+#include "../common/ReadAhead.h"
+#include "../common/Metrics.h"
+#include "../common/Log.h"
 #include "ThreadPool.h"
 #include "../database/Database.h"
 #include "../auth/AuthManager.h"
+#include "BlobStore.h"
+#include "FileCatalog.h"
+#include "MappedFiles.h"
+#include "MetricsExporter.h"
 
 
-#include <iostream>
 #include <fstream>
 #include <cstring>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <ctime>
 #include <filesystem>
+#include <algorithm>
+#include <openssl/ssl.h>
 
 
 void initialize_schema(Database& db);
 
+namespace {
+    constexpr int IDLE_TIMEOUT_SECONDS = 60;       // keep-alive sessions are closed after this much silence
+    constexpr int HANDSHAKE_TIMEOUT_SECONDS = 10;  // clients that stall the TLS handshake are dropped
+    constexpr int STRIPE_TIMEOUT_SECONDS = 600;    // parallel uploads never finished with fnsh are forgotten
+    constexpr int MAX_EVENTS = 256;
+    constexpr int MAX_REQUESTS_PER_DISPATCH = 64;  // a pipelining client yields its worker after this many
+    constexpr size_t DB_POOL_SIZE = 8;             // SQLite connections shared by the workers
+    constexpr int DEFAULT_WORKERS = 4;
+    constexpr size_t HASH_THREADS = 2;             // concurrent Argon2 calls (64 MiB each), at most
+    constexpr size_t HASH_QUEUE = 1;               // waiting logins beyond that get "Server busy"
+    constexpr uint64_t NOT_FOUND = UINT64_MAX;     // file size sentinel in ranged replies
+    constexpr uint32_t MAX_DELTA_LITERAL = 16 * 1024 * 1024;
+    const char* const BLOB_ROOT = "server/.blobs"; // beside the user directories: hard links need one filesystem
+
+    // Commands with their own latency histogram; anything else is "other"
+    const char* const LEGACY_COMMANDS[] = {
+        "send", "get.", "stat", "sndr", "getr", "sndp", "fnsh", "zsnd", "zget",
+        "dsig", "dlta", "crte", "lgin", "lgou", "list", "mtrc",
+    };
+
+    const char* frame_metric_name(Protocol::Opcode opcode) {
+        switch (opcode) {
+            case Protocol::Opcode::Ping:         return "v2.ping";
+            case Protocol::Opcode::CreateUser:   return "v2.create_user";
+            case Protocol::Opcode::Login:        return "v2.login";
+            case Protocol::Opcode::Logout:       return "v2.logout";
+            case Protocol::Opcode::List:         return "v2.list";
+            case Protocol::Opcode::UploadStatus: return "v2.upload_status";
+            case Protocol::Opcode::Get:          return "v2.get";
+            case Protocol::Opcode::Put:          return "v2.put";
+            case Protocol::Opcode::PutMany:      return "v2.put_many";
+            case Protocol::Opcode::GetMany:      return "v2.get_many";
+            case Protocol::Opcode::PutByHash:    return "v2.put_by_hash";
+            case Protocol::Opcode::Delete:       return "v2.delete";
+        }
+        return "other";
+    }
+
+    // A count from the environment, or fallback when unset or malformed
+    size_t count_from_env(const char* name, size_t fallback) {
+        const char* value = std::getenv(name);
+        if (!value)
+            return fallback;
+        char* end = nullptr;
+        unsigned long long n = std::strtoull(value, &end, 10);
+        return end != value && *end == '\0' ? (size_t)n : fallback;
+    }
+
+    bool set_nonblocking(int fd) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+    }
+}
+
 Server::Server(int port, int num_threads)
     : server_fd(-1), port(port), running(false),
-      thread_pool(nullptr), db(nullptr), auth_manager(nullptr)
+      thread_pool(nullptr), db(nullptr), auth_manager(nullptr), blob_store(nullptr), catalog(nullptr), object_cache(nullptr), mapped_files(nullptr),
+      metrics_exporter(nullptr),
+      epoll_fd(-1), wake_fd(-1)
 {
     thread_pool = new ThreadPool(num_threads);
+
+    // A login holds its connection worker until the hash is done, so hashing
+    // threads plus queue slots stay below half the pool: an auth storm can
+    // never occupy more than that share of the workers transfers run on.
+    // FILESERVER_HASH_THREADS and FILESERVER_HASH_QUEUE choose the split within
+    // that cap; the default 4 workers leave room for one hash and no queue.
+    // Logins and sign-ups beyond it get "Server busy", which the client
+    // retries a few times before showing it.
+    size_t auth_slots = std::max<size_t>(1, (thread_pool->size() - 1) / 2);
+    hash_threads = std::max<size_t>(1, std::min(count_from_env("FILESERVER_HASH_THREADS", HASH_THREADS), auth_slots));
+    hash_queue = std::min(count_from_env("FILESERVER_HASH_QUEUE", HASH_QUEUE), auth_slots - hash_threads);
+    object_cache = new ObjectCache(ObjectCache::budget_from_env());
+    mapped_files = new MappedFiles(MappedFiles::min_size_from_env());
+
+    for (const char* command : LEGACY_COMMANDS)
+        Metrics::register_command(command);
+    for (uint8_t op = (uint8_t)Protocol::Opcode::Ping; op <= (uint8_t)Protocol::Opcode::Delete; ++op)
+        Metrics::register_command(frame_metric_name((Protocol::Opcode)op));
+    metrics_exporter = new MetricsExporter(MetricsExporter::port_from_env(), [this] {
+        sampleGauges();
+        return Metrics::prometheus();
+    });
+}
+
+int Server::workers_from_env() {
+    size_t workers = count_from_env("FILESERVER_WORKERS", DEFAULT_WORKERS);
+    return workers > 0 && workers <= 1024 ? (int)workers : DEFAULT_WORKERS;
 }
 
 Server::~Server() {
     stop();
+    if (server_fd != -1)
+        close(server_fd);
+    delete metrics_exporter;   // its render callback reads the thread pool
+    delete thread_pool;   // joins workers before the sessions they use go away
+    sessions.clear();
+    if (wake_fd != -1)
+        close(wake_fd);
+    if (epoll_fd != -1)
+        close(epoll_fd);
+    delete mapped_files;
+    delete object_cache;
+    delete catalog;
+    delete blob_store;
     delete auth_manager;
     delete db;
-    delete thread_pool;
 }
 
 bool Server::initialize() {
     try {
-        db = new Database("server.db");
+        db = new Database("server.db", DB_POOL_SIZE);
         initialize_schema(*db);
         
-        std::cout << "Database initialized successfully.\n";
+        LOG_INFO("Database initialized successfully.");
         
-        auth_manager = new AuthManager(db->get_handle());
+        auth_manager = new AuthManager(*db, hash_threads, hash_queue);
+        LOG_INFO("Password hashing: {} threads, {} queued, of {} workers", hash_threads, hash_queue, thread_pool->size());
+
+        blob_store = new BlobStore(*db, BLOB_ROOT);
+        catalog = new FileCatalog(*db);
+        if (!catalog->imported()) {
+            size_t imported = importUntrackedFiles();
+            catalog->mark_imported();
+            LOG_INFO("Catalogued {} existing files", imported);
+        }
+        size_t orphans = blob_store->collect_garbage();
+        if (orphans > 0)
+            LOG_INFO("Removed {} unreferenced blobs", orphans);
         
     } catch (const std::exception& ex) {
-        std::cerr << "Fatal error: " << ex.what() << "\n";
+        LOG_ERROR("Fatal error: {}", ex.what());
         return false;
     }
 
     server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd == -1) {
-        perror("socket failed");
+        LOG_ERRNO("socket failed");
         return false;
     }
 
     int opt = 1;
     if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
-        perror("setsockopt failed");
+        LOG_ERRNO("setsockopt failed");
         close(server_fd);
         return false;
     }
@@ -64,371 +191,1950 @@ bool Server::initialize() {
 
     if (bind(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
         close(server_fd);
-        perror("bind failed");
+        LOG_ERRNO("bind failed");
+        return false;
+    }
+
+    if (listen(server_fd, SOMAXCONN) == -1) {
+        close(server_fd);
+        LOG_ERRNO("listen failed");
         return false;
     }
 
-    if (listen(server_fd, 5) == -1) {
+    if (!set_nonblocking(server_fd)) {
+        LOG_ERRNO("fcntl O_NONBLOCK failed");
         close(server_fd);
-        perror("listen failed");
+        return false;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd == -1 || wake_fd == -1) {
+        LOG_ERRNO("epoll/eventfd setup failed");
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = server_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) == -1) {
+        LOG_ERRNO("epoll_ctl listen socket failed");
+        return false;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == -1) {
+        LOG_ERRNO("epoll_ctl eventfd failed");
         return false;
     }
 
     // Initialize TLS via Network (certificate + key paths)
     if (Network::init_server_tls("cert/server-cert.pem", "cert/server-key.pem") != 0) {
-        std::cerr << "TLS init failed\n";
+        LOG_ERROR("TLS init failed");
         return false;
     }
 
+    // Scraping is optional: a busy port costs the endpoint, not the server
+    if (!metrics_exporter->start())
+        LOG_WARN("Metrics endpoint disabled");
+
     running = true;
     return true;
 }
 
+// Reactor loop: one thread owns every connection while it is handshaking or
+// idle between commands. A session is only handed to the worker pool once a
+// command is readable, and comes back here when the command is done.
 void Server::run() {
-    if (!running) {
-        std::cerr << "Server not initialized. Call initialize() first.\n";
+    if (server_fd == -1 || epoll_fd == -1) {
+        LOG_ERROR("Server not initialized. Call initialize() first.");
         return;
     }
 
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
+    LOG_INFO("Server listening on port {}...", port);
+
+    struct epoll_event events[MAX_EVENTS];
+    time_t last_sweep = time(nullptr);
 
     while (running) {
-        std::cout << "Server listening on port " << port << "...\n";
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 1000);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            LOG_ERRNO("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == server_fd)
+                acceptConnections();
+            else if (fd == wake_fd)
+                processHandbacks();
+            else
+                handleSessionEvent(fd, events[i].events);
+        }
+
+        time_t now = time(nullptr);
+        if (now != last_sweep) {
+            sweepIdleSessions();
+            sweepStripedUploads();
+            last_sweep = now;
+        }
+    }
+
+    // Anything that takes locks or logs happens here, on the reactor thread,
+    // never in the signal handler that asked for the stop
+    LOG_INFO("Shutting down...");
+    close(server_fd);
+    server_fd = -1;
+    logHashStats();
+    logCacheStats();
+}
+
+// Only an atomic store and a write(2): the reactor wakes up, sees running is
+// false and leaves its loop
+void Server::stop() {
+    running = false;
+    if (wake_fd != -1) {
+        uint64_t one = 1;
+        ssize_t n = write(wake_fd, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+void Server::logHashStats() {
+    if (!auth_manager)
+        return;
+    HashExecutor::Stats hs = auth_manager->hash_stats();
+    uint64_t runs = hs.completed + hs.expired;
+    LOG_INFO("Password hashing: {} done, {} rejected, {} expired; avg hash {}us (max {}us), avg wait {}us (max {}us)", hs.completed, hs.rejected, hs.expired, (hs.completed ? hs.hash_us_total / hs.completed : 0), hs.hash_us_max, (runs ? hs.wait_us_total / runs : 0), hs.wait_us_max);
+}
 
-        int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
+void Server::logCacheStats() {
+    ObjectCache::Stats cs = object_cache->stats();
+    uint64_t lookups = cs.hits + cs.misses;
+    LOG_INFO("Object cache: {} hits of {} lookups ({}%), {} files, {} bytes", cs.hits, lookups, (lookups ? cs.hits * 100 / lookups : 0), cs.entries, cs.bytes);
+}
+
+// Gauges owned elsewhere are read when someone asks for them
+void Server::sampleGauges() {
+    Metrics::set(Metrics::Gauge::PoolQueueDepth, (int64_t)thread_pool->queue_depth());
+}
 
+void Server::acceptConnections() {
+    while (true) {
+        int client_fd = accept4(server_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (client_fd == -1) {
-            perror("accept failed");
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERRNO("accept failed");
+            return;
+        }
+
+        Metrics::add(Metrics::Counter::ConnectionsAccepted);
+        auto session = std::make_unique<Session>();
+        session->conn = Connection(client_fd);
+        session->last_active = time(nullptr);
+        session->accepted_us = Metrics::now_us();
+        if (Network::begin_server_handshake(session->conn) != 0) {
+            LOG_ERROR("TLS session setup failed");
             continue;
         }
-        
-        std::cout << "Client connected\n";
 
-        // Capture necessary state for the worker thread
-        AuthManager* auth_ptr = auth_manager;
-        
-        thread_pool->submit([client_fd, auth_ptr, this]() {
-            this->handleClient(client_fd);
+        sessions[client_fd] = std::move(session);
+        if (!armSession(client_fd, EPOLLIN)) {
+            closeSession(client_fd);
+            continue;
+        }
+        Metrics::set(Metrics::Gauge::ActiveConnections, (int64_t)sessions.size());
+        LOG_DEBUG("Client connected ({} active)", sessions.size());
+    }
+}
+
+void Server::handleSessionEvent(int fd, uint32_t events) {
+    auto it = sessions.find(fd);
+    if (it == sessions.end())
+        return;
+    Session* session = it->second.get();
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        closeSession(fd);
+        return;
+    }
+
+    if (session->state == Session::State::Handshake) {
+        switch (Network::continue_handshake(session->conn)) {
+        case Network::HandshakeStatus::Done:
+            Metrics::observe(Metrics::Timer::TlsHandshake, Metrics::now_us() - session->accepted_us);
+            session->state = Session::State::Idle;
+            session->last_active = time(nullptr);
+            if (!armSession(fd, EPOLLIN))
+                closeSession(fd);
+            break;
+        case Network::HandshakeStatus::WantRead:
+            if (!armSession(fd, EPOLLIN))
+                closeSession(fd);
+            break;
+        case Network::HandshakeStatus::WantWrite:
+            if (!armSession(fd, EPOLLOUT))
+                closeSession(fd);
+            break;
+        case Network::HandshakeStatus::Failed:
+            LOG_ERROR("TLS accept failed");
+            closeSession(fd);
+            break;
+        }
+        return;
+    }
+
+    if (session->state == Session::State::Idle) {
+        session->state = Session::State::Busy;
+        thread_pool->submit([this, session]() {
+            this->serveSession(session);
         });
     }
 }
 
-void Server::stop() {
-    running = false;
-    if (server_fd != -1) {
-        close(server_fd);
-        server_fd = -1;
+void Server::processHandbacks() {
+    uint64_t counter;
+    while (read(wake_fd, &counter, sizeof(counter)) > 0) {
+    }
+
+    std::vector<std::pair<int, bool>> ready;
+    {
+        std::lock_guard<std::mutex> lock(handback_mutex);
+        ready.swap(handbacks);
+    }
+
+    for (const auto& [fd, keep] : ready) {
+        auto it = sessions.find(fd);
+        if (it == sessions.end())
+            continue;
+        if (!keep) {
+            closeSession(fd);
+            continue;
+        }
+        it->second->state = Session::State::Idle;
+        it->second->last_active = time(nullptr);
+        if (!armSession(fd, EPOLLIN))
+            closeSession(fd);
+    }
+}
+
+void Server::sweepIdleSessions() {
+    time_t now = time(nullptr);
+    std::vector<int> expired;
+    for (const auto& [fd, session] : sessions) {
+        if (session->state == Session::State::Idle && now - session->last_active >= IDLE_TIMEOUT_SECONDS)
+            expired.push_back(fd);
+        else if (session->state == Session::State::Handshake && now - session->last_active >= HANDSHAKE_TIMEOUT_SECONDS)
+            expired.push_back(fd);
+    }
+    for (int fd : expired) {
+        LOG_INFO("Closing idle connection");
+        closeSession(fd);
     }
 }
 
-void Server::handleClient(int client_fd) {
-    if (Network::wrap_server_connection(client_fd) != 0) {
-        std::cerr << "TLS accept failed\n";
-        close(client_fd);
+// A client that dies between its stripes and fnsh leaves its entry and
+// staging file behind
+void Server::sweepStripedUploads() {
+    time_t now = time(nullptr);
+    std::lock_guard<std::mutex> lock(stripe_mutex);
+    for (auto it = striped_uploads.begin(); it != striped_uploads.end();) {
+        if (it->second.receiving == 0 && now - it->second.last_active >= STRIPE_TIMEOUT_SECONDS) {
+            LOG_INFO("Abandoned parallel upload: {}", it->first);
+            unlink(it->second.path.c_str());
+            it = striped_uploads.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// The client gives up on the whole transfer once one stripe fails, so its
+// staged data goes too. Stripes of the same transfer still streaming write
+// to the unlinked file and find no entry when they finish.
+void Server::dropStripedUpload(const std::string& key, uint64_t transfer_id) {
+    std::lock_guard<std::mutex> lock(stripe_mutex);
+    auto it = striped_uploads.find(key);
+    if (it == striped_uploads.end() || it->second.transfer_id != transfer_id)
         return;
+    unlink(it->second.path.c_str());
+    striped_uploads.erase(it);
+}
+
+void Server::StripedUpload::add(uint64_t begin, uint64_t end) {
+    if (begin >= end)
+        return;
+    // Merge with a range that starts before begin and reaches it
+    auto it = ranges.upper_bound(begin);
+    if (it != ranges.begin()) {
+        auto prev = std::prev(it);
+        if (prev->second >= begin) {
+            begin = prev->first;
+            end = std::max(end, prev->second);
+            it = ranges.erase(prev);
+        }
     }
-    char command[5] = {0};
-    if (Network::recv_all(client_fd, command, 5) <= 0) { perror("failed to receive command"); Network::close_tls(client_fd); close(client_fd); return; }
+    // ...and with every range that starts inside [begin, end]
+    while (it != ranges.end() && it->first <= end) {
+        end = std::max(end, it->second);
+        it = ranges.erase(it);
+    }
+    ranges[begin] = end;
+}
 
-    std::cout << "Command: " << command << "\n";
+bool Server::StripedUpload::covered() const {
+    if (total == 0)
+        return true;
+    return ranges.size() == 1 && ranges.begin()->first == 0 && ranges.begin()->second == total;
+}
 
-    try {
-        handleCommand(client_fd, command);
-    } catch (const std::exception& ex) {
-        std::cerr << "Exception in handleCommand: " << ex.what() << "\n";
-    } catch (...) {
-        std::cerr << "Unknown exception in handleCommand\n";
+// One-shot registration: the fd reports once, then stays silent until re-armed,
+// so a session is never seen by the reactor and a worker at the same time.
+bool Server::armSession(int fd, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events | EPOLLONESHOT | EPOLLRDHUP;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+        return true;
+    if (errno == ENOENT && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0)
+        return true;
+    LOG_ERRNO("epoll_ctl failed");
+    return false;
+}
+
+void Server::closeSession(int fd) {
+    auto it = sessions.find(fd);
+    if (it == sessions.end())
+        return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    Network::close_connection(it->second->conn);
+    sessions.erase(it);
+    Metrics::set(Metrics::Gauge::ActiveConnections, (int64_t)sessions.size());
+}
+
+void Server::handBack(int fd, bool keep) {
+    {
+        std::lock_guard<std::mutex> lock(handback_mutex);
+        handbacks.emplace_back(fd, keep);
     }
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) == -1)
+        LOG_ERRNO("eventfd write failed");
+}
+
+// Worker side: run the readable command, plus any pipelined behind it (TLS may
+// hold them where epoll cannot see), then return the session.
+void Server::serveSession(Session* session) {
+    Connection& conn = session->conn;
+    bool keep = true;
+    int served = 0;
+
+    do {
+        // v2 frames start with a magic byte no legacy command starts with
+        char first = 0;
+        if (Network::recv_all(conn, &first, 1) != 1) {
+            LOG_DEBUG("Client disconnected");
+            keep = false;
+            break;
+        }
+
+        int rc = -1;
+        if ((uint8_t)first == Protocol::MAGIC) {
+            Protocol::Frame request;
+            if (Protocol::recv_frame(conn, request, true) != 0) {
+                LOG_ERROR("Failed to receive frame");
+                keep = false;
+                break;
+            }
+            uint64_t start = Metrics::now_us();
+            try {
+                rc = handleFrame(conn, request);
+            } catch (const std::exception& ex) {
+                LOG_ERROR("Exception in handleFrame: {}", ex.what());
+            } catch (...) {
+                LOG_ERROR("Unknown exception in handleFrame");
+            }
+            Metrics::observe_command(Metrics::command_id(frame_metric_name(request.opcode)), Metrics::now_us() - start);
+        } else {
+            char command[5] = {first};
+            if (Network::recv_all(conn, command + 1, 4) != 4) {
+                LOG_DEBUG("Client disconnected");
+                keep = false;
+                break;
+            }
+            command[4] = '\0';
+
+            LOG_DEBUG("Command: {}", command);
+
+            if (strcmp(command, "bye.") == 0) {
+                keep = false;
+                break;
+            }
+
+            uint64_t start = Metrics::now_us();
+            try {
+                rc = handleCommand(conn, command);
+            } catch (const std::exception& ex) {
+                LOG_ERROR("Exception in handleCommand: {}", ex.what());
+            } catch (...) {
+                LOG_ERROR("Unknown exception in handleCommand");
+            }
+            Metrics::observe_command(Metrics::command_id(command), Metrics::now_us() - start);
+        }
+
+        // A failed handler may have left the stream mid-message; the session can't continue
+        if (rc != 0) {
+            Metrics::add(Metrics::Counter::CommandErrors);
+            keep = false;
+            break;
+        }
+    } while (++served < MAX_REQUESTS_PER_DISPATCH && Network::has_pending_input(conn));
 
-    std::cout << "Closing connection\n";
-    Network::close_tls(client_fd);
-    close(client_fd);
+    if (!keep)
+        LOG_DEBUG("Closing connection");
+    handBack(conn.get_fd(), keep);
 }
 
-void Server::handleCommand(int client_fd, const char* command) {
-    std::cout << "handleCommand called with: " << command << "\n";
+int Server::handleCommand(Connection& conn, const char* command) {
+    LOG_DEBUG("handleCommand called with: {}", command);
     
+    int rc = -1;
     if (strcmp(command, "send") == 0) {
-        handleGetFile(client_fd);
+        rc = handleGetFile(conn);
     }
     else if (strcmp(command, "get.") == 0) {
-        handleSendFile(client_fd);
+        rc = handleSendFile(conn);
+    }
+    else if (strcmp(command, "stat") == 0) {
+        rc = handleUploadStatus(conn);
+    }
+    else if (strcmp(command, "sndr") == 0) {
+        rc = handleResumeUpload(conn);
+    }
+    else if (strcmp(command, "getr") == 0) {
+        rc = handleRangeDownload(conn);
+    }
+    else if (strcmp(command, "sndp") == 0) {
+        rc = handleStripeUpload(conn);
+    }
+    else if (strcmp(command, "fnsh") == 0) {
+        rc = handleFinishStripes(conn);
+    }
+    else if (strcmp(command, "zsnd") == 0) {
+        rc = handleCompressedUpload(conn);
+    }
+    else if (strcmp(command, "zget") == 0) {
+        rc = handleCompressedDownload(conn);
+    }
+    else if (strcmp(command, "dsig") == 0) {
+        rc = handleDeltaSignatures(conn);
+    }
+    else if (strcmp(command, "dlta") == 0) {
+        rc = handleDeltaUpload(conn);
     }
     else if (strcmp(command, "crte") == 0) {
-        handleCreateUser(client_fd);
+        rc = handleCreateUser(conn);
     }
     else if (strcmp(command, "lgin") == 0) {
-        handleLogin(client_fd);
+        rc = handleLogin(conn);
     }
     else if (strcmp(command, "lgou") == 0) {
-        handleLogout(client_fd);
+        rc = handleLogout(conn);
     }
     else if (strcmp(command, "list") == 0) {
-        handleList(client_fd);
+        rc = handleList(conn);
+    }
+    else if (strcmp(command, "mtrc") == 0) {
+        rc = handleMetrics(conn);
     }
     else {
-        std::cerr << "Unknown command: " << command << "\n";
+        LOG_WARN("Unknown command: {}", command);
     }
     
-    std::cout << "handleCommand completed\n";
+    LOG_DEBUG("handleCommand completed");
+    return rc;
 }
 
-int Server::handleGetFile(int client_fd) {
-    
+bool Server::userFromToken(const std::string& token, std::string& username) {
+    uint64_t start = Metrics::now_us();
+    std::optional<TokenCache::Entry> session = auth_manager->resolve_token(token);
+    Metrics::observe(Metrics::Timer::AuthLookup, Metrics::now_us() - start);
+    if (!session) {
+        LOG_ERROR("Failed to resolve username from token");
+        return false;
+    }
+    username = session->username;
+    return true;
+}
+
+// Resolve the session token that starts every authenticated command
+bool Server::recvUser(Connection& conn, std::string& username) {
     std::string token;
-    if (Network::recv_string(client_fd, token, "token") != 0) {
-        perror("recv token failed");
+    if (Network::recv_string(conn, token, "token") != 0) {
+        LOG_ERRNO("recv token failed");
+        return false;
+    }
+    return userFromToken(token, username);
+}
+
+// Filenames are single path components; dot-names are reserved for partial uploads
+bool Server::validFilename(const std::string& filename) {
+    return !filename.empty() && filename.size() < 256 && filename[0] != '.' &&
+           filename.find('/') == std::string::npos && filename.find('\0') == std::string::npos;
+}
+
+bool Server::recvFilename(Connection& conn, std::string& filename) {
+    if (Network::recv_string(conn, filename, "filename") != 0) {
+        LOG_ERRNO("failed to receive filename");
+        return false;
+    }
+    if (!validFilename(filename)) {
+        LOG_WARN("Rejected filename: {}", filename);
+        return false;
+    }
+    return true;
+}
+
+std::string Server::userDir(const std::string& username) {
+    return "server/" + username;
+}
+
+std::string Server::partPath(const std::string& username, const std::string& filename) {
+    return userDir(username) + "/." + filename + ".part";
+}
+
+std::string Server::stripePath(const std::string& username, const std::string& filename) {
+    return userDir(username) + "/." + filename + ".stripes";
+}
+
+uint64_t Server::partialSize(const std::string& username, const std::string& filename) {
+    struct stat st;
+    if (stat(partPath(username, filename).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+        return (uint64_t)st.st_size;
+    return 0;
+}
+
+// Every name username has stored, in name order, a catalog page at a time
+bool Server::listFiles(const std::string& username, std::vector<std::string>& names) {
+    FileCatalog::Query query;
+    std::vector<FileCatalog::Entry> entries;
+    std::string next;
+    do {
+        if (!catalog->list(username, query, entries, next))
+            return false;
+        for (FileCatalog::Entry& entry : entries)
+            names.push_back(std::move(entry.name));
+        query.cursor = next;
+    } while (!next.empty());
+    return true;
+}
+
+// One-time walk for files stored before uploads were catalogued. Each one is
+// adopted as if just uploaded, which also shares storage with identical blobs.
+size_t Server::importUntrackedFiles() {
+    size_t imported = 0;
+    std::error_code ec;
+    for (const auto& user : std::filesystem::directory_iterator("server", ec)) {
+        std::string username = user.path().filename().string();
+        if (!user.is_directory() || !validFilename(username))
+            continue;
+        for (const auto& entry : std::filesystem::directory_iterator(user.path(), ec)) {
+            std::string name = entry.path().filename().string();
+            if (!entry.is_regular_file() || !validFilename(name) || catalog->contains(username, name))
+                continue;
+            if (blob_store->adopt(username, name, entry.path().string()) || catalog->contains(username, name))
+                ++imported;
+        }
+    }
+    return imported;
+}
+
+// Receive exactly count bytes from the connection into file_fd at offset.
+// Returns the number of bytes stored; short only if the connection failed.
+// crc, when given, receives the CRC32C of the bytes as they arrived.
+uint64_t Server::receiveInto(Connection& conn, int file_fd, uint64_t offset, uint64_t count, uint32_t* crc) {
+    DiskWriter writer(file_fd, offset, count);
+    uint64_t total_received = 0;
+    if (crc)
+        *crc = 0;
+
+    // Fill a whole chunk per disk write; the writer flushes earlier chunks
+    // while the next one is being received
+    while (total_received < count) {
+        BufferPool::Lease buffer = writer.acquire();
+        if (!buffer)
+            break;
+        size_t want = (size_t)std::min<uint64_t>(buffer.size(), count - total_received);
+        ssize_t r = Network::recv_all(conn, buffer.data(), want);
+        if (r > 0) {
+            if (crc)
+                *crc = Checksum::crc32c(*crc, buffer.data(), (size_t)r);
+            writer.submit(std::move(buffer), (size_t)r, offset + total_received);
+            total_received += (uint64_t)r;
+        }
+        if (r != (ssize_t)want) {
+            LOG_ERRNO("recv failed");
+            break;
+        }
+    }
+    // Nothing counts as received unless it reached the file
+    if (!writer.finish()) {
+        LOG_ERROR("Disk write failed after {} bytes", total_received);
+        return 0;
+    }
+    return total_received;
+}
+
+// Atomically publish a finished partial upload under its real name, then
+// deduplicate it against the blob store. The upload has succeeded even if
+// deduplication fails; the file just keeps its own copy.
+int Server::commitUpload(const std::string& username, const std::string& filename) {
+    std::string final_path = userDir(username) + "/" + filename;
+    if (rename(partPath(username, filename).c_str(), final_path.c_str()) == -1) {
+        LOG_ERRNO("rename partial upload failed");
         return -1;
     }
-    
+    object_cache->invalidate(username + "/" + filename);
+    if (!blob_store->adopt(username, filename, final_path))
+        LOG_WARN("Deduplication skipped for {}", final_path);
+    return 0;
+}
+
+// Whole contents of a user file from the object cache, read in on the second
+// miss. Null when the caller should serve the file from disk as before.
+ObjectCache::Ref Server::cachedFile(const std::string& username, const std::string& filename) {
+    std::string key = username + "/" + filename;
+    bool admit = false;
+    uint64_t ticket = 0;
+    ObjectCache::Ref cached = object_cache->lookup(key, admit, ticket);
+    if (cached || !admit)
+        return cached;
+
+    int file_fd = open((userDir(username) + "/" + filename).c_str(), O_RDONLY | O_CLOEXEC);
+    if (file_fd == -1)
+        return nullptr;
+    struct stat st;
+    if (fstat(file_fd, &st) == -1 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size > object_cache->max_object()) {
+        close(file_fd);
+        return nullptr;
+    }
+
+    auto object = std::make_shared<ObjectCache::Object>();
+    object->data.resize((size_t)st.st_size);
+    size_t done = 0;
+    while (done < object->data.size()) {
+        ssize_t r = pread(file_fd, &object->data[done], object->data.size() - done, (off_t)done);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r <= 0) {
+            close(file_fd);
+            return nullptr;
+        }
+        done += (size_t)r;
+    }
+    object->crc = Checksum::crc32c(0, object->data.data(), object->data.size());
+
+    // A copy damaged at rest stays on the disk path, whose trailer carries the
+    // digest recorded at upload
+    uint32_t stored = 0;
+    bool damaged = blob_store->stored_checksum(file_fd, username, filename, stored) && stored != object->crc;
+    close(file_fd);
+    if (damaged)
+        return nullptr;
+
+    object_cache->insert(key, object, ticket);
+    return object;
+}
+
+// CRC32C of [offset, offset + length) of an open user file, for a download
+// trailer. Whole-file downloads reuse the digest recorded at commit time.
+bool Server::fileChecksum(int file_fd, const std::string& username, const std::string& filename,
+                          uint64_t offset, uint64_t length, uint64_t filesize, uint32_t& crc) {
+    if (offset == 0 && length == filesize && blob_store->stored_checksum(file_fd, username, filename, crc))
+        return true;
+    return Checksum::of_fd(file_fd, offset, length, crc);
+}
+
+// Compare the sender's trailer with what we computed over the received bytes
+bool Server::checksumMatches(Connection& conn, const std::string& filename, uint32_t crc, bool& matched) {
+    uint32_t expected = 0;
+    if (Network::recv_checksum(conn, expected) != 0) {
+        LOG_ERRNO("Failed to receive checksum");
+        return false;
+    }
+    matched = crc == expected;
+    if (!matched)
+        LOG_WARN("Checksum mismatch on {}: computed {}, sender {}", filename, Log::Hex{crc}, Log::Hex{expected});
+    return true;
+}
+
+// send: whole-file upload. After the data and its CRC32C trailer the client
+// reads an upload_feedback string saying whether the file was committed.
+int Server::handleGetFile(Connection& conn) {
     std::string username;
-    try {
-        username = auth_manager->username_from_token(token);
-    } catch (...) {
-        std::cerr << "Failed to resolve username from token\n";
+    if (!recvUser(conn, username))
         return -1;
-    }
-    std::vector<char> filename_vec;
-    if (Network::recv_bytes(client_fd, filename_vec, "filename") != 0) {
-        perror("failed to receive filename");
+    std::string filename;
+    if (!recvFilename(conn, filename))
         return -1;
-    }
-    std::string filename(filename_vec.begin(), filename_vec.end());
     uint64_t filesize_net = 0;
-    if (Network::recv_all(client_fd, (char*)&filesize_net, sizeof(filesize_net)) <= 0) {
-        perror("Failed to receive file size");
+    if (Network::recv_all(conn, (char*)&filesize_net, sizeof(filesize_net)) <= 0) {
+        LOG_ERRNO("Failed to receive file size");
         return -1;
     }
     uint64_t filesize = be64toh(filesize_net);
     // Create per-user directory
-    std::string user_dir = "server/" + username;
+    std::string user_dir = userDir(username);
     std::error_code ec;
     std::filesystem::create_directories(user_dir, ec);
     if (ec) {
-        std::cerr << "Failed to create user directory: " << ec.message() << "\n";
+        LOG_ERROR("Failed to create user directory: {}", ec.message());
         return -1;
     }
-    std::cout << "Receiving file for user '" << username << "': " << filename << " (" << filesize << " bytes)\n";
-    std::string save_path = user_dir + "/" + filename;
-    std::ofstream outfile(save_path, std::ios::binary);
+    LOG_INFO("Receiving file for user '{}': {} ({} bytes)", username, filename, filesize);
 
-    if (!outfile.is_open()) {
-        perror("Could not open output file for writing");
+    // Whole-file upload: still staged in the partial file so readers never see half of it
+    int file_fd = open(partPath(username, filename).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file_fd == -1) {
+        LOG_ERRNO("Could not open output file for writing");
         return -1;
     }
 
-    char buffer[4096] = {0};
-    ssize_t bytes_received;
-    uint64_t total_received = 0;
-
-    while (total_received < filesize) {
-        ssize_t r = Network::read_some(client_fd, buffer, sizeof(buffer));
-        if (r <= 0) break;
-        size_t to_write = std::min((size_t)r, (size_t)(filesize - total_received));
-        outfile.write(buffer, to_write);
-        total_received += to_write;
-    }
-
-    outfile.close();
+    uint32_t crc = 0;
+    uint64_t total_received = receiveInto(conn, file_fd, 0, filesize, &crc);
+    close(file_fd);
 
-    if (bytes_received < 0) {
-        perror("recv failed");
+    if (total_received != filesize) {
+        LOG_ERROR("File transfer incomplete. Expected: {}, Received: {}", filesize, total_received);
+        return -1;
     }
-    else if (total_received == filesize) {
-        std::cout << "File transfer complete. Received " << total_received << " bytes.\n";
+    bool matched = false;
+    if (!checksumMatches(conn, filename, crc, matched))
+        return -1;
+    if (!matched) {
+        unlink(partPath(username, filename).c_str());
+        return Network::send_string(conn, "Upload failed: checksum mismatch", "upload_feedback");
     }
-    else {
-        std::cerr << "File transfer incomplete. Expected: " << filesize << ", Received: " << total_received << "\n";
+    LOG_INFO("File transfer complete. Received {} bytes.", total_received);
+    if (commitUpload(username, filename) != 0) {
+        Network::send_string(conn, "Upload failed", "upload_feedback");
+        return -1;
     }
-    return 0;
+    return Network::send_string(conn, "Upload complete", "upload_feedback");
 }
 
-int Server::handleSendFile(int client_fd) {
-    // Receive auth token first
-    std::string token;
-    if (Network::recv_string(client_fd, token, "token") != 0) {
-        perror("recv token failed");
+// stat: how many bytes of an interrupted upload the server already holds
+int Server::handleUploadStatus(Connection& conn) {
+    std::string username;
+    if (!recvUser(conn, username))
         return -1;
-    }
+    std::string filename;
+    if (!recvFilename(conn, filename))
+        return -1;
+
+    uint64_t partial_net = htobe64(partialSize(username, filename));
+    return Network::send_raw(conn, &partial_net, sizeof(partial_net));
+}
 
+// sndr: resumable upload. The client proposes an offset, the server answers with
+// the offset it can actually resume from (never past what it holds), then the
+// client streams the rest of the file. The partial file is renamed when complete.
+int Server::handleResumeUpload(Connection& conn) {
     std::string username;
-    try {
-        username = auth_manager->username_from_token(token); // TODO: implement if missing
-    } catch (...) {
-        std::cerr << "Failed to resolve username from token\n";
+    if (!recvUser(conn, username))
         return -1;
-    }
-    std::vector<char> filename_vec;
-    if (Network::recv_bytes(client_fd, filename_vec, "filename") != 0) {
-        perror("failed to receive filename");
+    std::string filename;
+    if (!recvFilename(conn, filename))
         return -1;
-    }
-    std::string filename(filename_vec.begin(), filename_vec.end());
-    std::string filepath = "server/" + username + "/" + filename;
 
-    if (!std::filesystem::exists(filepath)) {
-        perror("file not found");
+    uint64_t header[2];   // requested offset, total file size
+    if (Network::recv_all(conn, (char*)header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        LOG_ERRNO("Failed to receive upload range");
         return -1;
     }
+    uint64_t requested = be64toh(header[0]);
+    uint64_t filesize = be64toh(header[1]);
 
-    auto filesize = std::filesystem::file_size(filepath);
-
-    uint64_t filesize_net = htobe64(filesize);
-    if (Network::send_raw(client_fd, &filesize_net, sizeof(filesize_net)) == -1) {
-        perror("Failed to send file size");
+    std::string user_dir = userDir(username);
+    std::error_code ec;
+    std::filesystem::create_directories(user_dir, ec);
+    if (ec) {
+        LOG_ERROR("Failed to create user directory: {}", ec.message());
         return -1;
     }
 
-    std::ifstream infile(filepath, std::ios::binary);
-    char buffer[4096] = {0};
-
-    if (!infile.is_open()) {
-        perror("Could not open file for reading");
+    int file_fd = open(partPath(username, filename).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (file_fd == -1) {
+        LOG_ERRNO("Could not open output file for writing");
         return -1;
     }
 
-    while (true) {
-        infile.read(buffer, sizeof(buffer));
-        ssize_t bytes_read = infile.gcount();
-        if (bytes_read <= 0)
-            break;
+    struct stat st;
+    uint64_t held = fstat(file_fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+    uint64_t offset = std::min({requested, held, filesize});
+    if (ftruncate(file_fd, (off_t)offset) == -1) {
+        LOG_ERRNO("ftruncate failed");
+        close(file_fd);
+        return -1;
+    }
 
-        if (Network::send_raw(client_fd, buffer, bytes_read) == -1) {
-            perror("send failed");
-            infile.close();
-            return -1;
-        }
+    uint64_t offset_net = htobe64(offset);
+    if (Network::send_raw(conn, &offset_net, sizeof(offset_net)) != 0) {
+        close(file_fd);
+        return -1;
     }
 
-    infile.close();
-    return 0;
-}
+    LOG_INFO("Receiving file for user '{}': {} ({} bytes, resuming at {})", username, filename, filesize, offset);
 
-int Server::handleCreateUser(int client_fd) {
-    std::vector<char> username_vec;
-    if (Network::recv_bytes(client_fd, username_vec, "username") != 0) {
-        perror("failed to receive username");
+    uint32_t crc = 0;
+    uint64_t received = receiveInto(conn, file_fd, offset, filesize - offset, &crc);
+
+    if (offset + received != filesize) {
+        // Writes complete out of order, so after a disk error the file may
+        // extend past a hole; cut it back to what is known to be there
+        if (ftruncate(file_fd, (off_t)(offset + received)) == -1)
+            LOG_ERRNO("ftruncate failed");
+        close(file_fd);
+        LOG_ERROR("File transfer interrupted at {} of {} bytes", offset + received, filesize);
         return -1;
     }
-
-    std::vector<char> password_vec;
-    if (Network::recv_bytes(client_fd, password_vec, "password") != 0) {
-        perror("failed to receive password");
+    bool matched = false;
+    if (!checksumMatches(conn, filename, crc, matched)) {
+        close(file_fd);
         return -1;
     }
-
-    std::string username(username_vec.begin(), username_vec.end());
-    std::string password(password_vec.begin(), password_vec.end());
-    bool ok = auth_manager->register_user(username, password);
-
-    std::string message = ok ? "User Created" : "Create user failed";
-    if (Network::send_string(client_fd, message, "create_user_feedback") != 0) {
-        perror("send feedback failed");
+    if (!matched) {
+        // Only this transfer's bytes are suspect; a retry resumes where it began
+        if (ftruncate(file_fd, (off_t)offset) == -1)
+            LOG_ERRNO("ftruncate failed");
+        close(file_fd);
+        return Network::send_string(conn, "Upload failed: checksum mismatch", "upload_feedback");
     }
-
-    return ok ? 0 : -1;
+    close(file_fd);
+    if (commitUpload(username, filename) != 0) {
+        Network::send_string(conn, "Upload failed", "upload_feedback");
+        return -1;
+    }
+    return Network::send_string(conn, "Upload complete", "upload_feedback");
 }
 
-int Server::handleLogin(int client_fd) {
-    std::vector<char> username_vec;
-    if (Network::recv_bytes(client_fd, username_vec, "username") != 0) {
-        perror("failed to receive username");
+// sndp: one stripe of a parallel upload. Each stripe arrives on its own
+// connection and is written with pwrite at its offset in the transfer's
+// staging file. The first stripe of a new transfer id resets that file; a
+// failed stripe discards it.
+int Server::handleStripeUpload(Connection& conn) {
+    std::string username;
+    if (!recvUser(conn, username))
+        return -1;
+    std::string filename;
+    if (!recvFilename(conn, filename))
         return -1;
-    }
 
-    std::vector<char> password_vec;
-    if (Network::recv_bytes(client_fd, password_vec, "password") != 0) {
-        perror("failed to receive password");
+    uint64_t header[4];   // transfer id, offset, length, total file size
+    if (Network::recv_all(conn, (char*)header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        LOG_ERRNO("Failed to receive stripe header");
+        return -1;
+    }
+    uint64_t transfer_id = be64toh(header[0]);
+    uint64_t offset = be64toh(header[1]);
+    uint64_t length = be64toh(header[2]);
+    uint64_t filesize = be64toh(header[3]);
+    if (offset > filesize || length > filesize - offset) {
+        LOG_ERROR("Stripe outside of file bounds");
         return -1;
     }
 
-    std::string username(username_vec.begin(), username_vec.end());
+    std::string user_dir = userDir(username);
+    std::error_code ec;
+    std::filesystem::create_directories(user_dir, ec);
+    if (ec) {
+        LOG_ERROR("Failed to create user directory: {}", ec.message());
+        return -1;
+    }
+
+    std::string key = username + "/" + filename;
+    int file_fd = -1;
+    {
+        std::lock_guard<std::mutex> lock(stripe_mutex);
+        auto it = striped_uploads.find(key);
+        bool fresh = it == striped_uploads.end() || it->second.transfer_id != transfer_id;
+        std::string path = stripePath(username, filename);
+        file_fd = open(path.c_str(), O_WRONLY | O_CREAT | (fresh ? O_TRUNC : 0) | O_CLOEXEC, 0644);
+        if (file_fd != -1) {
+            StripedUpload& upload = striped_uploads[key];
+            if (fresh) {
+                upload = StripedUpload();
+                upload.transfer_id = transfer_id;
+                upload.total = filesize;
+                upload.path = path;
+            }
+            ++upload.receiving;
+            upload.last_active = time(nullptr);
+        }
+    }
+    if (file_fd == -1) {
+        LOG_ERRNO("Could not open output file for writing");
+        return -1;
+    }
+
+    uint32_t crc = 0;
+    uint64_t received = receiveInto(conn, file_fd, offset, length, &crc);
+    close(file_fd);
+
+    bool matched = false;
+    bool trailer = received == length && checksumMatches(conn, filename, crc, matched);
+    {
+        std::lock_guard<std::mutex> lock(stripe_mutex);
+        auto it = striped_uploads.find(key);
+        if (it != striped_uploads.end() && it->second.transfer_id == transfer_id) {
+            --it->second.receiving;
+            it->second.last_active = time(nullptr);
+            if (matched)
+                it->second.add(offset, offset + length);
+        }
+    }
+
+    if (!matched)
+        dropStripedUpload(key, transfer_id);
+    if (received != length) {
+        LOG_ERROR("Stripe interrupted at {}", offset + received);
+        return -1;
+    }
+    if (!trailer)
+        return -1;
+    if (!matched)
+        return Network::send_string(conn, "Stripe checksum mismatch", "stripe_feedback");
+    return Network::send_string(conn, "Stripe complete", "stripe_feedback");
+}
+
+// fnsh: all stripes of a parallel upload were acknowledged; publish the file.
+// An incomplete transfer is discarded rather than left to be resumed.
+int Server::handleFinishStripes(Connection& conn) {
+    std::string username;
+    if (!recvUser(conn, username))
+        return -1;
+    std::string filename;
+    if (!recvFilename(conn, filename))
+        return -1;
+
+    uint64_t header[2];   // transfer id, total file size
+    if (Network::recv_all(conn, (char*)header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        LOG_ERRNO("Failed to receive finish header");
+        return -1;
+    }
+    uint64_t transfer_id = be64toh(header[0]);
+    uint64_t filesize = be64toh(header[1]);
+
+    bool complete = false;
+    {
+        std::lock_guard<std::mutex> lock(stripe_mutex);
+        auto it = striped_uploads.find(username + "/" + filename);
+        if (it != striped_uploads.end() && it->second.transfer_id == transfer_id) {
+            complete = it->second.total == filesize && it->second.receiving == 0 && it->second.covered();
+            if (complete && rename(it->second.path.c_str(), partPath(username, filename).c_str()) == -1) {
+                LOG_ERRNO("rename striped upload failed");
+                complete = false;
+            }
+            if (!complete)
+                unlink(it->second.path.c_str());
+            striped_uploads.erase(it);
+        }
+    }
+
+    if (!complete || commitUpload(username, filename) != 0)
+        return Network::send_string(conn, "Upload incomplete", "upload_feedback");
+    LOG_INFO("Parallel upload complete for user '{}': {} ({} bytes)", username, filename, filesize);
+    return Network::send_string(conn, "Upload complete", "upload_feedback");
+}
+
+// Stream [offset, offset + length) of an open user file, then its CRC32C
+// trailer. Large files on TLS sessions without kernel offload go out from the
+// shared mapping; everything else through send_file (sendfile, SSL_sendfile
+// or read-ahead buffers).
+int Server::sendFileData(Connection& conn, int file_fd, const struct stat& st, uint64_t offset, uint64_t length,
+                         const std::string& username, const std::string& filename) {
+    uint64_t filesize = (uint64_t)st.st_size;
+    MappedFiles::Ref mapping;
+    if (length > 0 && !Network::zero_copy_capable(conn))
+        mapping = mapped_files->map(file_fd, st);
+
+    int rc = 0;
+    uint32_t crc = 0;
+    bool have_crc = false;
+    if (mapping) {
+        const uint64_t step = BufferPool::instance().chunk_size();
+        const uint64_t window = std::max(ReadAhead::prefetch_span(), step);
+        uint64_t hinted = offset;
+        for (uint64_t done = 0; done < length && rc == 0;) {
+            // Keep a window of pages being read in ahead of this reader
+            while (hinted < offset + length && hinted < offset + done + window) {
+                mapping->prefetch(hinted, window);
+                hinted += window;
+            }
+            size_t n = (size_t)std::min(step, length - done);
+            rc = Network::send_raw(conn, mapping->data() + offset + done, n);
+            done += n;
+        }
+        // A range's digest is one pass over pages that are resident by now
+        if (rc == 0 && length != filesize) {
+            crc = Checksum::crc32c(0, mapping->data() + offset, (size_t)length);
+            have_crc = true;
+        }
+    } else {
+        posix_fadvise(file_fd, (off_t)offset, (off_t)length, POSIX_FADV_SEQUENTIAL);
+        rc = Network::send_file(conn, file_fd, (off_t)offset, length);
+    }
+    if (rc != 0)
+        LOG_ERRNO("send failed");
+
+    // Otherwise the trailer comes from the stored digest or a second pass
+    // over the (now cached) range
+    if (rc == 0 && !have_crc && !fileChecksum(file_fd, username, filename, offset, length, filesize, crc)) {
+        LOG_ERRNO("checksum read failed");
+        rc = -1;
+    }
+    if (rc == 0)
+        rc = Network::send_checksum(conn, crc);
+    return rc;
+}
+
+int Server::handleSendFile(Connection& conn) {
+    std::string username;
+    if (!recvUser(conn, username))
+        return -1;
+    std::string filename;
+    if (!recvFilename(conn, filename))
+        return -1;
+
+    if (ObjectCache::Ref cached = cachedFile(username, filename)) {
+        uint64_t filesize_net = htobe64((uint64_t)cached->data.size());
+        int rc = Network::send_raw(conn, &filesize_net, sizeof(filesize_net));
+        if (rc == 0)
+            rc = Network::send_raw(conn, cached->data.data(), cached->data.size());
+        if (rc == 0)
+            rc = Network::send_checksum(conn, cached->crc);
+        return rc;
+    }
+
+    std::string filepath = userDir(username) + "/" + filename;
+    int file_fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file_fd == -1) {
+        LOG_ERRNO("file not found");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(file_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        LOG_ERRNO("stat failed");
+        close(file_fd);
+        return -1;
+    }
+    uint64_t filesize = (uint64_t)st.st_size;
+
+    uint64_t filesize_net = htobe64(filesize);
+    if (Network::send_raw(conn, &filesize_net, sizeof(filesize_net)) == -1) {
+        LOG_ERRNO("Failed to send file size");
+        close(file_fd);
+        return -1;
+    }
+
+    int rc = sendFileData(conn, file_fd, st, 0, filesize, username, filename);
+    close(file_fd);
+    return rc;
+}
+
+// zsnd: whole-file upload with per-transfer compression. Header {file size,
+// requested codec}; the server answers with the codec it accepts, then the
+// client streams compressed chunks.
+int Server::handleCompressedUpload(Connection& conn) {
+    std::string username;
+    if (!recvUser(conn, username))
+        return -1;
+    std::string filename;
+    if (!recvFilename(conn, filename))
+        return -1;
+
+    uint64_t header[2];   // file size, requested codec
+    if (Network::recv_all(conn, (char*)header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        LOG_ERRNO("Failed to receive upload header");
+        return -1;
+    }
+    uint64_t filesize = be64toh(header[0]);
+    uint8_t codec = Compression::negotiate((uint8_t)be64toh(header[1]));
+
+    std::string user_dir = userDir(username);
+    std::error_code ec;
+    std::filesystem::create_directories(user_dir, ec);
+    if (ec) {
+        LOG_ERROR("Failed to create user directory: {}", ec.message());
+        return -1;
+    }
+
+    int file_fd = open(partPath(username, filename).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file_fd == -1) {
+        LOG_ERRNO("Could not open output file for writing");
+        return -1;
+    }
+
+    uint64_t codec_net = htobe64(codec);
+    if (Network::send_raw(conn, &codec_net, sizeof(codec_net)) != 0) {
+        close(file_fd);
+        return -1;
+    }
+
+    LOG_INFO("Receiving compressed file for user '{}': {} ({} bytes, codec {})", username, filename, filesize, (int)codec);
+
+    uint32_t crc = 0;
+    uint64_t received = Compression::recv_stream(conn, file_fd, 0, filesize, &crc);
+    close(file_fd);
+
+    if (received != filesize) {
+        LOG_ERROR("File transfer incomplete. Expected: {}, Received: {}", filesize, received);
+        return -1;
+    }
+    bool matched = false;
+    if (!checksumMatches(conn, filename, crc, matched))
+        return -1;
+    if (!matched) {
+        unlink(partPath(username, filename).c_str());
+        return Network::send_string(conn, "Upload failed: checksum mismatch", "upload_feedback");
+    }
+    if (commitUpload(username, filename) != 0) {
+        Network::send_string(conn, "Upload failed", "upload_feedback");
+        return -1;
+    }
+    return Network::send_string(conn, "Upload complete", "upload_feedback");
+}
+
+// zget: whole-file download with per-transfer compression. Request carries
+// the codec the client wants; the reply is {file size or NOT_FOUND, codec}
+// followed by the chunk stream.
+int Server::handleCompressedDownload(Connection& conn) {
+    std::string username;
+    if (!recvUser(conn, username))
+        return -1;
+    std::string filename;
+    if (!recvFilename(conn, filename))
+        return -1;
+
+    uint64_t requested_net = 0;
+    if (Network::recv_all(conn, (char*)&requested_net, sizeof(requested_net)) != (ssize_t)sizeof(requested_net)) {
+        LOG_ERRNO("Failed to receive codec");
+        return -1;
+    }
+    uint8_t codec = Compression::negotiate((uint8_t)be64toh(requested_net));
+
+    std::string filepath = userDir(username) + "/" + filename;
+    int file_fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (file_fd == -1 || fstat(file_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (file_fd != -1)
+            close(file_fd);
+        uint64_t reply[2] = { htobe64(NOT_FOUND), 0 };
+        return Network::send_raw(conn, reply, sizeof(reply));
+    }
+    uint64_t filesize = (uint64_t)st.st_size;
+
+    uint64_t reply[2] = { htobe64(filesize), htobe64(codec) };
+    if (Network::send_raw(conn, reply, sizeof(reply)) != 0) {
+        close(file_fd);
+        return -1;
+    }
+
+    posix_fadvise(file_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    uint32_t crc = 0;
+    int rc = Compression::send_stream(conn, file_fd, 0, filesize, codec, &crc);
+    // The digest recorded at upload also covers what happened to the file at rest
+    uint32_t stored = 0;
+    if (rc == 0 && blob_store->stored_checksum(file_fd, username, filename, stored))
+        crc = stored;
+    close(file_fd);
+    if (rc == 0)
+        rc = Network::send_checksum(conn, crc);
+    return rc;
+}
+
+// getr: ranged download. Reply is the total file size and the length that
+// follows; a missing file is reported as NOT_FOUND and the session goes on.
+int Server::handleRangeDownload(Connection& conn) {
+    std::string username;
+    if (!recvUser(conn, username))
+        return -1;
+    std::string filename;
+    if (!recvFilename(conn, filename))
+        return -1;
+
+    uint64_t range[2];   // offset, length (UINT64_MAX: to end of file)
+    if (Network::recv_all(conn, (char*)range, sizeof(range)) != (ssize_t)sizeof(range)) {
+        LOG_ERRNO("Failed to receive download range");
+        return -1;
+    }
+    uint64_t offset = be64toh(range[0]);
+    uint64_t length = be64toh(range[1]);
+
+    if (ObjectCache::Ref cached = cachedFile(username, filename)) {
+        uint64_t filesize = (uint64_t)cached->data.size();
+        offset = std::min(offset, filesize);
+        length = std::min(length, filesize - offset);
+        uint64_t reply[2] = { htobe64(filesize), htobe64(length) };
+        int rc = Network::send_raw(conn, reply, sizeof(reply));
+        if (rc == 0)
+            rc = Network::send_raw(conn, cached->data.data() + offset, (size_t)length);
+        if (rc == 0)
+            rc = Network::send_checksum(conn, length == filesize ? cached->crc
+                                              : Checksum::crc32c(0, cached->data.data() + offset, (size_t)length));
+        return rc;
+    }
+
+    std::string filepath = userDir(username) + "/" + filename;
+    int file_fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (file_fd == -1 || fstat(file_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (file_fd != -1)
+            close(file_fd);
+        uint64_t reply[2] = { htobe64(NOT_FOUND), 0 };
+        return Network::send_raw(conn, reply, sizeof(reply));
+    }
+
+    uint64_t filesize = (uint64_t)st.st_size;
+    offset = std::min(offset, filesize);
+    length = std::min(length, filesize - offset);
+
+    uint64_t reply[2] = { htobe64(filesize), htobe64(length) };
+    if (Network::send_raw(conn, reply, sizeof(reply)) != 0) {
+        close(file_fd);
+        return -1;
+    }
+
+    int rc = sendFileData(conn, file_fd, st, offset, length, username, filename);
+    close(file_fd);
+    return rc;
+}
+
+// dsig: block signatures of the stored copy, the first half of a delta upload.
+// Reply: u64 file size (NOT_FOUND if none), u32 block size, u32 count, then
+// count entries of u32 weak checksum + strong checksum.
+int Server::handleDeltaSignatures(Connection& conn) {
+    std::string username;
+    if (!recvUser(conn, username))
+        return -1;
+    std::string filename;
+    if (!recvFilename(conn, filename))
+        return -1;
+
+    std::string filepath = userDir(username) + "/" + filename;
+    int file_fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (file_fd == -1 || fstat(file_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (file_fd != -1)
+            close(file_fd);
+        uint64_t reply[2] = { htobe64(NOT_FOUND), 0 };
+        return Network::send_raw(conn, reply, sizeof(reply));
+    }
+
+    uint64_t filesize = (uint64_t)st.st_size;
+    uint32_t block_size = Delta::block_size_for(filesize);
+    std::vector<Delta::BlockSignature> signatures;
+    bool ok = Delta::signatures_of_fd(file_fd, block_size, signatures);
+    close(file_fd);
+    if (!ok) {
+        LOG_ERRNO("signature read failed");
+        signatures.clear();
+    }
+
+    const size_t entry_size = sizeof(uint32_t) + Delta::STRONG_BYTES;
+    std::vector<char> reply(sizeof(uint64_t) + 2 * sizeof(uint32_t) + signatures.size() * entry_size);
+    uint64_t size_net = htobe64(filesize);
+    uint32_t header[2] = { htonl(block_size), htonl((uint32_t)signatures.size()) };
+    memcpy(reply.data(), &size_net, sizeof(size_net));
+    memcpy(reply.data() + sizeof(size_net), header, sizeof(header));
+    char* p = reply.data() + sizeof(size_net) + sizeof(header);
+    for (const Delta::BlockSignature& sig : signatures) {
+        uint32_t weak_net = htonl(sig.weak);
+        memcpy(p, &weak_net, sizeof(weak_net));
+        memcpy(p + sizeof(weak_net), sig.strong, Delta::STRONG_BYTES);
+        p += entry_size;
+    }
+    return Network::send_raw(conn, reply.data(), reply.size());
+}
+
+// Copy length bytes between files, in the kernel where the filesystem allows
+bool Server::copyRange(int from_fd, uint64_t from, int to_fd, uint64_t to, uint64_t length) {
+    loff_t in_off = (loff_t)from;
+    loff_t out_off = (loff_t)to;
+    uint64_t done = 0;
+    while (done < length) {
+        ssize_t n = copy_file_range(from_fd, &in_off, to_fd, &out_off, (size_t)(length - done), 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += (uint64_t)n;
+    }
+    if (done == length)
+        return true;
+
+    // Fallback for filesystems without copy_file_range
+    BufferPool::Lease buffer = BufferPool::instance().acquire();
+    while (done < length) {
+        size_t want = (size_t)std::min<uint64_t>(buffer.size(), length - done);
+        ssize_t r = pread(from_fd, buffer.data(), want, (off_t)(from + done));
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        ssize_t written = 0;
+        while (written < r) {
+            ssize_t w = pwrite(to_fd, buffer.data() + written, (size_t)(r - written), (off_t)(to + done + (uint64_t)written));
+            if (w == -1 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return false;
+            written += w;
+        }
+        done += (uint64_t)r;
+    }
+    return true;
+}
+
+// dlta: rebuild a new version from the stored copy plus a delta stream.
+// Header {base size, block size, target size}; the server answers 1 if it
+// still holds that base (0 and the client uploads in full), then applies
+// copy/literal ops until END and checks the digest of the result.
+int Server::handleDeltaUpload(Connection& conn) {
+    std::string username;
+    if (!recvUser(conn, username))
+        return -1;
+    std::string filename;
+    if (!recvFilename(conn, filename))
+        return -1;
+
+    uint64_t header[3];
+    if (Network::recv_all(conn, (char*)header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        LOG_ERRNO("Failed to receive delta header");
+        return -1;
+    }
+    uint64_t base_size = be64toh(header[0]);
+    uint64_t block_size = be64toh(header[1]);
+    uint64_t target_size = be64toh(header[2]);
+
+    std::string base_path = userDir(username) + "/" + filename;
+    int base_fd = open(base_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    bool usable = base_fd != -1 && fstat(base_fd, &st) == 0 && (uint64_t)st.st_size == base_size &&
+                  block_size == Delta::block_size_for(base_size);
+    int out_fd = -1;
+    if (usable) {
+        out_fd = open(partPath(username, filename).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        usable = out_fd != -1;
+    }
+
+    uint64_t accepted_net = htobe64(usable ? 1 : 0);
+    int rc = Network::send_raw(conn, &accepted_net, sizeof(accepted_net));
+    if (rc != 0 || !usable) {
+        if (base_fd != -1)
+            close(base_fd);
+        if (out_fd != -1)
+            close(out_fd);
+        return rc;
+    }
+
+    LOG_INFO("Receiving delta for user '{}': {} ({} -> {} bytes)", username, filename, base_size, target_size);
+
+    uint64_t blocks = base_size / block_size;
+    uint64_t written = 0;
+    uint64_t literal_bytes = 0;
+    bool ok = true;
+    char digest[ContentHash::HEX_LENGTH];
+
+    while (ok) {
+        uint8_t op = 0;
+        if (Network::recv_all(conn, (char*)&op, 1) != 1) {
+            ok = false;
+            break;
+        }
+        if (op == Delta::OP_END) {
+            ok = Network::recv_all(conn, digest, sizeof(digest)) == (ssize_t)sizeof(digest);
+            break;
+        }
+        if (op == Delta::OP_COPY) {
+            uint64_t first_net;
+            uint32_t count_net;
+            if (Network::recv_all(conn, (char*)&first_net, sizeof(first_net)) != (ssize_t)sizeof(first_net) ||
+                Network::recv_all(conn, (char*)&count_net, sizeof(count_net)) != (ssize_t)sizeof(count_net)) {
+                ok = false;
+                break;
+            }
+            uint64_t first = be64toh(first_net);
+            uint64_t count = ntohl(count_net);
+            uint64_t length = count * block_size;
+            if (first > blocks || count > blocks - first || written + length > target_size) {
+                LOG_ERROR("Delta copy out of range");
+                ok = false;
+                break;
+            }
+            ok = copyRange(base_fd, first * block_size, out_fd, written, length);
+            written += length;
+        } else if (op == Delta::OP_LITERAL) {
+            uint32_t len_net;
+            if (Network::recv_all(conn, (char*)&len_net, sizeof(len_net)) != (ssize_t)sizeof(len_net)) {
+                ok = false;
+                break;
+            }
+            uint32_t length = ntohl(len_net);
+            if (length > MAX_DELTA_LITERAL || written + length > target_size) {
+                LOG_ERROR("Delta literal out of range");
+                ok = false;
+                break;
+            }
+            ok = receiveInto(conn, out_fd, written, length) == length;
+            written += length;
+            literal_bytes += length;
+        } else {
+            LOG_ERROR("Unknown delta op: {}", (int)op);
+            ok = false;
+        }
+    }
+    close(base_fd);
+
+    // A failed op leaves the stream mid-message: the session has to end
+    if (!ok) {
+        close(out_fd);
+        return -1;
+    }
+
+    std::string hex;
+    uint64_t size = 0;
+    bool verified = written == target_size && ContentHash::of_fd(out_fd, hex, size) &&
+                    size == target_size && hex == std::string(digest, sizeof(digest));
+    close(out_fd);
+
+    if (!verified || commitUpload(username, filename) != 0) {
+        LOG_ERROR("Delta result did not verify for {}", filename);
+        unlink(partPath(username, filename).c_str());
+        return Network::send_string(conn, "Upload failed", "upload_feedback");
+    }
+    LOG_INFO("Delta applied: {} literal bytes of {}", literal_bytes, target_size);
+    return Network::send_string(conn, "Upload complete", "upload_feedback");
+}
+
+int Server::handleCreateUser(Connection& conn) {
+    std::vector<char> username_vec;
+    if (Network::recv_bytes(conn, username_vec, "username") != 0) {
+        LOG_ERRNO("failed to receive username");
+        return -1;
+    }
+
+    std::vector<char> password_vec;
+    if (Network::recv_bytes(conn, password_vec, "password") != 0) {
+        LOG_ERRNO("failed to receive password");
+        return -1;
+    }
+
+    std::string username(username_vec.begin(), username_vec.end());
     std::string password(password_vec.begin(), password_vec.end());
+    // Usernames name directories under server/, so they follow the filename rules
+    AuthResult result = validFilename(username) ? auth_manager->register_user(username, password)
+                                                : AuthResult::Failed;
 
-    std::optional<std::string> token = auth_manager->login(username, password);
-    if (token == std::nullopt) {
-        std::string err("Login failed");
-        Network::send_string(client_fd, err, "login_feedback");
+    std::string message = result == AuthResult::Ok ? "User Created"
+                        : result == AuthResult::Busy ? "Server busy"
+                        : "Create user failed";
+    if (Network::send_string(conn, message, "create_user_feedback") != 0) {
+        LOG_ERRNO("send feedback failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+int Server::handleLogin(Connection& conn) {
+    std::vector<char> username_vec;
+    if (Network::recv_bytes(conn, username_vec, "username") != 0) {
+        LOG_ERRNO("failed to receive username");
+        return -1;
+    }
+
+    std::vector<char> password_vec;
+    if (Network::recv_bytes(conn, password_vec, "password") != 0) {
+        LOG_ERRNO("failed to receive password");
         return -1;
     }
 
+    std::string username(username_vec.begin(), username_vec.end());
+    std::string password(password_vec.begin(), password_vec.end());
+
+    std::string token;
+    AuthResult result = auth_manager->login(username, password, token);
+    if (result != AuthResult::Ok) {
+        // No token follows a failed login; the session stays usable
+        std::string err(result == AuthResult::Busy ? "Server busy" : "Login failed");
+        return Network::send_string(conn, err, "login_feedback");
+    }
+
     // Send feedback
     std::string ok_msg("Login successful");
-    if (Network::send_string(client_fd, ok_msg, "login_feedback") != 0) {
-        perror("send login feedback failed");
+    if (Network::send_string(conn, ok_msg, "login_feedback") != 0) {
+        LOG_ERRNO("send login feedback failed");
         return -1;
     }
 
     // Send token
-    if (Network::send_string(client_fd, token.value(), "token") != 0) {
-        perror("send token failed");
+    if (Network::send_string(conn, token, "token") != 0) {
+        LOG_ERRNO("send token failed");
         return -1;
     }
 
     return 0;
 }
 
-int Server::handleLogout(int client_fd) {
+int Server::handleLogout(Connection& conn) {
     
     if (!auth_manager) {
-        std::cerr << "ERROR: auth_manager is nullptr!" << std::endl;
+        LOG_ERROR("auth_manager is nullptr");
         return -1;
     }
         
     std::string token;
     
-    if (Network::recv_string(client_fd, token, "token") != 0) {
-        perror("failed to receive token");
+    if (Network::recv_string(conn, token, "token") != 0) {
+        LOG_ERRNO("failed to receive token");
         return -1;
     }
 
     auth_manager->logout(token);
         
     std::string message("Logged out successfully");
-    Network::send_string(client_fd, message, "logout_feedback");
-        
-    return 0;
+    return Network::send_string(conn, message, "logout_feedback");
 }
 
-int Server::handleList(int client_fd) {
+int Server::handleList(Connection& conn) {
     std::string token;
-    if (Network::recv_string(client_fd, token, "token") != 0) {
-        perror("recv token failed");
+    if (Network::recv_string(conn, token, "token") != 0) {
+        LOG_ERRNO("recv token failed");
         return -1;
     }
 
     std::string username;
-    try {
-        username = auth_manager->username_from_token(token);
-    } catch (...) {
+    if (!userFromToken(token, username)) {
         // Invalid token: send zero count
         uint32_t zero = htonl(0u);
-        Network::send_raw(client_fd, &zero, sizeof(zero));
-        return -1;
+        return Network::send_raw(conn, &zero, sizeof(zero));
     }
 
-    std::string user_dir = "server/" + username;
     std::vector<std::string> files;
-    if (std::filesystem::exists(user_dir)) {
-        for (const auto& entry : std::filesystem::directory_iterator(user_dir)) {
-            if (entry.is_regular_file()) {
-                files.push_back(entry.path().filename().string());
-            }
+    if (!listFiles(username, files))
+        files.clear();
+
+    // Same bytes as a count followed by one send_string per name, but built
+    // in one buffer so the whole listing goes out in a handful of writes
+    std::vector<char> reply;
+    Protocol::Writer out(reply);
+    out.put_u32(static_cast<uint32_t>(files.size()));
+    for (const auto& name : files)
+        out.put_string(name);
+
+    if (Network::send_raw(conn, reply.data(), reply.size()) != 0) {
+        LOG_ERRNO("send file list failed");
+        return -1;
+    }
+    return 0;
+}
+
+// mtrc: counters and latency percentiles as text, the same data the
+// Prometheus endpoint serves
+int Server::handleMetrics(Connection& conn) {
+    sampleGauges();
+    return Network::send_string(conn, Metrics::summary(), "metrics");
+}
+
+// v2 dispatch: every request frame gets exactly one response frame with the
+// same request id. Failures travel in the status, so the stream stays usable.
+int Server::handleFrame(Connection& conn, const Protocol::Frame& request) {
+    Protocol::Frame response;
+    response.opcode = request.opcode;
+    response.flags = Protocol::FLAG_RESPONSE;
+    response.request_id = request.request_id;
+
+    Protocol::Reader in(request.payload);
+    Protocol::Writer out(response.payload);
+    switch (request.opcode) {
+        case Protocol::Opcode::Ping:
+            response.payload = request.payload;
+            response.status = Protocol::Status::Ok;
+            break;
+        case Protocol::Opcode::CreateUser:   response.status = frameCreateUser(in, out); break;
+        case Protocol::Opcode::Login:        response.status = frameLogin(in, out); break;
+        case Protocol::Opcode::Logout:       response.status = frameLogout(in, out); break;
+        case Protocol::Opcode::List:         response.status = frameList(in, out); break;
+        case Protocol::Opcode::UploadStatus: response.status = frameUploadStatus(in, out); break;
+        case Protocol::Opcode::Get:          response.status = frameGet(in, out); break;
+        case Protocol::Opcode::Put:          response.status = framePut(in, out); break;
+        case Protocol::Opcode::PutMany:      response.status = framePutMany(in, out); break;
+        case Protocol::Opcode::GetMany:      response.status = frameGetMany(in, out); break;
+        case Protocol::Opcode::PutByHash:    response.status = framePutByHash(in, out); break;
+        case Protocol::Opcode::Delete:       response.status = frameDelete(in, out); break;
+        default:
+            LOG_WARN("Unknown opcode: {}", (int)request.opcode);
+            response.status = Protocol::Status::BadRequest;
+            break;
+    }
+
+    if (response.status != Protocol::Status::Ok)
+        response.payload.clear();
+    return Protocol::send_frame(conn, response);
+}
+
+Protocol::Status Server::frameCreateUser(Protocol::Reader& in, Protocol::Writer&) {
+    std::string username = in.get_string();
+    std::string password = in.get_string();
+    if (!in.ok() || !validFilename(username))
+        return Protocol::Status::BadRequest;
+
+    switch (auth_manager->register_user(username, password)) {
+        case AuthResult::Ok:   return Protocol::Status::Ok;
+        case AuthResult::Busy: return Protocol::Status::Busy;
+        default:               return Protocol::Status::Error;
+    }
+}
+
+Protocol::Status Server::frameLogin(Protocol::Reader& in, Protocol::Writer& out) {
+    std::string username = in.get_string();
+    std::string password = in.get_string();
+    if (!in.ok())
+        return Protocol::Status::BadRequest;
+
+    std::string token;
+    switch (auth_manager->login(username, password, token)) {
+        case AuthResult::Ok:
+            out.put_string(token);
+            return Protocol::Status::Ok;
+        case AuthResult::Busy:
+            return Protocol::Status::Busy;
+        default:
+            return Protocol::Status::Unauthorized;
+    }
+}
+
+Protocol::Status Server::frameLogout(Protocol::Reader& in, Protocol::Writer&) {
+    std::string token = in.get_string();
+    if (!in.ok())
+        return Protocol::Status::BadRequest;
+    auth_manager->logout(token);
+    return Protocol::Status::Ok;
+}
+
+Protocol::Status Server::frameList(Protocol::Reader& in, Protocol::Writer& out) {
+    std::string token = in.get_string();
+    if (!in.ok())
+        return Protocol::Status::BadRequest;
+    std::string username;
+    if (!userFromToken(token, username))
+        return Protocol::Status::Unauthorized;
+
+    // Older clients send the token alone and get the first page in name order
+    FileCatalog::Query query;
+    uint8_t flags = 0;
+    if (in.remaining() > 0) {
+        query.prefix = in.get_string();
+        uint8_t sort = in.get_u8();
+        query.descending = in.get_u8() != 0;
+        query.limit = in.get_u32();
+        query.cursor = in.get_string();
+        if (in.remaining() > 0)
+            flags = in.get_u8();
+        if (!in.ok() || sort > (uint8_t)Protocol::ListSort::Mtime)
+            return Protocol::Status::BadRequest;
+        query.sort = (FileCatalog::Sort)sort;
+    }
+
+    std::vector<FileCatalog::Entry> entries;
+    std::string next;
+    if (!catalog->list(username, query, entries, next))
+        return Protocol::Status::BadRequest;
+
+    out.put_u32((uint32_t)entries.size());
+    if (flags & Protocol::LIST_COMPACT) {
+        Protocol::ListWriter list(out, (flags & Protocol::LIST_HASHES) != 0);
+        for (const FileCatalog::Entry& entry : entries)
+            list.add(entry.name, entry.size, entry.mtime, entry.hash);
+    } else {
+        for (const FileCatalog::Entry& entry : entries) {
+            out.put_string(entry.name);
+            out.put_u64(entry.size);
+            out.put_u64((uint64_t)entry.mtime);
+            out.put_string(entry.hash);
         }
     }
+    out.put_string(next);
+    return Protocol::Status::Ok;
+}
 
-    uint32_t count_net = htonl(static_cast<uint32_t>(files.size()));
-    if (Network::send_raw(client_fd, &count_net, sizeof(count_net)) == -1) {
-        perror("send file count failed");
-        return -1;
+Protocol::Status Server::frameDelete(Protocol::Reader& in, Protocol::Writer&) {
+    std::string token = in.get_string();
+    std::string filename = in.get_string();
+    if (!in.ok() || !validFilename(filename))
+        return Protocol::Status::BadRequest;
+    std::string username;
+    if (!userFromToken(token, username))
+        return Protocol::Status::Unauthorized;
+
+    FileCatalog::RemoveResult result = catalog->remove(username, filename, userDir(username) + "/" + filename);
+    object_cache->invalidate(username + "/" + filename);
+    switch (result) {
+        case FileCatalog::RemoveResult::Ok:       return Protocol::Status::Ok;
+        case FileCatalog::RemoveResult::NotFound: return Protocol::Status::NotFound;
+        case FileCatalog::RemoveResult::Failed:   break;
+    }
+    return Protocol::Status::Error;
+}
+
+Protocol::Status Server::frameUploadStatus(Protocol::Reader& in, Protocol::Writer& out) {
+    std::string token = in.get_string();
+    std::string filename = in.get_string();
+    if (!in.ok() || !validFilename(filename))
+        return Protocol::Status::BadRequest;
+    std::string username;
+    if (!userFromToken(token, username))
+        return Protocol::Status::Unauthorized;
+
+    out.put_u64(partialSize(username, filename));
+    return Protocol::Status::Ok;
+}
+
+// Append "u64 size, data" for one stored file, if it fits in budget bytes.
+// Nothing is appended unless the whole file made it in.
+Protocol::Status Server::appendFile(const std::string& username, const std::string& filename,
+                                    Protocol::Writer& out, uint64_t budget) {
+    if (ObjectCache::Ref cached = cachedFile(username, filename)) {
+        if (budget < sizeof(uint64_t) || cached->data.size() > budget - sizeof(uint64_t))
+            return Protocol::Status::TooLarge;
+        out.put_u64((uint64_t)cached->data.size());
+        memcpy(out.extend(cached->data.size()), cached->data.data(), cached->data.size());
+        return Protocol::Status::Ok;
+    }
+
+    std::string filepath = userDir(username) + "/" + filename;
+    int file_fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file_fd == -1)
+        return Protocol::Status::NotFound;
+
+    struct stat st;
+    if (fstat(file_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(file_fd);
+        return Protocol::Status::NotFound;
+    }
+    uint64_t filesize = (uint64_t)st.st_size;
+    if (budget < sizeof(uint64_t) || filesize > budget - sizeof(uint64_t)) {
+        close(file_fd);
+        return Protocol::Status::TooLarge;
     }
 
-    for (const auto& name : files) {
-        if (Network::send_string(client_fd, name, "filename") != 0) {
-            perror("send filename failed");
-            return -1;
+    size_t start = out.size();
+    out.put_u64(filesize);
+    char* data = out.extend((size_t)filesize);
+    uint64_t done = 0;
+    while (done < filesize) {
+        ssize_t r = pread(file_fd, data + done, (size_t)(filesize - done), (off_t)done);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r <= 0) {
+            LOG_ERRNO("read failed");
+            close(file_fd);
+            out.truncate(start);
+            return Protocol::Status::Error;
         }
+        done += (uint64_t)r;
     }
-    return 0;
+    close(file_fd);
+    return Protocol::Status::Ok;
+}
+
+// Store a file received whole: one write into the partial file, then commit
+Protocol::Status Server::storeFile(const std::string& username, const std::string& filename,
+                                   const char* data, size_t size) {
+    int file_fd = open(partPath(username, filename).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file_fd == -1) {
+        LOG_ERRNO("Could not open output file for writing");
+        return Protocol::Status::Error;
+    }
+    size_t written = 0;
+    while (written < size) {
+        ssize_t w = pwrite(file_fd, data + written, size - written, (off_t)written);
+        if (w == -1 && errno == EINTR)
+            continue;
+        if (w <= 0) {
+            LOG_ERRNO("write failed");
+            close(file_fd);
+            return Protocol::Status::Error;
+        }
+        written += (size_t)w;
+    }
+    close(file_fd);
+
+    return commitUpload(username, filename) == 0 ? Protocol::Status::Ok : Protocol::Status::Error;
+}
+
+// Whole small file in one response; larger files use the streaming commands
+Protocol::Status Server::frameGet(Protocol::Reader& in, Protocol::Writer& out) {
+    std::string token = in.get_string();
+    std::string filename = in.get_string();
+    if (!in.ok() || !validFilename(filename))
+        return Protocol::Status::BadRequest;
+    std::string username;
+    if (!userFromToken(token, username))
+        return Protocol::Status::Unauthorized;
+
+    return appendFile(username, filename, out, Protocol::MAX_PAYLOAD);
+}
+
+// Whole small file in one request, staged and committed like any upload
+Protocol::Status Server::framePut(Protocol::Reader& in, Protocol::Writer&) {
+    std::string token = in.get_string();
+    std::string filename = in.get_string();
+    if (!in.ok() || !validFilename(filename))
+        return Protocol::Status::BadRequest;
+    std::string username;
+    if (!userFromToken(token, username))
+        return Protocol::Status::Unauthorized;
+
+    size_t size = 0;
+    const char* data = in.rest(size);
+
+    std::error_code ec;
+    std::filesystem::create_directories(userDir(username), ec);
+    if (ec) {
+        LOG_ERROR("Failed to create user directory: {}", ec.message());
+        return Protocol::Status::Error;
+    }
+    return storeFile(username, filename, data, size);
+}
+
+// Many small files in one request: one token lookup, one write per file, and
+// a status per file in the response
+Protocol::Status Server::framePutMany(Protocol::Reader& in, Protocol::Writer& out) {
+    std::string token = in.get_string();
+    uint32_t count = in.get_u32();
+
+    struct Entry {
+        std::string filename;
+        const char* data;
+        size_t size;
+    };
+    std::vector<Entry> entries;
+    for (uint32_t i = 0; i < count && in.ok(); ++i) {
+        Entry entry;
+        entry.filename = in.get_string();
+        entry.size = (size_t)in.get_u64();
+        entry.data = in.get_bytes(entry.size);
+        entries.push_back(std::move(entry));
+    }
+    // Parse everything before writing anything, so a malformed batch stores nothing
+    if (!in.ok())
+        return Protocol::Status::BadRequest;
+
+    std::string username;
+    if (!userFromToken(token, username))
+        return Protocol::Status::Unauthorized;
+
+    std::error_code ec;
+    std::filesystem::create_directories(userDir(username), ec);
+    if (ec) {
+        LOG_ERROR("Failed to create user directory: {}", ec.message());
+        return Protocol::Status::Error;
+    }
+
+    out.put_u32((uint32_t)entries.size());
+    for (const Entry& entry : entries) {
+        Protocol::Status status = validFilename(entry.filename)
+            ? storeFile(username, entry.filename, entry.data, entry.size)
+            : Protocol::Status::BadRequest;
+        out.put_u16((uint16_t)status);
+    }
+    return Protocol::Status::Ok;
+}
+
+// Many small files in one response. Files that do not fit in what is left of
+// the frame come back Deferred so the client can ask for them again.
+Protocol::Status Server::frameGetMany(Protocol::Reader& in, Protocol::Writer& out) {
+    std::string token = in.get_string();
+    uint32_t count = in.get_u32();
+    std::vector<std::string> names;
+    for (uint32_t i = 0; i < count && in.ok(); ++i)
+        names.push_back(in.get_string());
+    if (!in.ok())
+        return Protocol::Status::BadRequest;
+
+    std::string username;
+    if (!userFromToken(token, username))
+        return Protocol::Status::Unauthorized;
+
+    if (sizeof(uint32_t) + names.size() * sizeof(uint16_t) > Protocol::MAX_PAYLOAD)
+        return Protocol::Status::TooLarge;
+
+    // Largest file a single-name request could return
+    const uint64_t alone_limit = Protocol::MAX_PAYLOAD - sizeof(uint32_t) - sizeof(uint16_t) - sizeof(uint64_t);
+
+    out.put_u32((uint32_t)names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+        const std::string& filename = names[i];
+        if (!validFilename(filename)) {
+            out.put_u16((uint16_t)Protocol::Status::BadRequest);
+            continue;
+        }
+        size_t status_at = out.size();
+        out.put_u16((uint16_t)Protocol::Status::Ok);
+
+        // Leave room for the status of every entry still to come
+        uint64_t used = out.size() + (names.size() - i - 1) * sizeof(uint16_t);
+        uint64_t budget = Protocol::MAX_PAYLOAD > used ? Protocol::MAX_PAYLOAD - used : 0;
+        Protocol::Status status = appendFile(username, filename, out, budget);
+
+        if (status == Protocol::Status::TooLarge) {
+            struct stat st;
+            std::string filepath = userDir(username) + "/" + filename;
+            if (stat(filepath.c_str(), &st) == 0 && (uint64_t)st.st_size <= alone_limit)
+                status = Protocol::Status::Deferred;
+        }
+        if (status != Protocol::Status::Ok) {
+            out.truncate(status_at);
+            out.put_u16((uint16_t)status);
+        }
+    }
+    return Protocol::Status::Ok;
+}
+
+// Deduplicated upload: when the user already stores the content under another
+// name, publish it under the new one and skip the transfer. NotFound tells the
+// client to upload; identical content from other users is still shared by
+// BlobStore::adopt once the upload lands.
+Protocol::Status Server::framePutByHash(Protocol::Reader& in, Protocol::Writer&) {
+    std::string token = in.get_string();
+    std::string filename = in.get_string();
+    std::string hex = in.get_string();
+    uint64_t size = in.get_u64();
+    if (!in.ok() || !validFilename(filename) || !ContentHash::valid_hex(hex))
+        return Protocol::Status::BadRequest;
+    std::string username;
+    if (!userFromToken(token, username))
+        return Protocol::Status::Unauthorized;
+
+    std::error_code ec;
+    std::filesystem::create_directories(userDir(username), ec);
+    if (ec) {
+        LOG_ERROR("Failed to create user directory: {}", ec.message());
+        return Protocol::Status::Error;
+    }
+
+    std::string final_path = userDir(username) + "/" + filename;
+    if (!blob_store->link_existing(hex, size, username, filename, final_path))
+        return Protocol::Status::NotFound;
+    object_cache->invalidate(username + "/" + filename);
+    LOG_INFO("Deduplicated upload for user '{}': {} ({} bytes)", username, filename, size);
+    return Protocol::Status::Ok;
 }
@@ -1,35 +1,158 @@
 #pragma once
 
+#include <atomic>
 #include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <ctime>
+#include <cstdint>
+#include <sys/stat.h>
 #include "../common/Network.h"
+#include "../common/Protocol.h"
+#include "ObjectCache.h"
 
 // Forward declarations
 class ThreadPool;
 class Database;
 class AuthManager;
+class BlobStore;
+class FileCatalog;
+class MappedFiles;
+class MetricsExporter;
 
 class Server {
 private:
+    // A client connection owned by the reactor. While a worker runs one of its
+    // commands the session is Busy and its fd is disarmed in epoll.
+    struct Session {
+        enum class State { Handshake, Idle, Busy };
+
+        Connection conn;
+        State state = State::Handshake;
+        time_t last_active = 0;
+        uint64_t accepted_us = 0;   // for the TLS handshake histogram
+    };
+
     int server_fd;
     int port;
-    bool running;
+    std::atomic<bool> running;   // cleared by stop(), possibly from a signal handler
     bool tls_ready;              // TLS context initialized flag
     
     ThreadPool* thread_pool;
+    size_t hash_threads;         // Argon2 admission, capped by the pool size
+    size_t hash_queue;
     Database* db;
     AuthManager* auth_manager;
+    BlobStore* blob_store;       // deduplicating storage behind every committed upload
+    FileCatalog* catalog;        // indexed name/size/mtime/hash of every stored file
+    ObjectCache* object_cache;   // hot files served from memory
+    MappedFiles* mapped_files;   // large files shared by concurrent TLS downloads
+    MetricsExporter* metrics_exporter;   // Prometheus text on a loopback port
+
+    // Reactor state, owned by the thread in run()
+    int epoll_fd;
+    int wake_fd;                 // eventfd: workers hand sessions back through it
+    std::unordered_map<int, std::unique_ptr<Session>> sessions;
+
+    std::mutex handback_mutex;
+    std::vector<std::pair<int, bool>> handbacks;   // (fd, keep session open)
+
+    // Parallel uploads in flight, keyed by "<user>/<filename>". Verified
+    // stripes are kept as merged [begin, end) ranges, so a re-sent stripe
+    // can't stand in for a missing one. Stripes land in their own staging
+    // file, never in the .part that stat and sndr resume from.
+    struct StripedUpload {
+        uint64_t transfer_id = 0;
+        uint64_t total = 0;
+        std::string path;                      // staging file
+        std::map<uint64_t, uint64_t> ranges;   // begin -> end
+        int receiving = 0;                     // stripes still streaming
+        time_t last_active = 0;
+
+        void add(uint64_t begin, uint64_t end);
+        bool covered() const;
+    };
+    std::mutex stripe_mutex;
+    std::unordered_map<std::string, StripedUpload> striped_uploads;
+
+    // Reactor helpers
+    void acceptConnections();
+    void handleSessionEvent(int fd, uint32_t events);
+    void processHandbacks();
+    void sweepIdleSessions();
+    void sweepStripedUploads();
+    void dropStripedUpload(const std::string& key, uint64_t transfer_id);
+    void logHashStats();
+    void logCacheStats();
+    void sampleGauges();
+    bool armSession(int fd, uint32_t events);
+    void closeSession(int fd);
 
     // Private helper methods
-    void handleClient(int client_fd);
-    void handleCommand(int client_fd, const char* command);
+    void serveSession(Session* session);   // runs on a worker thread
+    void handBack(int fd, bool keep);
+    int handleCommand(Connection& conn, const char* command);   // non-zero ends the session
+    int handleFrame(Connection& conn, const Protocol::Frame& request);   // protocol v2
     
+    // Upload/download helpers
+    bool userFromToken(const std::string& token, std::string& username);
+    bool recvUser(Connection& conn, std::string& username);        // token -> username
+    bool recvFilename(Connection& conn, std::string& filename);    // validated single path component
+    static bool validFilename(const std::string& filename);
+    static std::string userDir(const std::string& username);
+    static std::string partPath(const std::string& username, const std::string& filename);
+    static std::string stripePath(const std::string& username, const std::string& filename);
+    static uint64_t partialSize(const std::string& username, const std::string& filename);
+    bool listFiles(const std::string& username, std::vector<std::string>& names);
+    size_t importUntrackedFiles();
+    uint64_t receiveInto(Connection& conn, int file_fd, uint64_t offset, uint64_t count, uint32_t* crc = nullptr);
+    int commitUpload(const std::string& username, const std::string& filename);
+    ObjectCache::Ref cachedFile(const std::string& username, const std::string& filename);
+    bool fileChecksum(int file_fd, const std::string& username, const std::string& filename,
+                      uint64_t offset, uint64_t length, uint64_t filesize, uint32_t& crc);
+    static bool checksumMatches(Connection& conn, const std::string& filename, uint32_t crc, bool& matched);
+    int sendFileData(Connection& conn, int file_fd, const struct stat& st, uint64_t offset, uint64_t length,
+                     const std::string& username, const std::string& filename);
+    static bool copyRange(int from_fd, uint64_t from, int to_fd, uint64_t to, uint64_t length);
+
     // Command handlers
-    int handleGetFile(int client_fd);
-    int handleSendFile(int client_fd);
-    int handleCreateUser(int client_fd);
-    int handleLogin(int client_fd);
-    int handleLogout(int client_fd);
-    int handleList(int client_fd);
+    int handleGetFile(Connection& conn);
+    int handleSendFile(Connection& conn);
+    int handleUploadStatus(Connection& conn);
+    int handleResumeUpload(Connection& conn);
+    int handleRangeDownload(Connection& conn);
+    int handleStripeUpload(Connection& conn);
+    int handleFinishStripes(Connection& conn);
+    int handleCompressedUpload(Connection& conn);
+    int handleCompressedDownload(Connection& conn);
+    int handleDeltaSignatures(Connection& conn);
+    int handleDeltaUpload(Connection& conn);
+    int handleCreateUser(Connection& conn);
+    int handleLogin(Connection& conn);
+    int handleLogout(Connection& conn);
+    int handleList(Connection& conn);
+    int handleMetrics(Connection& conn);
+
+    // Protocol v2 handlers: parse the request payload, fill the response payload
+    Protocol::Status frameCreateUser(Protocol::Reader& in, Protocol::Writer& out);
+    Protocol::Status frameLogin(Protocol::Reader& in, Protocol::Writer& out);
+    Protocol::Status frameLogout(Protocol::Reader& in, Protocol::Writer& out);
+    Protocol::Status frameList(Protocol::Reader& in, Protocol::Writer& out);
+    Protocol::Status frameUploadStatus(Protocol::Reader& in, Protocol::Writer& out);
+    Protocol::Status frameGet(Protocol::Reader& in, Protocol::Writer& out);
+    Protocol::Status framePut(Protocol::Reader& in, Protocol::Writer& out);
+    Protocol::Status framePutMany(Protocol::Reader& in, Protocol::Writer& out);
+    Protocol::Status frameGetMany(Protocol::Reader& in, Protocol::Writer& out);
+    Protocol::Status framePutByHash(Protocol::Reader& in, Protocol::Writer& out);
+    Protocol::Status frameDelete(Protocol::Reader& in, Protocol::Writer& out);
+    Protocol::Status appendFile(const std::string& username, const std::string& filename,
+                                Protocol::Writer& out, uint64_t budget);
+    Protocol::Status storeFile(const std::string& username, const std::string& filename,
+                               const char* data, size_t size);
 
     bool setupTLS();             // initialize TLS (calls Network::init_server_tls)
 
@@ -37,7 +160,10 @@ public:
     Server(int port = 8080, int num_threads = 4);
     ~Server();
 
+    // FILESERVER_WORKERS overrides the default of 4 connection workers
+    static int workers_from_env();
+
     bool initialize();
     void run();
-    void stop();
+    void stop();                 // async-signal-safe; run() returns and finishes the shutdown
 };
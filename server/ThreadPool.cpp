@@ -1,40 +1,138 @@
 #include "ThreadPool.h"
 
-ThreadPool::ThreadPool(int num_threads) {
-    for (int i = 0; i < num_threads; ++i) {
-        threads.emplace_back([this]() {
-            while (true) {
-                std::unique_lock<std::mutex> lock(mtx);
-                cv.wait(lock, [this]() { return !tasks.empty() || stop; });
-                
-                if (stop && tasks.empty()) break;
-                
-                auto task = tasks.front();
-                tasks.pop();
-                lock.unlock();
-                
-                task();
-            }
-        });
-    }
-}
+#include "../common/Metrics.h"
 
-void ThreadPool::submit(std::function<void()> task) {
-    {
-        std::lock_guard<std::mutex> lock(mtx);
-        tasks.push(task);
-    }
-    cv.notify_one();
+namespace {
+    // Index of the pool worker running on this thread, or SIZE_MAX for outsiders
+    thread_local const void* t_pool = nullptr;
+    thread_local size_t t_index = SIZE_MAX;
 }
 
+ThreadPool::ThreadPool(int num_threads, size_t capacity)
+    : capacity(capacity ? capacity : 1)
+{
+    if (num_threads < 1)
+        num_threads = 1;
+    for (int i = 0; i < num_threads; ++i)
+        workers.push_back(std::make_unique<Worker>());
+    for (int i = 0; i < num_threads; ++i)
+        threads.emplace_back([this, i]() { worker_loop((size_t)i); });
+}
 
 ThreadPool::~ThreadPool() {
     {
-        std::lock_guard<std::mutex> lock(mtx);
+        std::lock_guard<std::mutex> lock(sleep_mtx);
         stop = true;
     }
-    cv.notify_all();
+    work_cv.notify_all();
+    space_cv.notify_all();
     for (auto& t : threads) {
         t.join();
     }
-}
\ No newline at end of file
+}
+
+// Claim a queue slot without any lock
+bool ThreadPool::reserve() {
+    size_t n = queued.load();
+    while (n < capacity) {
+        if (queued.compare_exchange_weak(n, n + 1))
+            return true;
+    }
+    return false;
+}
+
+void ThreadPool::push(Task&& task) {
+    size_t target;
+    if (t_pool == this)
+        target = t_index;   // keep follow-up work on the submitting worker
+    else
+        target = next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+
+    {
+        std::lock_guard<std::mutex> lock(workers[target]->mtx);
+        workers[target]->tasks.push_back(std::move(task));
+    }
+    // queued was raised before this load and a sleeper registers before it
+    // checks queued (both seq_cst), so one of the two sides sees the other.
+    // The lock orders the wake-up after the sleeper's predicate check.
+    if (sleepers.load() > 0) {
+        { std::lock_guard<std::mutex> lock(sleep_mtx); }
+        work_cv.notify_one();
+    }
+}
+
+void ThreadPool::submit(Task task) {
+    if (stop)
+        return;
+    if (!reserve()) {
+        std::unique_lock<std::mutex> lock(sleep_mtx);
+        ++space_waiters;
+        space_cv.wait(lock, [this]() { return stop || reserve(); });
+        --space_waiters;
+        if (stop)
+            return;
+    }
+    push(std::move(task));
+}
+
+bool ThreadPool::try_submit(Task task) {
+    if (stop || !reserve())
+        return false;
+    push(std::move(task));
+    return true;
+}
+
+bool ThreadPool::pop_local(size_t index, Task& task) {
+    Worker& w = *workers[index];
+    std::lock_guard<std::mutex> lock(w.mtx);
+    if (w.tasks.empty())
+        return false;
+    task = std::move(w.tasks.front());
+    w.tasks.pop_front();
+    return true;
+}
+
+// Take from the opposite end of a victim's deque than its owner does
+bool ThreadPool::steal(size_t thief, Task& task) {
+    for (size_t i = 1; i < workers.size(); ++i) {
+        Worker& victim = *workers[(thief + i) % workers.size()];
+        std::unique_lock<std::mutex> lock(victim.mtx, std::try_to_lock);
+        if (!lock.owns_lock() || victim.tasks.empty())
+            continue;
+        task = std::move(victim.tasks.back());
+        victim.tasks.pop_back();
+        steals.fetch_add(1, std::memory_order_relaxed);
+        Metrics::add(Metrics::Counter::PoolSteals);
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::worker_loop(size_t index) {
+    t_pool = this;
+    t_index = index;
+
+    while (true) {
+        Task task;
+        if (pop_local(index, task) || steal(index, task)) {
+            queued.fetch_sub(1);
+            if (space_waiters.load() > 0) {
+                { std::lock_guard<std::mutex> lock(sleep_mtx); }
+                space_cv.notify_one();
+            }
+            task();
+            completed.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mtx);
+        if (stop && queued.load() == 0)
+            break;
+        ++sleepers;
+        // A try_lock steal may have skipped a busy deque; the timeout bounds that miss
+        work_cv.wait_for(lock, std::chrono::milliseconds(50), [this]() { return stop || queued.load() > 0; });
+        --sleepers;
+        if (stop && queued.load() == 0)
+            break;
+    }
+}
@@ -1,21 +1,152 @@
 #pragma once
 
 #include <thread>
-#include <queue>
+#include <deque>
 #include <mutex>
 #include <condition_variable>
-#include <functional>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#include <cstddef>
+#include <cstdint>
 
+// Move-only type-erased callable. Callables up to INLINE_SIZE bytes are stored
+// inside the Task itself, so submitting a typical lambda never allocates.
+class Task {
+public:
+    static constexpr size_t INLINE_SIZE = 48;
+
+    Task() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+    Task(F&& fn) {
+        using Fn = std::decay_t<F>;
+        if constexpr (fits_inline<Fn>()) {
+            new (&storage) Fn(std::forward<F>(fn));
+            ops = &inline_ops<Fn>;
+        } else {
+            *reinterpret_cast<Fn**>(&storage) = new Fn(std::forward<F>(fn));
+            ops = &heap_ops<Fn>;
+        }
+    }
+
+    Task(Task&& other) noexcept : ops(other.ops) {
+        if (ops) {
+            ops->move(&storage, &other.storage);
+            other.ops = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            ops = other.ops;
+            if (ops) {
+                ops->move(&storage, &other.storage);
+                other.ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    void operator()() { ops->invoke(&storage); }
+    explicit operator bool() const { return ops != nullptr; }
+
+private:
+    struct Ops {
+        void (*invoke)(void*);
+        void (*move)(void* dst, void* src);   // move-construct into dst, destroy src
+        void (*destroy)(void*);
+    };
+
+    template <typename Fn>
+    static constexpr bool fits_inline() {
+        return sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible_v<Fn>;
+    }
+
+    template <typename Fn>
+    static constexpr Ops inline_ops = {
+        [](void* p) { (*static_cast<Fn*>(p))(); },
+        [](void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        },
+        [](void* p) { static_cast<Fn*>(p)->~Fn(); },
+    };
+
+    template <typename Fn>
+    static constexpr Ops heap_ops = {
+        [](void* p) { (**static_cast<Fn**>(p))(); },
+        [](void* dst, void* src) { *static_cast<Fn**>(dst) = *static_cast<Fn**>(src); },
+        [](void* p) { delete *static_cast<Fn**>(p); },
+    };
+
+    void reset() {
+        if (ops) {
+            ops->destroy(&storage);
+            ops = nullptr;
+        }
+    }
+
+    const Ops* ops = nullptr;
+    alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+};
+
+// Work-stealing pool: every worker owns a deque. Tasks submitted from a worker
+// go to its own deque; outside submissions are spread round-robin. An idle
+// worker steals from the others before going to sleep. The total number of
+// queued tasks is bounded: submit() blocks once the pool is full, try_submit()
+// refuses instead.
 class ThreadPool {
+    struct Worker {
+        std::mutex mtx;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
     std::vector<std::thread> threads;
-    std::queue<std::function<void()>> tasks;
-    std::mutex mtx;
-    std::condition_variable cv;
-    bool stop = false;
+
+    // Only sleepers and blocked submitters touch sleep_mtx; the counts below
+    // let the common path (someone awake, room in the pool) skip it entirely
+    std::mutex sleep_mtx;
+    std::condition_variable work_cv;    // workers wait for tasks
+    std::condition_variable space_cv;   // submitters wait for room
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> sleepers{0};
+    std::atomic<size_t> space_waiters{0};
+
+    size_t capacity;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> next_worker{0};
+    std::atomic<uint64_t> steals{0};
+    std::atomic<uint64_t> completed{0};
+
+    void worker_loop(size_t index);
+    bool pop_local(size_t index, Task& task);
+    bool steal(size_t thief, Task& task);
+    bool reserve();
+    void push(Task&& task);
 
 public:
-    ThreadPool(int num_threads);
-    void submit(std::function<void()> task);
+    static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+    ThreadPool(int num_threads, size_t capacity = DEFAULT_CAPACITY);
     ~ThreadPool();
-};
\ No newline at end of file
+
+    void submit(Task task);        // blocks while the pool is at capacity
+    bool try_submit(Task task);    // false if the pool is at capacity
+
+    size_t queue_depth() const { return queued.load(std::memory_order_relaxed); }
+    uint64_t steal_count() const { return steals.load(std::memory_order_relaxed); }
+    uint64_t completed_count() const { return completed.load(std::memory_order_relaxed); }
+    size_t size() const { return threads.size(); }
+};
@@ -1,31 +1,46 @@
 #include "Server.h"
-#include <iostream>
+#include "../common/BufferPool.h"
+#include "../common/DiskWriter.h"
+#include "../common/ReadAhead.h"
+#include "../common/Log.h"
+#include <unistd.h>
 #include <csignal>
 
 Server* g_server = nullptr;
+volatile sig_atomic_t g_signal = 0;
 
+// Async-signal-safe only: the reactor does the actual shutdown once run()
+// sees the flag. A second signal, or one before the server runs, exits at once.
 void signalHandler(int signum) {
-    std::cout << "\nInterrupt signal (" << signum << ") received. Shutting down...\n";
-    if (g_server) {
-        g_server->stop();
-    }
-    exit(signum);
+    if (g_signal || !g_server)
+        _exit(128 + signum);
+    g_signal = signum;
+    g_server->stop();
 }
 
 int main() {
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    signal(SIGPIPE, SIG_IGN);  // a client vanishing mid-write must not kill the server
 
-    Server server(8080, 4);
-    g_server = &server;
+    Log::set_level(Log::level_from_env());
 
+    // Transfer chunk size: 1 MiB unless FILESERVER_CHUNK_SIZE says otherwise
+    BufferPool::instance().configure(BufferPool::chunk_size_from_env());
+    DiskWriter::set_defaults(DiskWriter::options_from_env());
+    ReadAhead::set_defaults(ReadAhead::options_from_env());
+
+    Server server(8080, Server::workers_from_env());
     if (!server.initialize()) {
-        std::cerr << "Failed to initialize server\n";
+        LOG_ERROR("Failed to initialize server");
         return 1;
     }
+    g_server = &server;
 
-    std::cout << "File Server starting...\n";
+    LOG_INFO("File Server starting...");
     server.run();
+    if (g_signal)
+        LOG_INFO("Stopped by signal {}", (int)g_signal);
 
     return 0;
 }
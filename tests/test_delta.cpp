@@ -0,0 +1,162 @@
+#include "../common/Delta.h"
+#include "Check.h"
+
+#include <sodium.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+    using Bytes = std::vector<unsigned char>;
+
+    Bytes random_bytes(size_t n, uint32_t seed) {
+        std::mt19937 rng(seed);
+        Bytes out(n);
+        for (unsigned char& c : out)
+            c = (unsigned char)rng();
+        return out;
+    }
+
+    std::vector<Delta::BlockSignature> signatures(const Bytes& base, uint32_t block_size) {
+        std::vector<Delta::BlockSignature> sigs;
+        for (size_t pos = 0; pos + block_size <= base.size(); pos += block_size) {
+            Delta::BlockSignature sig;
+            sig.weak = Delta::weak_checksum(base.data() + pos, block_size);
+            Delta::strong_checksum(base.data() + pos, block_size, sig.strong);
+            sigs.push_back(sig);
+        }
+        return sigs;
+    }
+
+    // What the server does with the ops: copies come from the base, literals
+    // from the new data
+    Bytes apply(const Bytes& base, const Bytes& data, uint32_t block_size, const std::vector<Delta::Op>& ops) {
+        Bytes out;
+        for (const Delta::Op& op : ops) {
+            if (op.kind == Delta::OP_COPY) {
+                uint64_t from = op.start * block_size;
+                uint64_t len = op.length * block_size;
+                CHECK(from + len <= base.size());
+                out.insert(out.end(), base.begin() + from, base.begin() + from + len);
+            } else {
+                CHECK(op.kind == Delta::OP_LITERAL);
+                CHECK(op.start + op.length <= data.size());
+                out.insert(out.end(), data.begin() + op.start, data.begin() + op.start + op.length);
+            }
+        }
+        return out;
+    }
+
+    uint64_t literal_bytes(const std::vector<Delta::Op>& ops) {
+        uint64_t n = 0;
+        for (const Delta::Op& op : ops)
+            if (op.kind == Delta::OP_LITERAL)
+                n += op.length;
+        return n;
+    }
+
+    // Rebuild data against base and return how much had to be sent literally
+    uint64_t round_trip(const Bytes& base, const Bytes& data, uint32_t block_size) {
+        std::vector<Delta::Op> ops = Delta::compute(data.data(), data.size(), block_size, signatures(base, block_size));
+        CHECK(apply(base, data, block_size, ops) == data);
+        return literal_bytes(ops);
+    }
+
+    void test_block_size() {
+        CHECK(Delta::block_size_for(0) == 2048);
+        CHECK(Delta::block_size_for(1024 * 1024) == 2048);
+        CHECK(Delta::block_size_for(64ull << 20) == 8192);
+        CHECK(Delta::block_size_for(1ull << 50) == 128 * 1024);
+        for (uint64_t size = 1; size < (1ull << 40); size *= 3) {
+            uint32_t b = Delta::block_size_for(size);
+            CHECK((b & (b - 1)) == 0);
+        }
+    }
+
+    void test_identical() {
+        const uint32_t block = 2048;
+        Bytes base = random_bytes(block * 50 + 100, 1);
+        // Only the partial tail block travels
+        CHECK(round_trip(base, base, block) == 100);
+
+        std::vector<Delta::Op> ops = Delta::compute(base.data(), base.size(), block, signatures(base, block));
+        CHECK(ops.size() == 2);
+        CHECK(ops[0].kind == Delta::OP_COPY && ops[0].start == 0 && ops[0].length == 50);
+    }
+
+    // Matching blocks are found at any byte offset, which needs the rolling
+    // checksum to agree with a fresh one after every step
+    void test_shifted() {
+        const uint32_t block = 2048;
+        Bytes base = random_bytes(block * 40, 2);
+        Bytes data = random_bytes(37, 3);
+        data.insert(data.end(), base.begin(), base.end());
+        CHECK(round_trip(base, data, block) == 37);
+    }
+
+    void test_edits() {
+        const uint32_t block = 2048;
+        Bytes base = random_bytes(block * 64, 4);
+
+        Bytes changed = base;
+        changed[block * 10 + 5] ^= 0xff;                       // one byte in block 10
+        CHECK(round_trip(base, changed, block) == block);
+
+        Bytes cut = base;
+        cut.erase(cut.begin() + block * 20, cut.begin() + block * 22 + 700);
+        CHECK(round_trip(base, cut, block) <= block);
+
+        Bytes moved(base.begin() + block * 32, base.end());   // halves swapped
+        moved.insert(moved.end(), base.begin(), base.begin() + block * 32);
+        CHECK(round_trip(base, moved, block) == 0);
+    }
+
+    void test_no_match() {
+        const uint32_t block = 2048;
+        Bytes base = random_bytes(block * 8, 5);
+        Bytes data = random_bytes(block * 8, 6);
+        CHECK(round_trip(base, data, block) == data.size());
+        CHECK(round_trip(Bytes(), data, block) == data.size());
+        Bytes tiny = random_bytes(block - 1, 7);
+        CHECK(round_trip(base, tiny, block) == tiny.size());
+        CHECK(round_trip(base, Bytes(), block) == 0);
+    }
+
+    // Signatures read from a file cover full blocks only
+    void test_signatures_of_fd() {
+        const uint32_t block = 4096;
+        Bytes base = random_bytes(block * 300 + 17, 8);   // spans several 1 MiB reads
+        char path[] = "/tmp/test_delta.XXXXXX";
+        int fd = mkstemp(path);
+        CHECK(fd != -1);
+        unlink(path);
+        CHECK(write(fd, base.data(), base.size()) == (ssize_t)base.size());
+
+        std::vector<Delta::BlockSignature> from_fd;
+        CHECK(Delta::signatures_of_fd(fd, block, from_fd));
+        close(fd);
+        std::vector<Delta::BlockSignature> expected = signatures(base, block);
+        CHECK(from_fd.size() == 300);
+        CHECK(from_fd.size() == expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            CHECK(from_fd[i].weak == expected[i].weak);
+            CHECK(memcmp(from_fd[i].strong, expected[i].strong, Delta::STRONG_BYTES) == 0);
+        }
+    }
+}
+
+int main() {
+    CHECK(sodium_init() >= 0);
+    test_block_size();
+    test_identical();
+    test_shifted();
+    test_edits();
+    test_no_match();
+    test_signatures_of_fd();
+    std::printf("test_delta: ok\n");
+    return 0;
+}
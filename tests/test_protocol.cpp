@@ -0,0 +1,196 @@
+#include "../common/Protocol.h"
+#include "Check.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+    size_t varint_size(uint64_t value) {
+        std::vector<char> buf;
+        Protocol::Writer(buf).put_varint(value);
+        return buf.size();
+    }
+
+    void test_varint_round_trip() {
+        const uint64_t values[] = {0, 1, 127, 128, 255, 16383, 16384, (1ull << 32) - 1, 1ull << 32,
+                                   (1ull << 63) - 1, 1ull << 63, UINT64_MAX};
+        std::vector<char> buf;
+        Protocol::Writer out(buf);
+        for (uint64_t v : values)
+            out.put_varint(v);
+
+        Protocol::Reader in(buf);
+        for (uint64_t v : values)
+            CHECK(in.get_varint() == v);
+        CHECK(in.ok());
+        CHECK(in.remaining() == 0);
+    }
+
+    // LEB128: 7 bits per byte
+    void test_varint_sizes() {
+        CHECK(varint_size(0) == 1);
+        CHECK(varint_size(127) == 1);
+        CHECK(varint_size(128) == 2);
+        CHECK(varint_size(16383) == 2);
+        CHECK(varint_size(16384) == 3);
+        CHECK(varint_size(UINT64_MAX) == 10);
+    }
+
+    void test_varint_truncated() {
+        std::vector<char> buf;
+        Protocol::Writer(buf).put_varint(300);
+        buf.pop_back();
+        Protocol::Reader in(buf);
+        in.get_varint();
+        CHECK(!in.ok());
+    }
+
+    // Eleven continuation bytes can't be a 64-bit value
+    void test_varint_overlong() {
+        std::vector<char> buf(11, (char)0x80);
+        buf.push_back(0);
+        Protocol::Reader in(buf);
+        in.get_varint();
+        CHECK(!in.ok());
+    }
+
+    void test_fixed_fields() {
+        std::vector<char> buf;
+        Protocol::Writer out(buf);
+        out.put_u8(0xAB);
+        out.put_u16(0xBEEF);
+        out.put_u32(0xDEADBEEF);
+        out.put_u64(0x0123456789ABCDEFull);
+        out.put_string("hello");
+
+        Protocol::Reader in(buf);
+        CHECK(in.get_u8() == 0xAB);
+        CHECK(in.get_u16() == 0xBEEF);
+        CHECK(in.get_u32() == 0xDEADBEEF);
+        CHECK(in.get_u64() == 0x0123456789ABCDEFull);
+        CHECK(in.get_string() == "hello");
+        CHECK(in.ok());
+
+        // Reading past the end fails and stays failed
+        in.get_u8();
+        CHECK(!in.ok());
+        CHECK(in.remaining() == 0);
+    }
+
+    // A string whose length prefix runs past the payload
+    void test_string_overrun() {
+        std::vector<char> buf;
+        Protocol::Writer out(buf);
+        out.put_u32(1000);
+        out.put_bytes("abc", 3);
+        Protocol::Reader in(buf);
+        in.get_string();
+        CHECK(!in.ok());
+    }
+
+    struct ListEntry {
+        std::string name;
+        uint64_t size;
+        int64_t mtime;
+        std::string hash;
+    };
+
+    std::vector<char> encode_list(const std::vector<ListEntry>& entries, bool with_hashes) {
+        std::vector<char> buf;
+        Protocol::Writer out(buf);
+        Protocol::ListWriter list(out, with_hashes);
+        for (const ListEntry& e : entries)
+            list.add(e.name, e.size, e.mtime, e.hash);
+        return buf;
+    }
+
+    // Shared prefixes of every length, including none and a whole name,
+    // mtimes going backwards (negative zigzag deltas) and empty names
+    void test_list_round_trip() {
+        const std::vector<ListEntry> entries = {
+            {"", 0, 0, "h0"},
+            {"photos/2024/a.jpg", 1, 1700000000, "h1"},
+            {"photos/2024/b.jpg", 2, 1700000005, "h2"},
+            {"photos/2024/b.jpg.bak", UINT64_MAX, 1600000000, ""},
+            {"photos/2025/a.jpg", 4, -5, "h4"},
+            {"readme", 5, INT64_MAX, "h5"},
+            {"readme", 6, INT64_MIN, "h6"},
+            {"z", 7, 0, std::string(64, 'f')},
+        };
+
+        for (bool with_hashes : {false, true}) {
+            std::vector<char> buf = encode_list(entries, with_hashes);
+            Protocol::Reader in(buf);
+            Protocol::ListReader list(in, with_hashes);
+            for (const ListEntry& e : entries) {
+                std::string name, hash;
+                uint64_t size = 0;
+                int64_t mtime = 0;
+                CHECK(list.next(name, size, mtime, hash));
+                CHECK(name == e.name);
+                CHECK(size == e.size);
+                CHECK(mtime == e.mtime);
+                CHECK(hash == (with_hashes ? e.hash : ""));
+            }
+            CHECK(in.remaining() == 0);
+        }
+    }
+
+    // The shared prefix is not repeated on the wire
+    void test_list_front_coding() {
+        std::string prefix(100, 'x');
+        std::vector<char> buf = encode_list({{prefix + "1", 1, 0, ""}, {prefix + "2", 1, 0, ""}}, false);
+        // First entry: 1+1+101+1+1 bytes; second: 1 (shared=100) + 1 + 1 + 1 + 1
+        CHECK(buf.size() == 105 + 5);
+    }
+
+    // A shared length longer than the previous name is corrupt
+    void test_list_bad_shared() {
+        std::vector<char> buf;
+        Protocol::Writer out(buf);
+        out.put_varint(3);
+        out.put_varint(1);
+        out.put_bytes("a", 1);
+        out.put_varint(0);
+        out.put_varint(0);
+        Protocol::Reader in(buf);
+        Protocol::ListReader list(in, false);
+        std::string name, hash;
+        uint64_t size;
+        int64_t mtime;
+        CHECK(!list.next(name, size, mtime, hash));
+    }
+
+    void test_list_truncated() {
+        std::vector<char> full = encode_list({{"alpha", 10, 5, "hash"}, {"alphabet", 20, 6, "hash2"}}, true);
+        for (size_t cut = 0; cut < full.size(); ++cut) {
+            std::vector<char> buf(full.begin(), full.begin() + cut);
+            Protocol::Reader in(buf);
+            Protocol::ListReader list(in, true);
+            std::string name, hash;
+            uint64_t size;
+            int64_t mtime;
+            int read = 0;
+            while (list.next(name, size, mtime, hash))
+                ++read;
+            CHECK(read < 2);
+        }
+    }
+}
+
+int main() {
+    test_varint_round_trip();
+    test_varint_sizes();
+    test_varint_truncated();
+    test_varint_overlong();
+    test_fixed_fields();
+    test_string_overrun();
+    test_list_round_trip();
+    test_list_front_coding();
+    test_list_bad_shared();
+    test_list_truncated();
+    std::printf("test_protocol: ok\n");
+    return 0;
+}
@@ -0,0 +1,227 @@
+#include "../common/BufferPool.h"
+#include "../common/Checksum.h"
+#include "../common/Log.h"
+#include "../common/Network.h"
+#include "../server/Server.h"
+#include "Check.h"
+
+#include <endian.h>
+#include <netinet/in.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <sodium.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Parallel uploads against a real server in a scratch directory: stripes are
+// staged apart from the .part file, so stat never reports a file with holes
+// as a resumable prefix, and a transfer that fails or finishes with gaps
+// leaves nothing behind.
+namespace {
+    const std::string USER = "alice";
+    const uint64_t STRIPE = 256 * 1024;
+
+    bool write_certificate(const std::string& cert_path, const std::string& key_path) {
+        EVP_PKEY* key = EVP_EC_gen("P-256");
+        X509* cert = X509_new();
+        if (!key || !cert)
+            return false;
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME* name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        bool ok = X509_sign(cert, key, EVP_sha256()) > 0;
+
+        FILE* f = fopen(cert_path.c_str(), "w");
+        ok = ok && f && PEM_write_X509(f, cert) == 1;
+        if (f)
+            fclose(f);
+        f = fopen(key_path.c_str(), "w");
+        ok = ok && f && PEM_write_PrivateKey(f, key, nullptr, nullptr, 0, nullptr, nullptr) == 1;
+        if (f)
+            fclose(f);
+        X509_free(cert);
+        EVP_PKEY_free(key);
+        return ok;
+    }
+
+    int free_port() {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        CHECK(fd != -1);
+        CHECK(bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        CHECK(getsockname(fd, (sockaddr*)&addr, &len) == 0);
+        close(fd);
+        return ntohs(addr.sin_port);
+    }
+
+    void connect_to(Connection& conn, int port) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons((uint16_t)port);
+        CHECK(fd != -1);
+        CHECK(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        conn = Connection(fd);
+        CHECK(Network::wrap_client_connection(conn) == 0);
+    }
+
+    void command(Connection& conn, const char* name) {
+        char buffer[5] = {};
+        memcpy(buffer, name, 4);
+        CHECK(Network::send_raw(conn, buffer, 5) == 0);
+    }
+
+    std::string reply(Connection& conn) {
+        std::string text;
+        CHECK(Network::recv_string(conn, text, "reply") == 0);
+        return text;
+    }
+
+    std::string login(Connection& conn) {
+        command(conn, "crte");
+        CHECK(Network::send_string(conn, USER, "username") == 0);
+        CHECK(Network::send_string(conn, "password", "password") == 0);
+        CHECK(reply(conn) == "User Created");
+
+        command(conn, "lgin");
+        CHECK(Network::send_string(conn, USER, "username") == 0);
+        CHECK(Network::send_string(conn, "password", "password") == 0);
+        CHECK(reply(conn) == "Login successful");
+        return reply(conn);
+    }
+
+    void send_name(Connection& conn, const std::string& token, const std::string& filename) {
+        CHECK(Network::send_string(conn, token, "token") == 0);
+        CHECK(Network::send_string(conn, filename, "filename") == 0);
+    }
+
+    // sndp for [offset, offset + STRIPE) of a filesize-byte file; returns the feedback
+    std::string stripe(Connection& conn, const std::string& token, const std::string& filename,
+                       uint64_t transfer_id, uint64_t offset, uint64_t filesize, bool corrupt = false) {
+        std::vector<char> data(STRIPE, (char)(offset >> 10));
+        command(conn, "sndp");
+        send_name(conn, token, filename);
+        uint64_t header[4] = { htobe64(transfer_id), htobe64(offset), htobe64(STRIPE), htobe64(filesize) };
+        CHECK(Network::send_raw(conn, header, sizeof(header)) == 0);
+        CHECK(Network::send_raw(conn, data.data(), data.size()) == 0);
+        uint32_t crc = Checksum::crc32c(0, data.data(), data.size());
+        CHECK(Network::send_checksum(conn, corrupt ? crc ^ 1 : crc) == 0);
+        return reply(conn);
+    }
+
+    std::string finish(Connection& conn, const std::string& token, const std::string& filename,
+                       uint64_t transfer_id, uint64_t filesize) {
+        command(conn, "fnsh");
+        send_name(conn, token, filename);
+        uint64_t header[2] = { htobe64(transfer_id), htobe64(filesize) };
+        CHECK(Network::send_raw(conn, header, sizeof(header)) == 0);
+        return reply(conn);
+    }
+
+    uint64_t upload_status(Connection& conn, const std::string& token, const std::string& filename) {
+        command(conn, "stat");
+        send_name(conn, token, filename);
+        uint64_t held = 0;
+        CHECK(Network::recv_all(conn, (char*)&held, sizeof(held)) == (ssize_t)sizeof(held));
+        return be64toh(held);
+    }
+
+    bool exists(const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0;
+    }
+
+    std::string staged(const std::string& filename) {
+        return "server/" + USER + "/." + filename + ".stripes";
+    }
+
+    // A stripe past a gap must not show up as a resumable prefix, and fnsh
+    // throws the transfer away
+    void test_gap(Connection& conn, const std::string& token) {
+        CHECK(stripe(conn, token, "gap.bin", 1, STRIPE, 2 * STRIPE) == "Stripe complete");
+        CHECK(exists(staged("gap.bin")));
+        CHECK(upload_status(conn, token, "gap.bin") == 0);
+
+        CHECK(finish(conn, token, "gap.bin", 1, 2 * STRIPE) == "Upload incomplete");
+        CHECK(upload_status(conn, token, "gap.bin") == 0);
+        CHECK(!exists(staged("gap.bin")));
+        CHECK(!exists("server/" + USER + "/gap.bin"));
+    }
+
+    void test_failed_stripe(Connection& conn, const std::string& token) {
+        CHECK(stripe(conn, token, "bad.bin", 2, 0, 2 * STRIPE) == "Stripe complete");
+        CHECK(stripe(conn, token, "bad.bin", 2, STRIPE, 2 * STRIPE, true) == "Stripe checksum mismatch");
+        CHECK(!exists(staged("bad.bin")));
+        CHECK(upload_status(conn, token, "bad.bin") == 0);
+        CHECK(finish(conn, token, "bad.bin", 2, 2 * STRIPE) == "Upload incomplete");
+    }
+
+    void test_complete(Connection& conn, const std::string& token) {
+        CHECK(stripe(conn, token, "ok.bin", 3, STRIPE, 2 * STRIPE) == "Stripe complete");
+        CHECK(stripe(conn, token, "ok.bin", 3, 0, 2 * STRIPE) == "Stripe complete");
+        CHECK(finish(conn, token, "ok.bin", 3, 2 * STRIPE) == "Upload complete");
+        CHECK(!exists(staged("ok.bin")));
+        struct stat st;
+        CHECK(stat(("server/" + USER + "/ok.bin").c_str(), &st) == 0);
+        CHECK((uint64_t)st.st_size == 2 * STRIPE);
+    }
+}
+
+int main() {
+    CHECK(sodium_init() >= 0);
+    signal(SIGPIPE, SIG_IGN);
+    Log::set_level(Log::Level::Error);
+    setenv("FILESERVER_METRICS_PORT", "0", 1);
+    BufferPool::instance().configure(BufferPool::DEFAULT_CHUNK_SIZE);
+
+    char dir[] = "/tmp/test_stripes_XXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    CHECK(chdir(dir) == 0);
+    CHECK(mkdir("cert", 0700) == 0);
+    CHECK(write_certificate("cert/server-cert.pem", "cert/server-key.pem"));
+    CHECK(Network::init_client_tls(false) == 0);
+
+    int port = free_port();
+    {
+        Server server(port, 4);
+        CHECK(server.initialize());
+        std::thread reactor([&] { server.run(); });
+
+        Connection conn;
+        connect_to(conn, port);
+        std::string token = login(conn);
+        test_gap(conn, token);
+        test_failed_stripe(conn, token);
+        test_complete(conn, token);
+        command(conn, "bye.");
+        Network::close_connection(conn);
+
+        server.stop();
+        reactor.join();
+    }
+    Log::flush();
+
+    CHECK(chdir("/") == 0);
+    std::string cleanup = std::string("rm -rf ") + dir;
+    CHECK(system(cleanup.c_str()) == 0);
+    std::printf("test_stripes: ok\n");
+    return 0;
+}